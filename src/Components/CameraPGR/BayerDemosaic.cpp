@@ -0,0 +1,363 @@
+/*!
+ * \file
+ * \brief Conversions of RAW8 Bayer images
+ * \author Mikolaj Kojdecki
+ */
+
+#include "BayerDemosaic.hpp"
+
+#if CAMERAPGR_X86_SIMD
+#include <immintrin.h>
+#endif
+
+namespace Sources {
+namespace CameraPGR {
+
+namespace {
+
+/*
+ * Every row of a Bayer image holds green samples and samples of one other
+ * colour ("row colour"). At a green sample the row colour is interpolated
+ * horizontally and the remaining colour vertically. At a row-colour sample
+ * green comes from the four direct neighbours and the remaining colour from
+ * the four diagonal ones.
+ *
+ * Averages are computed as rounded pairwise means (pavgb), in scalar code
+ * as well, so that all instruction sets give exactly the same result.
+ */
+
+struct RowLayout {
+	/// Parity of x of green samples
+	int green_parity;
+	/// Row colour is red (otherwise blue)
+	bool red_row;
+};
+
+RowLayout rowLayout(BayerPattern pattern, int y) {
+	RowLayout layout;
+	switch (pattern) {
+	case BAYER_GRBG:
+		layout.green_parity = 0;
+		layout.red_row = true;
+		break;
+	case BAYER_GBRG:
+		layout.green_parity = 0;
+		layout.red_row = false;
+		break;
+	case BAYER_BGGR:
+		layout.green_parity = 1;
+		layout.red_row = false;
+		break;
+	default:
+		layout.green_parity = 1;
+		layout.red_row = true;
+	}
+	if (y & 1) {
+		layout.green_parity = 1 - layout.green_parity;
+		layout.red_row = !layout.red_row;
+	}
+	return layout;
+}
+
+inline unsigned char avg2(unsigned int a, unsigned int b) {
+	return (unsigned char) ((a + b + 1) >> 1);
+}
+
+inline unsigned int absDiff(unsigned int a, unsigned int b) {
+	return a > b ? a - b : b - a;
+}
+
+inline void pixelScalar(const unsigned char * up, const unsigned char * cur, const unsigned char * dn,
+		int x, int cols, const RowLayout & layout, bool edge_aware, unsigned char * out) {
+	// mirror at the borders, which keeps colour of the neighbours
+	const int xl = x > 0 ? x - 1 : (cols > 1 ? 1 : 0);
+	const int xr = x < cols - 1 ? x + 1 : (cols > 1 ? cols - 2 : 0);
+
+	const unsigned char h = avg2(cur[xl], cur[xr]);
+	const unsigned char v = avg2(up[x], dn[x]);
+	unsigned char g, row_colour, other_colour;
+
+	if ((x & 1) == layout.green_parity) {
+		g = cur[x];
+		row_colour = h;
+		other_colour = v;
+	} else {
+		if (edge_aware) {
+			const unsigned int dh = absDiff(cur[xl], cur[xr]);
+			const unsigned int dv = absDiff(up[x], dn[x]);
+			g = dh < dv ? h : (dv < dh ? v : avg2(h, v));
+		} else {
+			g = avg2(h, v);
+		}
+		row_colour = cur[x];
+		other_colour = avg2(avg2(up[xl], up[xr]), avg2(dn[xl], dn[xr]));
+	}
+
+	out[0] = layout.red_row ? other_colour : row_colour;
+	out[1] = g;
+	out[2] = layout.red_row ? row_colour : other_colour;
+}
+
+void rowScalar(const unsigned char * up, const unsigned char * cur, const unsigned char * dn, unsigned char * dst,
+		int x_begin, int x_end, int cols, const RowLayout & layout, bool edge_aware) {
+	for (int x = x_begin; x < x_end; ++x)
+		pixelScalar(up, cur, dn, x, cols, layout, edge_aware, dst + 3 * x);
+}
+
+#if CAMERAPGR_X86_SIMD
+
+CAMERAPGR_TARGET_SSE2 inline __m128i select128(__m128i mask, __m128i a, __m128i b) {
+	return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+/*!
+ * SIMD loops start at x = 1, so the first lane always has odd x.
+ */
+CAMERAPGR_TARGET_SSE2 void rowSSE2(const unsigned char * up, const unsigned char * cur, const unsigned char * dn, unsigned char * dst,
+		int cols, const RowLayout & layout, bool edge_aware) {
+	const __m128i green_mask = layout.green_parity ? _mm_set1_epi16(0x00FF) : _mm_set1_epi16((short) 0xFF00);
+	const __m128i zero = _mm_setzero_si128();
+	unsigned char planes[3][16];
+
+	rowScalar(up, cur, dn, dst, 0, 1, cols, layout, edge_aware);
+
+	int x = 1;
+	for (; x + 16 < cols; x += 16) {
+		const __m128i c = _mm_loadu_si128((const __m128i *) (cur + x));
+		const __m128i w = _mm_loadu_si128((const __m128i *) (cur + x - 1));
+		const __m128i e = _mm_loadu_si128((const __m128i *) (cur + x + 1));
+		const __m128i n = _mm_loadu_si128((const __m128i *) (up + x));
+		const __m128i s = _mm_loadu_si128((const __m128i *) (dn + x));
+
+		const __m128i h = _mm_avg_epu8(w, e);
+		const __m128i v = _mm_avg_epu8(n, s);
+		__m128i g = _mm_avg_epu8(h, v);
+		if (edge_aware) {
+			const __m128i dh = _mm_or_si128(_mm_subs_epu8(w, e), _mm_subs_epu8(e, w));
+			const __m128i dv = _mm_or_si128(_mm_subs_epu8(n, s), _mm_subs_epu8(s, n));
+			const __m128i not_h = _mm_cmpeq_epi8(_mm_subs_epu8(dv, dh), zero);
+			const __m128i not_v = _mm_cmpeq_epi8(_mm_subs_epu8(dh, dv), zero);
+			g = select128(not_h, select128(not_v, g, v), h);
+		}
+		const __m128i diag = _mm_avg_epu8(
+				_mm_avg_epu8(_mm_loadu_si128((const __m128i *) (up + x - 1)), _mm_loadu_si128((const __m128i *) (up + x + 1))),
+				_mm_avg_epu8(_mm_loadu_si128((const __m128i *) (dn + x - 1)), _mm_loadu_si128((const __m128i *) (dn + x + 1))));
+
+		const __m128i green = select128(green_mask, c, g);
+		const __m128i row_colour = select128(green_mask, h, c);
+		const __m128i other_colour = select128(green_mask, v, diag);
+
+		_mm_storeu_si128((__m128i *) planes[0], layout.red_row ? other_colour : row_colour);
+		_mm_storeu_si128((__m128i *) planes[1], green);
+		_mm_storeu_si128((__m128i *) planes[2], layout.red_row ? row_colour : other_colour);
+
+		// SSE2 has no byte shuffle, interleave from L1
+		unsigned char * out = dst + 3 * x;
+		for (int i = 0; i < 16; ++i) {
+			out[3 * i] = planes[0][i];
+			out[3 * i + 1] = planes[1][i];
+			out[3 * i + 2] = planes[2][i];
+		}
+	}
+
+	rowScalar(up, cur, dn, dst, x, cols, cols, layout, edge_aware);
+}
+
+/// pshufb masks building 48 bytes of BGR from 16 bytes of each plane
+const unsigned char interleave_masks[3][3][16] __attribute__((aligned(16))) = {
+	{
+		{ 0x00, 0x80, 0x80, 0x01, 0x80, 0x80, 0x02, 0x80, 0x80, 0x03, 0x80, 0x80, 0x04, 0x80, 0x80, 0x05 },
+		{ 0x80, 0x00, 0x80, 0x80, 0x01, 0x80, 0x80, 0x02, 0x80, 0x80, 0x03, 0x80, 0x80, 0x04, 0x80, 0x80 },
+		{ 0x80, 0x80, 0x00, 0x80, 0x80, 0x01, 0x80, 0x80, 0x02, 0x80, 0x80, 0x03, 0x80, 0x80, 0x04, 0x80 },
+	},
+	{
+		{ 0x80, 0x80, 0x06, 0x80, 0x80, 0x07, 0x80, 0x80, 0x08, 0x80, 0x80, 0x09, 0x80, 0x80, 0x0a, 0x80 },
+		{ 0x05, 0x80, 0x80, 0x06, 0x80, 0x80, 0x07, 0x80, 0x80, 0x08, 0x80, 0x80, 0x09, 0x80, 0x80, 0x0a },
+		{ 0x80, 0x05, 0x80, 0x80, 0x06, 0x80, 0x80, 0x07, 0x80, 0x80, 0x08, 0x80, 0x80, 0x09, 0x80, 0x80 },
+	},
+	{
+		{ 0x80, 0x0b, 0x80, 0x80, 0x0c, 0x80, 0x80, 0x0d, 0x80, 0x80, 0x0e, 0x80, 0x80, 0x0f, 0x80, 0x80 },
+		{ 0x80, 0x80, 0x0b, 0x80, 0x80, 0x0c, 0x80, 0x80, 0x0d, 0x80, 0x80, 0x0e, 0x80, 0x80, 0x0f, 0x80 },
+		{ 0x0a, 0x80, 0x80, 0x0b, 0x80, 0x80, 0x0c, 0x80, 0x80, 0x0d, 0x80, 0x80, 0x0e, 0x80, 0x80, 0x0f },
+	},
+};
+
+CAMERAPGR_TARGET_AVX2 inline void interleave16(__m128i b, __m128i g, __m128i r, unsigned char * out) {
+	for (int k = 0; k < 3; ++k) {
+		const __m128i part = _mm_or_si128(
+				_mm_or_si128(
+						_mm_shuffle_epi8(b, _mm_load_si128((const __m128i *) interleave_masks[k][0])),
+						_mm_shuffle_epi8(g, _mm_load_si128((const __m128i *) interleave_masks[k][1]))),
+				_mm_shuffle_epi8(r, _mm_load_si128((const __m128i *) interleave_masks[k][2])));
+		_mm_storeu_si128((__m128i *) (out + 16 * k), part);
+	}
+}
+
+CAMERAPGR_TARGET_AVX2 inline __m256i select256(__m256i mask, __m256i a, __m256i b) {
+	return _mm256_blendv_epi8(b, a, mask);
+}
+
+CAMERAPGR_TARGET_AVX2 void rowAVX2(const unsigned char * up, const unsigned char * cur, const unsigned char * dn, unsigned char * dst,
+		int cols, const RowLayout & layout, bool edge_aware) {
+	const __m256i green_mask = layout.green_parity ? _mm256_set1_epi16(0x00FF) : _mm256_set1_epi16((short) 0xFF00);
+	const __m256i zero = _mm256_setzero_si256();
+
+	rowScalar(up, cur, dn, dst, 0, 1, cols, layout, edge_aware);
+
+	int x = 1;
+	for (; x + 32 < cols; x += 32) {
+		const __m256i c = _mm256_loadu_si256((const __m256i *) (cur + x));
+		const __m256i w = _mm256_loadu_si256((const __m256i *) (cur + x - 1));
+		const __m256i e = _mm256_loadu_si256((const __m256i *) (cur + x + 1));
+		const __m256i n = _mm256_loadu_si256((const __m256i *) (up + x));
+		const __m256i s = _mm256_loadu_si256((const __m256i *) (dn + x));
+
+		const __m256i h = _mm256_avg_epu8(w, e);
+		const __m256i v = _mm256_avg_epu8(n, s);
+		__m256i g = _mm256_avg_epu8(h, v);
+		if (edge_aware) {
+			const __m256i dh = _mm256_or_si256(_mm256_subs_epu8(w, e), _mm256_subs_epu8(e, w));
+			const __m256i dv = _mm256_or_si256(_mm256_subs_epu8(n, s), _mm256_subs_epu8(s, n));
+			const __m256i not_h = _mm256_cmpeq_epi8(_mm256_subs_epu8(dv, dh), zero);
+			const __m256i not_v = _mm256_cmpeq_epi8(_mm256_subs_epu8(dh, dv), zero);
+			g = select256(not_h, select256(not_v, g, v), h);
+		}
+		const __m256i diag = _mm256_avg_epu8(
+				_mm256_avg_epu8(_mm256_loadu_si256((const __m256i *) (up + x - 1)), _mm256_loadu_si256((const __m256i *) (up + x + 1))),
+				_mm256_avg_epu8(_mm256_loadu_si256((const __m256i *) (dn + x - 1)), _mm256_loadu_si256((const __m256i *) (dn + x + 1))));
+
+		const __m256i green = select256(green_mask, c, g);
+		const __m256i row_colour = select256(green_mask, h, c);
+		const __m256i other_colour = select256(green_mask, v, diag);
+		const __m256i blue = layout.red_row ? other_colour : row_colour;
+		const __m256i red = layout.red_row ? row_colour : other_colour;
+
+		unsigned char * out = dst + 3 * x;
+		interleave16(_mm256_castsi256_si128(blue), _mm256_castsi256_si128(green), _mm256_castsi256_si128(red), out);
+		interleave16(_mm256_extracti128_si256(blue, 1), _mm256_extracti128_si256(green, 1), _mm256_extracti128_si256(red, 1), out + 48);
+	}
+
+	rowScalar(up, cur, dn, dst, x, cols, cols, layout, edge_aware);
+}
+
+/*!
+ * Window means of x in [0, cols - 1), in blocks of 16 while x + 16 < cols.
+ * Returns the first x left for scalar code.
+ */
+CAMERAPGR_TARGET_SSE2 int lumaSSE2(const unsigned char * top, const unsigned char * bottom, unsigned char * dst, int cols) {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i two = _mm_set1_epi16(2);
+	int x = 0;
+	for (; x + 16 < cols; x += 16) {
+		const __m128i a = _mm_loadu_si128((const __m128i *) (top + x));
+		const __m128i b = _mm_loadu_si128((const __m128i *) (top + x + 1));
+		const __m128i c = _mm_loadu_si128((const __m128i *) (bottom + x));
+		const __m128i d = _mm_loadu_si128((const __m128i *) (bottom + x + 1));
+		__m128i lo = _mm_add_epi16(_mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero)),
+				_mm_add_epi16(_mm_unpacklo_epi8(c, zero), _mm_unpacklo_epi8(d, zero)));
+		__m128i hi = _mm_add_epi16(_mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero)),
+				_mm_add_epi16(_mm_unpackhi_epi8(c, zero), _mm_unpackhi_epi8(d, zero)));
+		lo = _mm_srli_epi16(_mm_add_epi16(lo, two), 2);
+		hi = _mm_srli_epi16(_mm_add_epi16(hi, two), 2);
+		_mm_storeu_si128((__m128i *) (dst + x), _mm_packus_epi16(lo, hi));
+	}
+	return x;
+}
+
+/*!
+ * As lumaSSE2, in blocks of 32. Unpacking and packing both work within
+ * 128-bit lanes, so the output comes out in order.
+ */
+CAMERAPGR_TARGET_AVX2 int lumaAVX2(const unsigned char * top, const unsigned char * bottom, unsigned char * dst, int cols) {
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i two = _mm256_set1_epi16(2);
+	int x = 0;
+	for (; x + 32 < cols; x += 32) {
+		const __m256i a = _mm256_loadu_si256((const __m256i *) (top + x));
+		const __m256i b = _mm256_loadu_si256((const __m256i *) (top + x + 1));
+		const __m256i c = _mm256_loadu_si256((const __m256i *) (bottom + x));
+		const __m256i d = _mm256_loadu_si256((const __m256i *) (bottom + x + 1));
+		__m256i lo = _mm256_add_epi16(_mm256_add_epi16(_mm256_unpacklo_epi8(a, zero), _mm256_unpacklo_epi8(b, zero)),
+				_mm256_add_epi16(_mm256_unpacklo_epi8(c, zero), _mm256_unpacklo_epi8(d, zero)));
+		__m256i hi = _mm256_add_epi16(_mm256_add_epi16(_mm256_unpackhi_epi8(a, zero), _mm256_unpackhi_epi8(b, zero)),
+				_mm256_add_epi16(_mm256_unpackhi_epi8(c, zero), _mm256_unpackhi_epi8(d, zero)));
+		lo = _mm256_srli_epi16(_mm256_add_epi16(lo, two), 2);
+		hi = _mm256_srli_epi16(_mm256_add_epi16(hi, two), 2);
+		_mm256_storeu_si256((__m256i *) (dst + x), _mm256_packus_epi16(lo, hi));
+	}
+	return x;
+}
+
+#endif
+
+inline unsigned char windowMean(const unsigned char * top, const unsigned char * bottom, int x) {
+	return (unsigned char) ((top[x] + top[x + 1] + bottom[x] + bottom[x + 1] + 2) >> 2);
+}
+
+}
+
+		void bayerLuma(const unsigned char * src, size_t src_step, unsigned char * dst, size_t dst_step,
+				int rows, int cols, int row_begin, int row_end, SimdLevel simd) {
+			if (rows < 2 || cols < 2) {
+				// no complete window, samples are passed as they are
+				for (int y = row_begin; y < row_end; ++y)
+					for (int x = 0; x < cols; ++x)
+						dst[y * dst_step + x] = src[y * src_step + x];
+				return;
+			}
+
+			for (int y = row_begin; y < row_end; ++y) {
+				const unsigned char * top = src + y * src_step;
+				const unsigned char * bottom = src + (y + 1 < rows ? y + 1 : y - 1) * src_step;
+				unsigned char * out = dst + y * dst_step;
+
+				int x = 0;
+				switch (simd) {
+#if CAMERAPGR_X86_SIMD
+				case SIMD_AVX2:
+					x = lumaAVX2(top, bottom, out, cols);
+					break;
+				case SIMD_SSE2:
+					x = lumaSSE2(top, bottom, out, cols);
+					break;
+#endif
+				default:
+					break;
+				}
+				for (; x < cols - 1; ++x)
+					out[x] = windowMean(top, bottom, x);
+				out[cols - 1] = windowMean(top, bottom, cols - 2);
+			}
+		}
+
+		void demosaicBGR(const unsigned char * src, size_t src_step, unsigned char * dst, size_t dst_step,
+				int rows, int cols, int row_begin, int row_end,
+				BayerPattern pattern, DemosaicMethod method, SimdLevel simd) {
+			const bool edge_aware = method == DEMOSAIC_EDGE_AWARE;
+
+			for (int y = row_begin; y < row_end; ++y) {
+				const int y_up = y > 0 ? y - 1 : (rows > 1 ? 1 : 0);
+				const int y_down = y < rows - 1 ? y + 1 : (rows > 1 ? rows - 2 : 0);
+				const unsigned char * up = src + y_up * src_step;
+				const unsigned char * cur = src + y * src_step;
+				const unsigned char * dn = src + y_down * src_step;
+				unsigned char * out = dst + y * dst_step;
+				const RowLayout layout = rowLayout(pattern, y);
+
+				switch (simd) {
+#if CAMERAPGR_X86_SIMD
+				case SIMD_AVX2:
+					rowAVX2(up, cur, dn, out, cols, layout, edge_aware);
+					break;
+				case SIMD_SSE2:
+					rowSSE2(up, cur, dn, out, cols, layout, edge_aware);
+					break;
+#endif
+				default:
+					rowScalar(up, cur, dn, out, 0, cols, cols, layout, edge_aware);
+				}
+			}
+		}
+
+} //: namespace CameraPGR
+} //: namespace Sources
@@ -0,0 +1,74 @@
+/*!
+ * \file
+ * \brief Conversions of RAW8 Bayer images
+ * \author Mikolaj Kojdecki
+ */
+
+#ifndef BAYERDEMOSAIC_HPP_
+#define BAYERDEMOSAIC_HPP_
+
+#include <cstddef>
+
+#include "SimdSupport.hpp"
+
+namespace Sources {
+namespace CameraPGR {
+
+/*!
+ * Colour filter layout, named after the top-left 2x2 tile.
+ */
+enum BayerPattern {
+	BAYER_RGGB,
+	BAYER_GRBG,
+	BAYER_GBRG,
+	BAYER_BGGR
+};
+
+enum DemosaicMethod {
+	/// Average of the nearest samples of each colour
+	DEMOSAIC_BILINEAR,
+	/// Green interpolated along the direction of the smaller gradient
+	DEMOSAIC_EDGE_AWARE
+};
+
+/*!
+ * Converts rows [row_begin, row_end) of RAW8 image to 8-bit BGR in a single
+ * pass. Neighbours outside the image are mirrored, so bands of one image
+ * may be processed independently (e.g. in parallel) with identical result.
+ *
+ * All instruction sets produce bit-identical output.
+ *
+ * \param src first row of the whole RAW8 image
+ * \param src_step source row size in bytes
+ * \param dst first row of the whole BGR image (rows x cols x 3)
+ * \param dst_step destination row size in bytes
+ */
+void demosaicBGR(const unsigned char * src, size_t src_step, unsigned char * dst, size_t dst_step,
+		int rows, int cols, int row_begin, int row_end,
+		BayerPattern pattern, DemosaicMethod method, SimdLevel simd = bestSimdLevel());
+
+/*!
+ * Converts the whole image.
+ */
+inline void demosaicBGR(const unsigned char * src, size_t src_step, unsigned char * dst, size_t dst_step,
+		int rows, int cols, BayerPattern pattern, DemosaicMethod method, SimdLevel simd = bestSimdLevel()) {
+	demosaicBGR(src, src_step, dst, dst_step, rows, cols, 0, rows, pattern, method, simd);
+}
+
+/*!
+ * Luminance of rows [row_begin, row_end) of RAW8 image without demosaicing:
+ * every 2x2 window holds one red, two green and one blue sample, whatever
+ * the tile, so (R + 2G + B) / 4 is the rounded mean of the window starting
+ * at the pixel. The last row and column take the window on their other side.
+ *
+ * All instruction sets produce bit-identical output.
+ *
+ * \param dst first row of the whole 8-bit image (rows x cols)
+ */
+void bayerLuma(const unsigned char * src, size_t src_step, unsigned char * dst, size_t dst_step,
+		int rows, int cols, int row_begin, int row_end, SimdLevel simd = bestSimdLevel());
+
+} //: namespace CameraPGR
+} //: namespace Sources
+
+#endif /* BAYERDEMOSAIC_HPP_ */
@@ -0,0 +1,195 @@
+/*!
+ * \file
+ * \brief State of one camera handled by CameraPGR_Source
+ * \author Mikolaj Kojdecki
+ */
+
+#ifndef CAMERACHANNEL_HPP_
+#define CAMERACHANNEL_HPP_
+
+#include "DataStream.hpp"
+
+#include "CaptureBackend.hpp"
+#include "CaptureControl.hpp"
+#include "FramePool.hpp"
+#include "FrameQueue.hpp"
+#include "Frame.hpp"
+#include "FrameConverter.hpp"
+#include "Config.hpp"
+#include "EncodedFrame.hpp"
+#include "LatencyHistogram.hpp"
+#include "Mailbox.hpp"
+#include "PropertyCache.hpp"
+#include "RawRecorder.hpp"
+#include "SharedFramePublisher.hpp"
+#include "Undistorter.hpp"
+#include "WorkerPool.hpp"
+
+#include <opencv2/opencv.hpp>
+
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+
+//FlyCapture2 imports
+#include <FlyCapture2.h>
+
+namespace Sources {
+namespace CameraPGR {
+
+/*!
+ * \struct ImageFormat
+ * \brief Image window and pixel format set on a camera.
+ */
+struct ImageFormat {
+	FlyCapture2::GigEImageSettings window;
+	InputFormat input;
+};
+
+/*!
+ * \class CameraChannel
+ * \brief One camera: its backend, buffers, output streams, statistics and
+ * capture thread.
+ *
+ * The camera, its settings and buffers are touched only by the capture
+ * thread of the channel, so channels run independently; other threads reach
+ * it through the mailboxes, the control and the queue. Frames are written to
+ * the output streams (with last_meta and the delivery statistics) by the
+ * thread delivering them - the executor in onStep, the capture or a
+ * conversion thread with event delivery, the matcher for frame sets - one at
+ * a time. Counters read by the statistics are atomic.
+ */
+class CameraChannel {
+public:
+	/*!
+	 * \param index position of the camera in camera_serial
+	 * \param serial serial number, 0 - first camera found on the bus
+	 * \param core CPU core the capture thread is pinned to, -1 - any
+	 */
+	CameraChannel(unsigned int index, unsigned int serial, int core) :
+		index(index), serial(serial), core(core), input_format(INPUT_RGB8), row_converter(0), sdk_demosaic(false), stream_tuned(false), governed_frame_rate(0), next_preview(0),
+		counter_restart(false), delivery_latency_sum(0), delivery_latency_max(0), delivered(0),
+		frames_lost(0), retrieve_errors(0), convert_errors(0), retrieved(0), decimated(0),
+		governor_retrieved(0), governor_delivered(0), governor_lost(0), governor_decimated(0),
+		stats_time(0), stats_cpu_time(0), stats_delivered(0), stats_recorded_bytes(0) {
+		for (int i = 0; i < CaptureControl::STATE_COUNT; ++i)
+			stats_state_time[i] = 0;
+	}
+
+	unsigned int index;
+	unsigned int serial;
+	int core;
+
+	boost::shared_ptr<CaptureBackend> camera;
+	FlyCapture2::CameraInfo info;
+	/// Image window set on the camera, places frames on the sensor
+	FlyCapture2::GigEImageSettings window;
+	/// Format sent by the camera and the conversion chosen for it
+	InputFormat input_format;
+	RowConverter row_converter;
+	bool sdk_demosaic;
+	/// Window and format posted by the component, set by the capture thread between frames with the stream stopped
+	Mailbox<ImageFormat> format_request;
+	/// Transport settings written to the camera when it connects, tuned values included
+	StreamSettings stream;
+	/// Stream tuning is done once, not again on reconnects
+	bool stream_tuned;
+
+	/// Run, pause and stop commands for the capture thread and its state
+	CaptureControl control;
+
+	/// Configuration posted by the component, applied by the capture thread between frames
+	Mailbox<Config> config;
+	/// Posted by one_push_trigger: one-push adjustments run again with the next configuration
+	Mailbox<bool> one_push;
+	/// Frame rate chosen by the rate governor for a free running camera
+	Mailbox<float> governed_rate;
+	/// Frame rate last taken from governed_rate, 0 - frame_rate_mode and frame_rate_value apply
+	float governed_frame_rate;
+	/// Property values last written to the camera
+	PropertyCache properties;
+
+	FramePool pool;
+	/// Buffers of out_preview
+	FramePool preview_pool;
+	/// Time (ns) from which the next preview may be made, rate cap of out_preview
+	boost::uint64_t next_preview;
+	boost::shared_ptr<FrameQueue<Frame> > frames;
+
+	/// Lens distortion removal, used when calibrated
+	Undistorter undistorter;
+	/// BGR frame before undistortion (RAW frames only)
+	cv::Mat distorted;
+
+	/// Recording of raw frames, when record_path is set
+	boost::scoped_ptr<RawRecorder> recorder;
+	/// Ring of converted frames in shared memory, when shm_name is set
+	boost::scoped_ptr<SharedFramePublisher> shared;
+
+	/// Conversion threads, none - frames are converted by the capture thread
+	boost::scoped_ptr<WorkerPool> workers;
+
+	// Output data streams, named out_img etc. for a single camera and out_img_<index> etc. for more
+	Base::DataStreamOut<cv::Mat> out_img;
+	/// Capture information, written right before every frame sent to out_img
+	Base::DataStreamOut<FrameMeta> out_frame_meta;
+	/// Written right after every frame sent to out_img
+	Base::DataStreamOut<Base::UnitType> out_trigger;
+	/// Downscaled frames for visualisation, written after out_trigger
+	Base::DataStreamOut<cv::Mat> out_preview;
+	/// Regions of out_img, out_roi_<name> in order of the names in roi
+	std::vector<boost::shared_ptr<Base::DataStreamOut<cv::Mat> > > out_roi;
+	/// Frames of out_img compressed by the encoding threads, in capture order, when encode_format is set
+	Base::DataStreamOut<EncodedFrame> out_encoded;
+
+	/// Last frame written to out_frame_meta, base for frames_lost and interval
+	FrameMeta last_meta;
+	/// Set on reconnect: the frame counter of the camera starts again, last_meta is no base
+	boost::atomic<bool> counter_restart;
+
+	/// Time from receiving frames from the camera to writing them to out_img
+	boost::atomic<boost::uint64_t> delivery_latency_sum;
+	boost::atomic<boost::uint64_t> delivery_latency_max;
+	boost::atomic<unsigned long> delivered;
+
+	/// Time spent in stages of frame processing
+	LatencyHistogram retrieve_latency;
+	LatencyHistogram convert_latency;
+	LatencyHistogram swap_latency;
+	LatencyHistogram undistort_latency;
+	LatencyHistogram write_latency;
+	/// Time from stopping the stream for a new window or format to the first frame in it
+	LatencyHistogram reconfigure_latency;
+	boost::atomic<unsigned long> frames_lost;
+	unsigned long retrieve_errors;
+	/// Frames the SDK failed to convert, counted by conversion threads
+	boost::atomic<unsigned long> convert_errors;
+	/// Frames received from the camera
+	boost::atomic<unsigned long> retrieved;
+	/// Frames skipped before conversion by the rate governor
+	boost::atomic<unsigned long> decimated;
+
+	/// Time from receiving frames to writing them to the outputs, collected by the rate governor
+	LatencyHistogram lag;
+	/// Counters at the previous decision of the rate governor
+	unsigned long governor_retrieved;
+	unsigned long governor_delivered;
+	unsigned long governor_lost;
+	unsigned long governor_decimated;
+
+	/// State at the time of the previous summary
+	boost::uint64_t stats_time;
+	boost::uint64_t stats_cpu_time;
+	unsigned long stats_delivered;
+	boost::uint64_t stats_state_time[CaptureControl::STATE_COUNT];
+	boost::uint64_t stats_recorded_bytes;
+
+	boost::thread thread;
+};
+
+} //: namespace CameraPGR
+} //: namespace Sources
+
+#endif /* CAMERACHANNEL_HPP_ */
@@ -8,8 +8,16 @@
 #include <string>
 #include <sstream>
 #include <iostream>
+#include <cstdlib>
+#include <algorithm>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
 
 #include "CameraPGR.hpp"
+#include "Timing.hpp"
 #include "Common/Logger.hpp"
 
 #include <boost/bind.hpp>
@@ -20,25 +28,281 @@
 //#include <Image.h>
 
 /***************************** IMPORTANT NOTICE ************************
- * For the time being this component IS NOT WORKING without submitting
- * the serial number of the camera in component configuration (parameter
- * camera_serial). The number can be chcecked on the sticker on the
- * camera or in FlyCap application.
+ * Without the serial number of the camera in component configuration
+ * (parameter camera_serial) the first camera found on the bus is used.
+ * The number can be chcecked on the sticker on the camera or in FlyCap
+ * application.
+ *
+ * camera_serial may list several cameras ("13481977,13481980"), each is
+ * then captured by its own thread and sent to its own out_img_<n> stream.
+ *
+ * Setting camera_url to "synthetic://" replaces the camera with a test
+ * pattern generator (see SyntheticBackend.hpp), e.g. for benchmarking
+ * on machines without a Point Grey camera.
  *
+ * Setting camera_url to "file:///path" replays frames recorded with
+ * record_path (see ReplayBackend.hpp) through the same processing.
  *
+ * Regions set in roi are written to out_roi_<name> streams as views into
+ * the frame of out_img, the streams exist for the names given at start.
  */
 namespace Sources {
 namespace CameraPGR {
 
+namespace {
+
+// steps of the camera window when it shrinks to the regions of interest;
+// 16 columns suit the GigE models, 2 rows keep the Bayer phase
+const int window_step_x = 16;
+const int window_step_y = 2;
+
+BayerPattern bayerPattern(FlyCapture2::BayerTileFormat tile) {
+	switch (tile) {
+	case FlyCapture2::GRBG:
+		return BAYER_GRBG;
+	case FlyCapture2::GBRG:
+		return BAYER_GBRG;
+	case FlyCapture2::BGGR:
+		return BAYER_BGGR;
+	default:
+		return BAYER_RGGB;
+	}
+}
+
+FlyCapture2::PixelFormat sdkPixelFormat(InputFormat format) {
+	switch (format) {
+	case INPUT_RAW8:
+		return FlyCapture2::PIXEL_FORMAT_RAW8;
+	case INPUT_MONO8:
+		return FlyCapture2::PIXEL_FORMAT_MONO8;
+	case INPUT_MONO16:
+		return FlyCapture2::PIXEL_FORMAT_MONO16;
+	case INPUT_RAW16:
+		return FlyCapture2::PIXEL_FORMAT_RAW16;
+	default:
+		return FlyCapture2::PIXEL_FORMAT_RGB;
+	}
+}
+
+SourceImage sourceImage(const FlyCapture2::Image & image) {
+	SourceImage source;
+	source.data = image.GetData();
+	source.step = image.GetStride();
+	source.rows = image.GetRows();
+	source.cols = image.GetCols();
+	source.pattern = bayerPattern(image.GetBayerTileFormat());
+	return source;
+}
+
+// Conversion stages, each writing rows [begin, end) of the frame
+
+bool convertRows(RowConverter convert, const SourceImage & source, unsigned char * dst, size_t dst_step, DemosaicMethod method, SimdLevel simd,
+		int begin, int end) {
+	convert(source, dst, dst_step, method, simd, begin, end);
+	return true;
+}
+
+/*!
+ * The SDK converts the whole frame at once, whatever the rows.
+ */
+bool convertSDK(const FlyCapture2::Image * image, unsigned char * dst, size_t dst_step, boost::atomic<unsigned long> * errors, int, int) {
+	const unsigned int rows = image->GetRows();
+	FlyCapture2::Image bgr(rows, image->GetCols(), dst_step, dst, dst_step * rows, FlyCapture2::PIXEL_FORMAT_BGR);
+	FlyCapture2::Error error = image->Convert(FlyCapture2::PIXEL_FORMAT_BGR, &bgr);
+	if (error != FlyCapture2::PGRERROR_OK)
+	{
+		// a frame the SDK cannot convert is dropped, the next one usually converts
+		if ((*errors)++ % 100 == 0)
+			LOG(LERROR) << "Convert error: " << error.GetDescription() << " (" << *errors << " so far)";
+		return false;
+	}
+	return true;
+}
+
+/*!
+ * With parallel set the whole frame is remapped using OpenCV threads.
+ */
+bool undistortRows(const Undistorter * undistorter, const unsigned char * src, unsigned char * dst, size_t dst_step,
+		bool swap_rb, bool parallel, int begin, int end) {
+	if (parallel)
+		undistorter->apply(src, dst, dst_step, swap_rb);
+	else
+		undistorter->remapRows(src, dst, dst_step, swap_rb, begin, end);
+	return true;
+}
+
+/*!
+ * Runs the last conversion stage on rows [begin, end) and averages blocks
+ * of scale x scale pixels of the result into the preview, strip by strip
+ * while the strip is still in cache, so the frame is not read again.
+ * Bands start at multiples of scale; strip_rows = 0 - kernel converts the
+ * whole frame at once. Rows and columns short of a block are left out.
+ */
+bool previewRows(const WorkerPool::Kernel & convert, const cv::Mat & image, const cv::Mat & preview, int scale, int strip_rows, int begin, int end) {
+	const int strip = strip_rows > 0 ? strip_rows : end - begin;
+	for (int row = begin; row < end; row += strip)
+	{
+		const int last = std::min(end, row + strip);
+		if (!convert(row, last))
+			return false;
+		const int first_block = row / scale;
+		const int last_block = std::min(last / scale, preview.rows);
+		if (last_block > first_block)
+		{
+			cv::Mat out = preview.rowRange(first_block, last_block);
+			cv::resize(image(cv::Range(first_block * scale, last_block * scale), cv::Range(0, preview.cols * scale)), out, out.size(), 0, 0,
+					cv::INTER_AREA);
+		}
+	}
+	return true;
+}
+
+/*!
+ * Runs the last conversion stage on rows [begin, end) and copies them to the
+ * shared memory slot, strip by strip while the strip is still in cache.
+ * strip_rows = 0 - kernel converts the whole frame at once.
+ */
+bool shareRows(const WorkerPool::Kernel & convert, const cv::Mat & image, const cv::Mat & slot, int strip_rows, int begin, int end) {
+	const int strip = strip_rows > 0 ? strip_rows : end - begin;
+	for (int row = begin; row < end; row += strip)
+	{
+		const int last = std::min(end, row + strip);
+		if (!convert(row, last))
+			return false;
+		cv::Mat out = slot.rowRange(row, last);
+		image.rowRange(row, last).copyTo(out);
+	}
+	return true;
+}
+
+/*!
+ * Splits list of values separated with commas, semicolons or spaces.
+ */
+std::vector<std::string> splitList(const std::string & list) {
+	std::vector<std::string> items;
+	std::string::size_type pos = 0;
+	while (pos < list.size()) {
+		std::string::size_type end = list.find_first_of(",; \t", pos);
+		if (end == std::string::npos)
+			end = list.size();
+		if (end > pos)
+			items.push_back(list.substr(pos, end - pos));
+		pos = end + 1;
+	}
+	return items;
+}
+
+std::string streamName(const char * name, const CameraChannel & channel, size_t count) {
+	if (count == 1)
+		return name;
+	std::stringstream ss;
+	ss << name << "_" << channel.index;
+	return ss.str();
+}
+
+/*!
+ * Item of '|' separated list for camera index, the last one for cameras past the end.
+ */
+std::string cameraItem(const std::string & list, size_t index) {
+	std::string::size_type begin = 0;
+	for (size_t i = 0; i < index; ++i) {
+		std::string::size_type next = list.find('|', begin);
+		if (next == std::string::npos)
+			break;
+		begin = next + 1;
+	}
+	return list.substr(begin, list.find('|', begin) - begin);
+}
+
+/// Larger jumps of the frame counter are taken for a restart of the camera, not for lost frames
+const unsigned int max_frame_gap = 1u << 16;
+
+/// Consecutive capture errors after which the camera is reconnected
+const unsigned int reconnect_after = 8;
+
+/*!
+ * Wait before the next attempt after given number of consecutive errors:
+ * none after the first one, then from 1 ms doubling up to 1 s.
+ */
+boost::uint64_t retryDelay(unsigned int failures) {
+	if (failures < 2)
+		return 0;
+	return 1000000ull << std::min(failures - 2, 10u);
+}
+
+/*!
+ * Pins thread to CPU core, no-op for negative core.
+ */
+bool pinThread(boost::thread & thread, int core) {
+	if (core < 0)
+		return true;
+#ifdef __linux__
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+	CPU_SET(core, &cpus);
+	return pthread_setaffinity_np(thread.native_handle(), sizeof(cpus), &cpus) == 0;
+#else
+	return false;
+#endif
+}
+
+}
+
 		CameraPGR_Source::CameraPGR_Source(const std::string & name) :
 		Base::Component(name),
 		camera_url("camera_url", string("null")),
-		camera_serial("camera_serial", 0),
+		camera_serial("camera_serial", string("0")),
+		camera_cores("camera_cores", string("")),
 		pixel_format("pixel_format", string("RGB")),
+		output_format("output_format", string("BGR")),
 		width("width", 1296), //need to rework
 		height("height", 1032),
 		offsetX("offsetX", 0),
 		offsetY("offsetY", 0),
+		demosaic("demosaic", string("bilinear")),
+		simd("simd", string("auto")),
+		buffer_count("buffer_count", 8),
+		packet_size("packet_size", 0),
+		packet_delay("packet_delay", -1),
+		sdk_buffers("sdk_buffers", 0),
+		grab_mode("grab_mode", string("")),
+		grab_timeout("grab_timeout", 0),
+		stream_tune("stream_tune", false),
+		stream_tune_sizes("stream_tune_sizes", string("9000,4500,1500")),
+		stream_tune_delays("stream_tune_delays", string("0,500,2000,8000")),
+		stream_tune_seconds("stream_tune_seconds", 1.0f),
+		queue_policy("queue_policy", string("latest")),
+		queue_size("queue_size", 2),
+		delivery("delivery", string("step")),
+		undistort("undistort", false),
+		camera_matrix("camera_matrix", string("")),
+		dist_coeffs("dist_coeffs", string("")),
+		conversion_threads("conversion_threads", 0),
+		preview_scale("preview_scale", 0),
+		preview_fps("preview_fps", 15),
+		stats_interval("stats_interval", 5),
+		latency_target_ms("latency_target_ms", 0),
+		governor_interval("governor_interval", 1),
+		governor_min_rate("governor_min_rate", 1),
+		encode_format("encode_format", string("")),
+		encode_quality("encode_quality", 90),
+		encode_threads("encode_threads", 2),
+		encode_deadline_ms("encode_deadline_ms", 100),
+		sync("sync", string("off")),
+		sync_tolerance("sync_tolerance", 5),
+		trigger_source("trigger_source", 0),
+		trigger_polarity("trigger_polarity", 0),
+		trigger_delay("trigger_delay", -1),
+		trigger_rate("trigger_rate", 30),
+		record_path("record_path", string("")),
+		record_chunk_mb("record_chunk_mb", 16),
+		record_buffer_mb("record_buffer_mb", 512),
+		shm_name("shm_name", string("")),
+		shm_slots("shm_slots", 4),
+		shm_slot_mb("shm_slot_mb", 0),
+		roi("roi", string("")),
+		roi_crop("roi_crop", false),
+		one_push_trigger("one_push_trigger", false),
 		brightness_mode("brightness_mode", string("previous")),
 		brightness_value("brightness_value", -1),
         exposure_mode("exposure_mode", string("previous")),
@@ -58,7 +322,8 @@ namespace CameraPGR {
 		shutter_mode("shutter_mode", string("previous")),
 		shutter_value("shutter_value", -1),
 		gain_mode("gain_mode", string("previous")),
-		gain_value("gain_value", 0)
+		gain_value("gain_value", 0),
+		applying_config(false), rate_control(RATE_FRAME_RATE), governor_time(0), governed_period(0), decimation_factor(1), input_format(INPUT_RGB8)
 		/* Camera properties:
 		 * BRIGHTNESS
 		 * AUTO_EXPOSURE	AUTO	ONEPUSH
@@ -83,6 +348,7 @@ namespace CameraPGR {
 		 * */{
 			registerProperty(width);
 			registerProperty(height);
+			registerProperty(one_push_trigger);
 			registerProperty(brightness_mode);
 			registerProperty(brightness_value);
 			registerProperty(exposure_mode);
@@ -101,122 +367,553 @@ namespace CameraPGR {
 			registerProperty(gain_value);
 			registerProperty(camera_url);
 			registerProperty(camera_serial);
+			registerProperty(camera_cores);
 			registerProperty(pixel_format);
+			registerProperty(output_format);
 			registerProperty(offsetX);
 			registerProperty(offsetY);
-			
-			changing = false;
+			registerProperty(demosaic);
+			registerProperty(simd);
+			registerProperty(buffer_count);
+			registerProperty(packet_size);
+			registerProperty(packet_delay);
+			registerProperty(sdk_buffers);
+			registerProperty(grab_mode);
+			registerProperty(grab_timeout);
+			registerProperty(stream_tune);
+			registerProperty(stream_tune_sizes);
+			registerProperty(stream_tune_delays);
+			registerProperty(stream_tune_seconds);
+			registerProperty(queue_policy);
+			registerProperty(queue_size);
+			registerProperty(delivery);
+			registerProperty(undistort);
+			registerProperty(camera_matrix);
+			registerProperty(dist_coeffs);
+			registerProperty(conversion_threads);
+			registerProperty(preview_scale);
+			registerProperty(preview_fps);
+			registerProperty(stats_interval);
+			registerProperty(latency_target_ms);
+			registerProperty(governor_interval);
+			registerProperty(governor_min_rate);
+			registerProperty(encode_format);
+			registerProperty(encode_quality);
+			registerProperty(encode_threads);
+			registerProperty(encode_deadline_ms);
+			registerProperty(sync);
+			registerProperty(sync_tolerance);
+			registerProperty(trigger_source);
+			registerProperty(trigger_polarity);
+			registerProperty(trigger_delay);
+			registerProperty(trigger_rate);
+			registerProperty(record_path);
+			registerProperty(record_chunk_mb);
+			registerProperty(record_buffer_mb);
+			registerProperty(shm_name);
+			registerProperty(shm_slots);
+			registerProperty(shm_slot_mb);
+			registerProperty(roi);
+			registerProperty(roi_crop);
+
+			// edits in discode_gui reach the cameras between frames
+			brightness_mode.setCallback(boost::bind(&CameraPGR_Source::onModeChanged, this, _1, _2));
+			brightness_value.setCallback(boost::bind(&CameraPGR_Source::onValueChanged, this, _1, _2));
+			exposure_mode.setCallback(boost::bind(&CameraPGR_Source::onModeChanged, this, _1, _2));
+			exposure_value.setCallback(boost::bind(&CameraPGR_Source::onValueChanged, this, _1, _2));
+			hue_mode.setCallback(boost::bind(&CameraPGR_Source::onModeChanged, this, _1, _2));
+			hue_value.setCallback(boost::bind(&CameraPGR_Source::onValueChanged, this, _1, _2));
+			saturation_mode.setCallback(boost::bind(&CameraPGR_Source::onModeChanged, this, _1, _2));
+			saturation_value.setCallback(boost::bind(&CameraPGR_Source::onValueChanged, this, _1, _2));
+			gamma_mode.setCallback(boost::bind(&CameraPGR_Source::onModeChanged, this, _1, _2));
+			gamma_value.setCallback(boost::bind(&CameraPGR_Source::onValueChanged, this, _1, _2));
+			frame_rate_mode.setCallback(boost::bind(&CameraPGR_Source::onModeChanged, this, _1, _2));
+			frame_rate_value.setCallback(boost::bind(&CameraPGR_Source::onValueChanged, this, _1, _2));
+			shutter_mode.setCallback(boost::bind(&CameraPGR_Source::onModeChanged, this, _1, _2));
+			shutter_value.setCallback(boost::bind(&CameraPGR_Source::onValueChanged, this, _1, _2));
+			gain_mode.setCallback(boost::bind(&CameraPGR_Source::onModeChanged, this, _1, _2));
+			gain_value.setCallback(boost::bind(&CameraPGR_Source::onValueChanged, this, _1, _2));
+			roi.setCallback(boost::bind(&CameraPGR_Source::onRegionsChanged, this, _1, _2));
+			roi_crop.setCallback(boost::bind(&CameraPGR_Source::onCropChanged, this, _1, _2));
+			one_push_trigger.setCallback(boost::bind(&CameraPGR_Source::onOnePushTriggered, this, _1, _2));
+			width.setCallback(boost::bind(&CameraPGR_Source::onWindowChanged, this, _1, _2));
+			height.setCallback(boost::bind(&CameraPGR_Source::onWindowChanged, this, _1, _2));
+			offsetX.setCallback(boost::bind(&CameraPGR_Source::onWindowChanged, this, _1, _2));
+			offsetY.setCallback(boost::bind(&CameraPGR_Source::onWindowChanged, this, _1, _2));
+			pixel_format.setCallback(boost::bind(&CameraPGR_Source::onPixelFormatChanged, this, _1, _2));
 		}
 
 		CameraPGR_Source::~CameraPGR_Source() {
-			ok = false;
-			changing = true;
-			image_thread.join();
-
-			cam.StopCapture();
-			cam.Disconnect();
+			for (size_t i = 0; i < channels.size(); ++i)
+				channels[i]->control.stop();
+			trigger_thread.interrupt();
+			trigger_thread.join();
+			if (frame_sets)
+				frame_sets->close();
+			for (size_t i = 0; i < channels.size(); ++i)
+				if (channels[i]->frames)
+					channels[i]->frames->close();
+			for (size_t i = 0; i < channels.size(); ++i)
+				channels[i]->thread.join();
+			// frames waiting for the encoders or being encoded are dropped
+			encoder.reset();
+
+			for (size_t i = 0; i < channels.size(); ++i) {
+				CameraChannel & channel = *channels[i];
+				// frames still in memory are written with the index
+				if (channel.recorder)
+					channel.recorder->close();
+				// readers see the ring closed
+				if (channel.shared)
+					channel.shared->close();
+				if (channel.camera) {
+					channel.camera->stopCapture();
+					channel.camera->disconnect();
+				}
+			}
 		}
 
 		void CameraPGR_Source::prepareInterface() {
 			// Register data streams, events and event handlers HERE!
 			registerStream("configChange", &configChange);
-			registerStream("out_img", &out_img);
 			registerStream("out_info", &out_info);
+			registerStream("out_frame_set", &out_frame_set);
+
+			// one set of image streams per camera
+			std::vector<std::string> serials = splitList(camera_serial);
+			if (serials.empty())
+				serials.push_back("0");
+			std::vector<std::string> cores = splitList(camera_cores);
+			channels.clear();
+			for (size_t i = 0; i < serials.size(); ++i) {
+				const int core = (i < cores.size()) ? atoi(cores[i].c_str()) : -1;
+				channels.push_back(boost::shared_ptr<CameraChannel>(
+						new CameraChannel(i, strtoul(serials[i].c_str(), NULL, 10), core)));
+			}
+
+			// names of the regions fix their streams, rectangles may change later
+			RegionList regions;
+			std::string error;
+			if (!parseRegions(roi, regions, error))
+				LOG(LERROR) << "Invalid roi: " << error;
+			roi_names.clear();
+			boost::shared_ptr<std::vector<cv::Rect> > rects(new std::vector<cv::Rect>());
+			for (size_t i = 0; i < regions.size(); ++i) {
+				roi_names.push_back(regions[i].name);
+				rects->push_back(regions[i].rect);
+			}
+			roi_rects = rects;
+
+			for (size_t i = 0; i < channels.size(); ++i) {
+				CameraChannel & channel = *channels[i];
+				registerStream(streamName("out_img", channel, channels.size()), &channel.out_img);
+				registerStream(streamName("out_frame_meta", channel, channels.size()), &channel.out_frame_meta);
+				registerStream(streamName("out_trigger", channel, channels.size()), &channel.out_trigger);
+				registerStream(streamName("out_preview", channel, channels.size()), &channel.out_preview);
+				registerStream(streamName("out_encoded", channel, channels.size()), &channel.out_encoded);
+				channel.out_roi.clear();
+				for (size_t r = 0; r < roi_names.size(); ++r) {
+					channel.out_roi.push_back(boost::shared_ptr<Base::DataStreamOut<cv::Mat> >(new Base::DataStreamOut<cv::Mat>()));
+					registerStream(streamName(("out_roi_" + roi_names[r]).c_str(), channel, channels.size()), channel.out_roi.back().get());
+				}
+			}
 			// Register handlers
 			h_onConfigChanged.setup(boost::bind(&CameraPGR_Source::onNewConfig, this));
 			registerHandler("onConfigChanged", &h_onConfigChanged);
 			addDependency("onConfigChanged", &configChange);
+			// no dependencies - called in every step of the executor
+			h_onStep.setup(boost::bind(&CameraPGR_Source::onStep, this));
+			registerHandler("onStep", &h_onStep);
+			addDependency("onStep", NULL);
 
 		}
 
 		bool CameraPGR_Source::onInit() {
-			// TODO odzyskiwanie guid i wybór więcej niż jednej kamery
-			FlyCapture2::Error error;
-			FlyCapture2::BusManager busMgr;
+			// Cameras given as 0 are taken from the bus in order, skipping those listed explicitly
+			bool any_camera = false;
+			for (size_t i = 0; i < channels.size(); ++i)
+				any_camera |= (channels[i]->serial == 0);
+			if (any_camera && channels.size() > 1)
+			{
+				boost::shared_ptr<CaptureBackend> bus(CaptureBackend::create(camera_url));
+				std::vector<unsigned int> found;
+				if (bus && bus->listCameras(found))
+				{
+					for (size_t i = 0; i < channels.size(); ++i)
+						found.erase(std::remove(found.begin(), found.end(), channels[i]->serial), found.end());
+					for (size_t i = 0, next = 0; i < channels.size() && next < found.size(); ++i)
+						if (channels[i]->serial == 0)
+							channels[i]->serial = found[next++];
+				} else
+				{
+					LOG(LWARNING) << "Cannot list cameras" << (bus ? ": " + bus->lastError() : std::string());
+				}
+			}
 
-			FlyCapture2::PGRGuid guid;
-			if(camera_serial != (unsigned int) 0)
-				error = busMgr.GetCameraFromSerialNumber(camera_serial, &guid);
+			event_delivery = (delivery == "event");
+			demosaic_method = (demosaic == "edge") ? DEMOSAIC_EDGE_AWARE : DEMOSAIC_BILINEAR;
+			simd_level = simdLevelFromString(simd);
 
-			// Connect to a camera
-			// According to documentation when guid is null it should connect to first found camera.
-			// Now, the  question is: is guid in this case null? Need to check.
+			// formats are resolved here, the capture loop only calls the chosen converter
+			InputFormat input;
+			if (!inputFormatFromString(pixel_format, input))
+			{
+				LOG(LERROR) << "Unsupported pixel_format: " << std::string(pixel_format);
+				return false;
+			}
+			input_format = input;
+			if (!outputFormatFromString(output_format, output_format_id))
+			{
+				LOG(LERROR) << "Unsupported output_format: " << std::string(output_format);
+				return false;
+			}
+			if (undistort && output_format_id != OUTPUT_BGR8)
+				LOG(LWARNING) << "Undistortion needs BGR output, frames will not be undistorted";
+			LOG(LINFO) << "Converting " << std::string(pixel_format) << " to " << std::string(output_format) << ", kernels: " << simdLevelName(simd_level);
 
-			//God damn it, of course it's not working.
-			error = cam.Connect(&guid);
-			if (error != FlyCapture2::PGRERROR_OK)
+			if (sync != "off")
 			{
-				LOG(LERROR) << "Connect error";
-				//LOG(LERROR) <<  error;
-				//return -1;
+				matcher.reset(new FrameSetMatcher(channels.size(), (boost::uint64_t) (sync_tolerance * 1e6)));
+				frame_sets.reset(new FrameQueue<FrameSet>(queue_size > 0 ? queue_size : 1, queuePolicyFromString(queue_policy)));
 			}
 
-			// Get the camera information
-			// This is held as a member of this class, since it's gonna be static during the execution
-			error = cam.GetCameraInfo(&camInfo);
-			if (error != FlyCapture2::PGRERROR_OK)
+			if (latency_target_ms > 0)
 			{
-				LOG(LERROR) << "GetCameraInfo error";
-				//LOG(LERROR) << error;
-				//return -1;
+				governor.reset(new RateGovernor((boost::uint64_t) (latency_target_ms * 1e6), std::max(0.1f, (float) governor_min_rate)));
+				rate_control = (sync == "software") ? RATE_TRIGGER : (sync == "hardware") ? RATE_DECIMATION : RATE_FRAME_RATE;
+				LOG(LINFO) << "Rate governor: latency target " << latency_target_ms << " ms, acting on "
+						<< (rate_control == RATE_TRIGGER ? "trigger rate" : rate_control == RATE_DECIMATION ? "decimation" : "frame rate");
+			}
+
+			if (!std::string(encode_format).empty())
+			{
+				std::string extension;
+				std::vector<int> params;
+				if (encode_format == "jpeg" || encode_format == "jpg")
+				{
+					extension = ".jpg";
+					params.push_back(cv::IMWRITE_JPEG_QUALITY);
+					params.push_back(std::min(100, std::max(0, (int) encode_quality)));
+				} else if (encode_format == "png")
+				{
+					extension = ".png";
+					// encoding is on the way to every consumer, size matters less than time
+					params.push_back(cv::IMWRITE_PNG_COMPRESSION);
+					params.push_back(1);
+				} else
+				{
+					LOG(LERROR) << "Unsupported encode_format: " << std::string(encode_format);
+					return false;
+				}
+				if (extension == ".jpg" && output_format_id == OUTPUT_MONO16)
+				{
+					LOG(LWARNING) << "JPEG takes 8-bit frames, MONO16 frames are encoded as PNG";
+					extension = ".png";
+					params.clear();
+				}
+				encoder.reset(new FrameEncoder(encode_threads, channels.size(), extension, params,
+						encode_deadline_ms > 0 ? (boost::uint64_t) (encode_deadline_ms * 1e6) : 0,
+						boost::bind(&CameraPGR_Source::publishEncoded, this, _1, _2)));
+				LOG(LINFO) << "Encoding frames to " << extension << " with " << encoder->threads() << " threads, deadline "
+						<< encode_deadline_ms << " ms";
+			}
+
+			// Connecting a GigE camera takes a while, so all cameras are opened at once
+			boost::thread_group openers;
+			for (size_t i = 0; i < channels.size(); ++i)
+				openers.create_thread(boost::bind(&CameraPGR_Source::openCamera, this, channels[i].get()));
+			openers.join_all();
+
+			for (size_t i = 0; i < channels.size(); ++i)
+				if (!channels[i]->camera)
+					return false;
+
+			if (!std::string(record_path).empty())
+			{
+				for (size_t i = 0; i < channels.size(); ++i)
+				{
+					CameraChannel & channel = *channels[i];
+					std::stringstream path;
+					path << std::string(record_path) << "/camera_" << channel.serial << ".pgrraw";
+					channel.recorder.reset(new RawRecorder((size_t) std::max(1, (int) record_chunk_mb) << 20,
+							(size_t) std::max(1, (int) record_buffer_mb) << 20));
+					if (!channel.recorder->open(path.str(), channel.info))
+					{
+						LOG(LERROR) << "Cannot record to " << path.str() << ": " << channel.recorder->lastError();
+						channel.recorder.reset();
+					} else
+						LOG(LNOTICE) << "Recording camera " << channel.serial << " to " << path.str();
+				}
+			}
+
+			if (!std::string(shm_name).empty())
+			{
+				const size_t slot_bytes = (shm_slot_mb > 0) ? (size_t) (shm_slot_mb * (1 << 20))
+						: (size_t) std::max(0, (int) width) * std::max(0, (int) height) * CV_ELEM_SIZE(outputType(output_format_id));
+				for (size_t i = 0; i < channels.size(); ++i)
+				{
+					CameraChannel & channel = *channels[i];
+					const std::string name = streamName(std::string(shm_name).c_str(), channel, channels.size());
+					channel.shared.reset(new SharedFramePublisher());
+					if (!channel.shared->open(name, std::max(2, (int) shm_slots), slot_bytes, channel.info.serialNumber))
+					{
+						LOG(LERROR) << "Cannot create shared memory " << name << ": " << channel.shared->lastError();
+						channel.shared.reset();
+					} else
+						LOG(LNOTICE) << "Camera " << channel.info.serialNumber << " frames in shared memory " << name << ", " << std::max(2, (int) shm_slots)
+								<< " slots of " << slot_bytes << " bytes";
+				}
 			}
 
-			FlyCapture2::GigEImageSettingsInfo imageSettingsInfo;
-			error = cam.GetGigEImageSettingsInfo( &imageSettingsInfo );
-			if (error != FlyCapture2::PGRERROR_OK)
+			// capture threads wait in Idle until onStart
+			for (size_t i = 0; i < channels.size(); ++i)
 			{
-				LOG(LERROR) << "GetGigEImageSettingsInfo error";
-				//LOG(LERROR) << error;
+				CameraChannel & channel = *channels[i];
+				channel.thread = boost::thread(boost::bind(&CameraPGR_Source::captureAndSendImages, this, &channel));
+				if (!pinThread(channel.thread, channel.core))
+					LOG(LWARNING) << "Cannot pin capture thread of camera " << channel.serial << " to core " << channel.core;
+			}
+			if (sync == "software")
+				trigger_thread = boost::thread(boost::bind(&CameraPGR_Source::triggerCameras, this));
+			return true;
+		}
+
+		void CameraPGR_Source::openCamera(CameraChannel * channel) {
+			boost::shared_ptr<CaptureBackend> camera(CaptureBackend::create(camera_url));
+			if (!camera)
+			{
+				LOG(LERROR) << "Unsupported camera_url: " << std::string(camera_url);
+				return;
+			}
+			channel->camera = camera;
+
+			if (undistort && output_format_id == OUTPUT_BGR8)
+			{
+				cv::Mat matrix, coeffs;
+				if (Undistorter::parseMatrix(cameraItem(camera_matrix, channel->index), matrix) && matrix.rows == 3 && matrix.cols == 3
+						&& Undistorter::parseMatrix(cameraItem(dist_coeffs, channel->index), coeffs) && coeffs.rows == 1)
+					channel->undistorter.setCalibration(matrix, coeffs);
+				else
+					LOG(LERROR) << "Invalid camera_matrix or dist_coeffs (camera " << channel->serial << "), frames will not be undistorted";
+			}
+
+			if (conversion_threads > 0)
+				channel->workers.reset(new WorkerPool(conversion_threads));
+
+			// frames held by the encoders do not count against buffers for downstream components
+			channel->pool.resize((buffer_count > 0 ? buffer_count : 1) + (encoder ? encoder->heldFrames() : 0));
+			if (preview_scale > 1)
+				channel->preview_pool.resize(buffer_count > 0 ? buffer_count : 1);
+			channel->frames.reset(new FrameQueue<Frame>(queue_size > 0 ? queue_size : 1, queuePolicyFromString(queue_policy)));
+			channel->stream = streamSettings();
+
+			// the first connection sets the configured format, reconnects the one last applied
+			ImageFormat format;
+			format.input = input_format;
+			format.window = imageWindow(format.input);
+			useImageFormat(*channel, format);
+
+			// a camera that cannot be connected now is retried by the capture thread
+			connectCamera(*channel);
+		}
+
+		bool CameraPGR_Source::connectCamera(CameraChannel & channel) {
+			CaptureBackend * camera = channel.camera.get();
+			// Connect to a camera
+			// With camera_serial = 0 the first camera found on the bus is used.
+			if (!camera->connect(channel.serial))
+			{
+				LOG(LERROR) << "Connect error (camera " << channel.serial << "): " << camera->lastError();
+				return false;
+			}
+
+			// Get the camera information
+			// This is held in the channel, since it's gonna be static during the execution
+			if (!camera->getCameraInfo(channel.info))
+			{
+				LOG(LERROR) << "GetCameraInfo error (camera " << channel.serial << "): " << camera->lastError();
 				//return -1;
 			}
-			FlyCapture2::GigEImageSettings imageSettings;
-			imageSettings.offsetX = offsetX;
-			imageSettings.offsetY = offsetY;
-			imageSettings.height = height;
-			imageSettings.width = width;
-			if(pixel_format == "RAW")
-				imageSettings.pixelFormat = FlyCapture2::PIXEL_FORMAT_RAW8;
-			else if(pixel_format == "RGB" || pixel_format == "RGB8")
-				imageSettings.pixelFormat = FlyCapture2::PIXEL_FORMAT_RGB;
 
 			LOG(LINFO) << "Setting GigE image settings...\n";
 
-			error = cam.SetGigEImageSettings( &imageSettings );
-			if (error != FlyCapture2::PGRERROR_OK)
+			// the window and format of the channel, properties are not read from the capture thread
+			if (!camera->setImageSettings(channel.window))
 			{
-				//LOG(LERROR) << error;
-				LOG(LERROR) << "SetGigEImageSettings error: " << error.GetDescription();
+				LOG(LERROR) << "SetGigEImageSettings error (camera " << channel.serial << "): " << camera->lastError();
 				//return -1;
 			}
 
-			/* and turn on the streamer */
-			error = cam.StartCapture();
-			if (error != FlyCapture2::PGRERROR_OK)
+			if (!camera->setStreamSettings(channel.stream))
+				LOG(LERROR) << "Stream settings error (camera " << channel.serial << "): " << camera->lastError();
+
+			//setting camera properties
+			configureCamera(channel, currentConfig());
+
+			// with the frame rate of the task and before the trigger is armed
+			if (stream_tune && !channel.stream_tuned)
 			{
-				//LOG(LERROR) << error;
-				LOG(LERROR) << "StartCapture error";
-				//return -1;
+				tuneStream(channel);
+				channel.stream_tuned = true;
+			}
+
+			if (sync == "hardware" || sync == "software")
+			{
+				FlyCapture2::TriggerMode trigger;
+				trigger.onOff = true;
+				trigger.mode = 0;
+				trigger.parameter = 0;
+				trigger.polarity = trigger_polarity;
+				// source 7 is the software trigger
+				trigger.source = (sync == "software") ? 7 : trigger_source;
+				if (!camera->setTriggerMode(trigger))
+					LOG(LERROR) << "SetTriggerMode error (camera " << channel.serial << "): " << camera->lastError();
+
+				if (trigger_delay >= 0)
+				{
+					FlyCapture2::Property prop;
+					prop.type = FlyCapture2::TRIGGER_DELAY;
+					prop.onOff = true;
+					prop.autoManualMode = false;
+					prop.absControl = true;
+					prop.absValue = trigger_delay;
+					camera->setProperty(prop);
+				}
 			}
-			ok = true;
-			image_thread = boost::thread(boost::bind(&CameraPGR_Source::captureAndSendImages, this));
+
+			sendCameraInfo(channel.info);
 			return true;
 		}
 
+		StreamSettings CameraPGR_Source::streamSettings() {
+			StreamSettings settings;
+			settings.packet_size = std::max((int) packet_size, 0);
+			settings.packet_delay = std::max((int) packet_delay, -1);
+			settings.buffers = std::max((int) sdk_buffers, 0);
+			if (grab_mode == "drop")
+				settings.grab_mode = FlyCapture2::DROP_FRAMES;
+			else if (grab_mode == "buffer")
+				settings.grab_mode = FlyCapture2::BUFFER_FRAMES;
+			else if (!std::string(grab_mode).empty())
+				LOG(LWARNING) << "Unknown grab_mode " << std::string(grab_mode) << ", SDK default used";
+			if (grab_timeout != 0)
+				settings.grab_timeout = (grab_timeout < 0) ? (int) FlyCapture2::TIMEOUT_INFINITE : (int) grab_timeout;
+			return settings;
+		}
+
+		void CameraPGR_Source::tuneStream(CameraChannel & channel) {
+			std::vector<unsigned int> sizes;
+			std::vector<std::string> items = splitList(stream_tune_sizes);
+			for (size_t i = 0; i < items.size(); ++i)
+				sizes.push_back(strtoul(items[i].c_str(), NULL, 10));
+			std::vector<int> delays;
+			items = splitList(stream_tune_delays);
+			for (size_t i = 0; i < items.size(); ++i)
+				delays.push_back(atoi(items[i].c_str()));
+			if (sizes.empty())
+				sizes.push_back(channel.stream.packet_size);
+			if (delays.empty())
+				delays.push_back(channel.stream.packet_delay);
+
+			// measured free running, the trigger (if any) is armed afterwards
+			FlyCapture2::TriggerMode free_running;
+			free_running.onOff = false;
+			free_running.mode = free_running.parameter = free_running.polarity = free_running.source = 0;
+			channel.camera->setTriggerMode(free_running);
+
+			LOG(LNOTICE) << "Tuning stream of camera " << channel.serial << ", " << sizes.size() * delays.size() << " settings";
+			std::vector<StreamTrial> trials;
+			if (!sweepStream(*channel.camera, sizes, delays, (boost::uint64_t) (stream_tune_seconds * 1e9), trials))
+			{
+				LOG(LERROR) << "Stream tuning error (camera " << channel.serial << "): " << channel.camera->lastError();
+				return;
+			}
+			for (size_t i = 0; i < trials.size(); ++i)
+			{
+				const StreamTrial & trial = trials[i];
+				if (trial.accepted)
+					LOG(LINFO) << "Camera " << channel.serial << " packet size " << trial.packet_size << ", delay " << trial.packet_delay
+							<< ": " << trial.fps << " FPS, failed " << 100.0 * trial.failureRate() << "% of frames";
+				else
+					LOG(LINFO) << "Camera " << channel.serial << " packet size " << trial.packet_size << ", delay " << trial.packet_delay
+							<< " not accepted";
+			}
+
+			const int best = bestTrial(trials);
+			if (best < 0)
+			{
+				LOG(LWARNING) << "No stream setting of camera " << channel.serial << " delivered frames, keeping the configured one";
+				return;
+			}
+			channel.stream.packet_size = trials[best].packet_size;
+			channel.stream.packet_delay = trials[best].packet_delay;
+			if (!channel.camera->setStreamSettings(channel.stream))
+				LOG(LERROR) << "Stream settings error (camera " << channel.serial << "): " << channel.camera->lastError();
+			LOG(LNOTICE) << "Camera " << channel.serial << " stream tuned: packet size " << trials[best].packet_size << ", delay "
+					<< trials[best].packet_delay << ", " << trials[best].fps << " FPS, failed " << 100.0 * trials[best].failureRate() << "% of frames";
+		}
+
 		bool CameraPGR_Source::onFinish() {
+			if (matcher && matcher->totalFrames() > 0)
+				LOG(LINFO) << "Frame sets: " << matcher->totalSets() << ", complete "
+						<< 100.0 * matcher->totalSets() * channels.size() / matcher->totalFrames() << "% of frames";
+			for (size_t i = 0; i < channels.size(); ++i)
+			{
+				const CameraChannel & channel = *channels[i];
+				LOG(LINFO) << "Camera " << channel.info.serialNumber << " frame buffers: " << channel.pool.size()
+						<< ", high-water " << channel.pool.highWater() << ", frames " << channel.pool.acquired()
+						<< ", dropped (pool exhausted) " << channel.pool.exhausted();
+				if (preview_scale > 1)
+					LOG(LINFO) << "Camera " << channel.info.serialNumber << " previews: " << channel.preview_pool.acquired()
+							<< ", skipped (pool exhausted) " << channel.preview_pool.exhausted();
+				if (channel.frames && !event_delivery && !matcher)
+					LOG(LINFO) << "Camera " << channel.info.serialNumber << " frame queue: enqueued " << channel.frames->enqueued()
+							<< ", dropped " << channel.frames->dropped() << ", stale " << channel.frames->stale();
+				if (channel.delivered > 0)
+					LOG(LINFO) << "Camera " << channel.info.serialNumber << " capture to out_img latency ("
+							<< (event_delivery ? "event" : "step") << " delivery): mean "
+							<< channel.delivery_latency_sum / channel.delivered / 1000 << " us, max "
+							<< channel.delivery_latency_max / 1000 << " us";
+
+				std::stringstream states;
+				for (int s = 0; s < CaptureControl::STATE_COUNT; ++s)
+					states << " " << CaptureControl::name((CaptureControl::State) s) << " "
+							<< channel.control.timeIn((CaptureControl::State) s) / 1e9 << " s";
+				LOG(LINFO) << "Camera " << channel.info.serialNumber << " capture thread time in state:" << states.str();
+				if (channel.decimated > 0)
+					LOG(LINFO) << "Camera " << channel.info.serialNumber << " frames skipped by the rate governor: " << channel.decimated;
+				if (encoder)
+				{
+					FrameEncoder::Counters & counters = encoder->counters(channel.index);
+					LOG(LINFO) << "Camera " << channel.info.serialNumber << " encoded frames: " << counters.encoded
+							<< ", late (dropped) " << counters.late << ", queue full (dropped) " << counters.overflow << ", failed " << counters.failed;
+				}
+				if (channel.shared)
+					LOG(LINFO) << "Camera " << channel.info.serialNumber << " shared memory: published " << channel.shared->published()
+							<< " frames, too large " << channel.shared->oversized();
+				if (channel.recorder)
+					LOG(LINFO) << "Camera " << channel.info.serialNumber << " recording: " << channel.recorder->recorded()
+							<< " frames, dropped " << channel.recorder->dropped() << ", write errors " << channel.recorder->writeErrors();
+			}
 			return true;
 		}
 
 		bool CameraPGR_Source::onStop() {
+			for (size_t i = 0; i < channels.size(); ++i)
+				channels[i]->control.pause();
 			return true;
 		}
 
 		bool CameraPGR_Source::onStart() {
 			LOG(LINFO) << "CameraPGR_Source::start()\n";
 			//sendCameraInfo();
+			governor_time = monotonicNanoseconds();
+			for (size_t i = 0; i < channels.size(); ++i)
+				channels[i]->control.run();
 			return true;
 		}
 
-		void CameraPGR_Source::sendCameraInfo() {
+		void CameraPGR_Source::sendCameraInfo(const FlyCapture2::CameraInfo & camInfo) {
 			std::stringstream ss;
 			char macAddress[64];
 			sprintf(
@@ -284,86 +981,594 @@ namespace CameraPGR {
 			//odczytanie własności kamery
 		}
 
-		void CameraPGR_Source::captureAndSendImages() {
-			cv::Mat img;
-			FlyCapture2::Image image;
-			FlyCapture2::Image convertedRawImage;
-			FlyCapture2::Image* imagePointer = 0;
-			FlyCapture2::Error error;
-			unsigned int pair_id = 0;
-			//setting camera properties
-			configure();
-			while (ok) {
-				while(!changing)
+		void CameraPGR_Source::captureAndSendImages(CameraChannel * channel) {
+			// With conversion workers frame N is converted while frame N+1 is retrieved,
+			// so the SDK fills the two images in turns
+			FlyCapture2::Image images[2];
+			int current = 0;
+			bool first_frame = true;
+			bool capturing = false;
+			unsigned int failures = 0;
+			// time the stream was stopped for a new image format, 0 - not reconfiguring
+			boost::uint64_t reconfigure_start = 0;
+			CaptureControl & control = channel->control;
+			CaptureBackend * camera = channel->camera.get();
+			FramePool & pool = channel->pool;
+			WorkerPool * workers = channel->workers.get();
+			channel->stats_time = monotonicNanoseconds();
+			channel->stats_cpu_time = threadCpuNanoseconds();
+			channel->stats_delivered = channel->delivered;
+			for (int i = 0; i < CaptureControl::STATE_COUNT; ++i)
+				channel->stats_state_time[i] = control.timeIn((CaptureControl::State) i);
+			while (!control.stopping()) {
+				//unsigned char *img_frame = NULL;
+				//uint32_t bytes_used;
+
+				if (!control.running())
+				{
+					// the camera stops sending until the component is started again
+					if (workers)
+						workers->wait();
+					if (capturing)
+						camera->stopCapture();
+					capturing = false;
+					control.enter(CaptureControl::IDLE);
+					control.waitWhilePaused();
+					continue;
+				}
+
+				const boost::uint64_t retrieve_start = monotonicNanoseconds();
+				if (stats_interval > 0 && retrieve_start - channel->stats_time >= stats_interval * 1e9)
+					sendStats(*channel, retrieve_start);
+
+				if (failures > 0)
 				{
-					//unsigned char *img_frame = NULL;
-					//uint32_t bytes_used;
+					// repeated errors - wait longer every time instead of spinning on a missing camera
+					control.enter(CaptureControl::RECOVERING);
+					if (!control.sleepFor(retryDelay(failures)))
+						continue;
+					if (failures >= reconnect_after)
+					{
+						if (workers)
+							workers->wait();
+						capturing = false;
+						if (!reconnectCamera(*channel))
+						{
+							++failures;
+							continue;
+						}
+					}
+				}
 
-					// Retrieve an image
-					error = cam.RetrieveBuffer( &image );
-					if (error != FlyCapture2::PGRERROR_OK)
+				// new window or pixel format: the stream is restarted with it, the camera stays connected
+				ImageFormat format;
+				if (channel->format_request.take(format))
+				{
+					control.enter(CaptureControl::RECONFIGURING);
+					// frames in conversion still read the SDK images
+					if (workers)
+						workers->wait();
+					reconfigure_start = monotonicNanoseconds();
+					if (capturing)
+						camera->stopCapture();
+					capturing = false;
+					if (camera->setImageSettings(format.window))
+					{
+						useImageFormat(*channel, format);
+						resizeSharedRing(*channel);
+					}
+					else
+						LOG(LERROR) << "SetGigEImageSettings error (camera " << channel->serial << "), window not changed: " << camera->lastError();
+					first_frame = true;
+				}
+
+				if (!capturing)
+				{
+					/* and turn on the streamer */
+					if (!camera->startCapture())
 					{
-						//PrintError( error );
+						if (failures++ == 0)
+							LOG(LERROR) << "StartCapture error (camera " << channel->serial << "): " << camera->lastError();
 						continue;
 					}
+					capturing = true;
+				}
+
+				// taken before the configuration posted right after it
+				bool repeat;
+				if (channel->one_push.take(repeat))
+					channel->properties.repeatOnePush();
+				float rate;
+				if (channel->governed_rate.take(rate))
+				{
+					control.enter(CaptureControl::RECONFIGURING);
+					governFrameRate(*channel, rate);
+				}
+				// property changes posted since the previous frame
+				Config config;
+				if (channel->config.take(config))
+				{
+					control.enter(CaptureControl::RECONFIGURING);
+					configureCamera(*channel, config);
+				}
+				if (failures == 0)
+					control.enter(CaptureControl::STREAMING);
+
+				// Retrieve an image
+				Frame frame;
+				const FlyCapture2::Image * retrieved = camera->retrieveBuffer(images[current], frame.meta);
+				if (!retrieved)
+				{
+					//PrintError( error );
+					++channel->retrieve_errors;
+					if (++failures == reconnect_after)
+						LOG(LWARNING) << "Camera " << channel->serial << " fails (" << camera->lastError() << "), reconnecting";
+					continue;
+				}
+				frame.meta.received = monotonicNanoseconds();
+				const FlyCapture2::Image & image = *retrieved;
+				++channel->retrieved;
+				frame.meta.offset_x = channel->window.offsetX;
+				frame.meta.offset_y = channel->window.offsetY;
+				channel->retrieve_latency.record(frame.meta.received - retrieve_start);
+				// untouched sensor data, before any conversion
+				if (channel->recorder)
+					channel->recorder->record(image, frame.meta);
+
+				if (failures > 0)
+				{
+					if (failures >= reconnect_after)
+						LOG(LNOTICE) << "Camera " << channel->serial << " recovered after " << failures << " errors";
+					failures = 0;
+					control.enter(CaptureControl::STREAMING);
+				}
+
+				if (reconfigure_start > 0)
+				{
+					channel->reconfigure_latency.record(frame.meta.received - reconfigure_start);
+					LOG(LINFO) << "Camera " << channel->serial << " reconfigured to " << channel->window.width << "x" << channel->window.height
+							<< "+" << channel->window.offsetX << "+" << channel->window.offsetY << " in "
+							<< (frame.meta.received - reconfigure_start) / 1000 << " us";
+					reconfigure_start = 0;
+				}
+				if (first_frame)
+				{
+					LOG(LINFO) << "Camera " << channel->info.serialNumber << " PixFormat: " << image.GetPixelFormat() << ", BitsPerPixel: " << image.GetBitsPerPixel()
+							<< ", DataSize: " << image.GetDataSize() << ", Stride: " << image.GetStride();
+					first_frame = false;
+				}
 
-					if(pixel_format == "RAW")
+				// frames the rate governor has no use for are not converted; every camera keeps the same
+				// exposures, counted by the frame counter of the first camera, or the sets would not match
+				const unsigned int decimation = (rate_control == RATE_DECIMATION) ? decimation_factor.load() : 0;
+				boost::int64_t counter_offset;
+				if (decimation > 1 && matcher->counterOffset(channel->index, counter_offset)
+						&& ((boost::int64_t) frame.meta.frame_counter - counter_offset) % decimation != 0)
+				{
+					++channel->decimated;
+					continue;
+				}
+
+				const int rows = image.GetRows();
+				const int cols = image.GetCols();
+
+				// The SDK buffer is overwritten by the next RetrieveBuffer, so the frame
+				// is written once into a pool buffer that lives as long as downstream needs it.
+				cv::Mat img = pool.acquire(rows, cols, outputType(output_format_id));
+				if (img.empty())
+				{
+					if (pool.exhausted() % 100 == 1)
+						LOG(LWARNING) << "Frame dropped, all " << pool.size() << " buffers in use downstream (" << pool.exhausted() << " drops so far)";
+					continue;
+				}
+
+				// previous frame uses the undistortion buffer and table
+				if (workers)
+					workers->wait();
+
+				std::vector<WorkerPool::Stage> stages;
+				const bool undistorting = channel->undistorter.calibrated();
+				LatencyHistogram * latency = (channel->input_format == INPUT_RGB8) ? &channel->swap_latency : &channel->convert_latency;
+				if (undistorting && channel->input_format == INPUT_RGB8)
+				{
+					// red and blue are swapped while remapping, one pass from the SDK buffer
+					channel->undistorter.prepare(rows, cols, channel->window.offsetX, channel->window.offsetY, image.GetStride());
+					stages.push_back(WorkerPool::Stage(boost::bind(undistortRows, &channel->undistorter, image.GetData(), img.data,
+							img.step[0], true, workers == 0, _1, _2), true, &channel->undistort_latency));
+				} else
+				{
+					// undistortion works on the converted frame, samples of a mosaic cannot be interpolated
+					cv::Mat converted = img;
+					if (undistorting)
 					{
-				        error = image.Convert( FlyCapture2::PIXEL_FORMAT_RGBU, &convertedRawImage );
-				        if (error != FlyCapture2::PGRERROR_OK)
-				        {
-				            //PrintError( error );
-				            //return -1;
-				        	continue;
-				        	//TODO add DisCODe logging about error
-				        }
-				        imagePointer = &convertedRawImage;
+						channel->distorted.create(rows, cols, CV_8UC3);
+						converted = channel->distorted;
+					}
 
+					if (channel->sdk_demosaic)
+					{
+						// Let the SDK write BGR straight into the pool (or undistortion) buffer
+						stages.push_back(WorkerPool::Stage(boost::bind(convertSDK, &image, converted.data, converted.step[0], &channel->convert_errors, _1, _2), false,
+								latency));
 					} else
-			        {
-						imagePointer = &image;
-			        }
+					{
+						stages.push_back(WorkerPool::Stage(boost::bind(convertRows, channel->row_converter, sourceImage(image), converted.data, converted.step[0],
+								demosaic_method, simd_level, _1, _2), true, latency));
+					}
+
+					if (undistorting)
+					{
+						channel->undistorter.prepare(rows, cols, channel->window.offsetX, channel->window.offsetY, converted.step[0]);
+						stages.push_back(WorkerPool::Stage(boost::bind(undistortRows, &channel->undistorter, converted.data, img.data,
+								img.step[0], false, workers == 0, _1, _2), true, &channel->undistort_latency));
+					}
+				}
 
-					unsigned int rowBytes = (double) imagePointer->GetReceivedDataSize() / (double) imagePointer->GetRows();
-					img = cv::Mat(imagePointer->GetRows(), imagePointer->GetCols(), CV_8UC3, imagePointer->GetData(), rowBytes);
-					cvtColor(img, img, CV_RGB2BGR);
+				// remapping on the capture thread uses OpenCV threads on the whole frame
+				const bool whole_frame = !stages.back().banded || (undistorting && !workers);
 
-					out_img.write(img);
+				// other processes get a copy of the rows just converted, made by the thread that converted them
+				if (channel->shared)
+				{
+					boost::uint64_t number;
+					const cv::Mat slot = channel->shared->begin(rows, cols, img.type(), number);
+					if (!slot.empty())
+					{
+						WorkerPool::Stage & last = stages.back();
+						last.kernel = boost::bind(shareRows, last.kernel, cv::Mat(rows, cols, img.type(), img.data, img.step[0]), slot,
+								whole_frame ? 0 : 16, _1, _2);
+						frame.shared_frame = number;
+					} else if (channel->shared->oversized() % 100 == 1)
+						LOG(LWARNING) << "Frame " << cols << "x" << rows << " larger than shared memory slots (shm_slot_mb), not published ("
+								<< channel->shared->oversized() << " so far)";
+				}
 
-					LOG(LDEBUG) << "PixFormat: " << imagePointer->GetPixelFormat();
-					LOG(LDEBUG) << "BitsPerPixel: " << imagePointer->GetBitsPerPixel();
-					LOG(LDEBUG) << "DataSize: " << imagePointer->GetDataSize();
-					LOG(LDEBUG) << "Stride: " << imagePointer->GetStride();
+				// the preview is binned from the output of the last stage, band by band
+				const int scale = preview_scale;
+				if (scale > 1 && rows >= scale && cols >= scale && (preview_fps <= 0 || frame.meta.received >= channel->next_preview))
+				{
+					cv::Mat preview = channel->preview_pool.acquire(rows / scale, cols / scale, img.type());
+					if (!preview.empty())
+					{
+						const boost::uint64_t period = preview_fps > 0 ? (boost::uint64_t) (1e9 / preview_fps) : 0;
+						channel->next_preview = (frame.meta.received < channel->next_preview + period) ? channel->next_preview + period
+								: frame.meta.received + period;
+
+						WorkerPool::Stage & last = stages.back();
+						last.kernel = boost::bind(previewRows, last.kernel, cv::Mat(rows, cols, img.type(), img.data, img.step[0]),
+								cv::Mat(preview.rows, preview.cols, preview.type(), preview.data, preview.step[0]), scale,
+								whole_frame ? 0 : 16 * scale, _1, _2);
+						last.alignment = (scale % 2) ? 2 * scale : scale;
+						frame.preview = preview;
+					}
+				}
 
-					//timestamp?
-					/*ImagePtr image(new Image);
+				frame.image = img;
+				const WorkerPool::Handler deliver = boost::bind(&CameraPGR_Source::deliver, this, channel, frame);
+				if (workers)
+				{
+					workers->start(stages, rows, deliver);
+					current ^= 1;
+				} else
+					WorkerPool::runInline(stages, rows, deliver);
+			}
+			if (workers)
+				workers->wait();
+			control.enter(CaptureControl::STOPPING);
+		}
 
-					 image->height = convertedImage.GetRows();
-					 image->width = convertedImage.GetCols();
-					 image->step = convertedImage.GetStride();
-					 image->encoding = image_encodings::RGB8;
+		bool CameraPGR_Source::reconnectCamera(CameraChannel & channel) {
+			channel.camera->stopCapture();
+			channel.camera->disconnect();
+			// the camera may come back with its default settings
+			channel.properties.clear();
+			// last_meta belongs to the thread writing the outputs, it starts over at the next frame
+			channel.counter_restart = true;
+			return connectCamera(channel);
+		}
 
-					 image->header.stamp = capture_time;
-					 image->header.seq = pair_id;
+		void CameraPGR_Source::deliver(CameraChannel * channel, const Frame & frame) {
+			if (frame.shared_frame >= 0)
+				channel->shared->commit(frame.shared_frame, frame.meta);
+			// encoded once here, whatever happens to the frame in queues and sets
+			if (encoder)
+				encoder->submit(channel->index, frame.image, frame.meta);
 
-					 image->header.frame_id = frame;
+			if (matcher)
+			{
+				FrameSet set;
+				if (matcher->add(channel->index, frame, set))
+				{
+					if (event_delivery)
+						publishSet(set);
+					else
+						frame_sets->push(set);
+				}
+			} else if (event_delivery)
+				publish(*channel, frame);
+			else
+				channel->frames->push(frame);
+		}
 
-					 int data_size = convertedImage.GetDataSize();
+		void CameraPGR_Source::onStep() {
+			// property values are read here, away from the capture threads
+			if (governor)
+			{
+				const boost::uint64_t now = monotonicNanoseconds();
+				if (now - governor_time >= governor_interval * 1e9)
+					governRate(now);
+			}
 
-					 image->data.resize(data_size);
+			for (size_t i = 0; i < channels.size(); ++i)
+			{
+				CameraChannel & channel = *channels[i];
+				Frame frame;
+				if (channel.frames && channel.frames->pop(frame))
+					publish(channel, frame);
+			}
 
-					 memcpy(&image->data[0], convertedImage.GetData(), data_size);
+			FrameSet set;
+			if (frame_sets && frame_sets->pop(set))
+				publishSet(set);
+		}
+
+		void CameraPGR_Source::publish(CameraChannel & channel, const Frame & frame) {
+			FrameMeta meta = frame.meta;
+			trackFrame(channel, meta);
+
+			const boost::uint64_t write_start = monotonicNanoseconds();
+			channel.out_frame_meta.write(meta);
+			channel.out_img.write(frame.image);
+			publishRegions(channel, frame.image, meta);
+			channel.out_trigger.write(Base::UnitType());
+			const boost::uint64_t write_end = monotonicNanoseconds();
+			channel.write_latency.record(write_end - write_start);
+			if (!frame.preview.empty())
+				channel.out_preview.write(frame.preview);
+
+			recordDelivery(channel, frame.meta.received, write_end);
+		}
 
-					 pub.publish(image);
+		void CameraPGR_Source::publishSet(const FrameSet & set) {
+			boost::mutex::scoped_lock lock(set_mutex);
+			FrameSet tracked = set;
+			for (size_t i = 0; i < channels.size(); ++i)
+				trackFrame(*channels[i], tracked.meta[i]);
+
+			const boost::uint64_t write_start = monotonicNanoseconds();
+			out_frame_set.write(tracked);
+			for (size_t i = 0; i < channels.size(); ++i)
+				publishRegions(*channels[i], tracked.images[i], tracked.meta[i]);
+			const boost::uint64_t write_end = monotonicNanoseconds();
+			for (size_t i = 0; i < set.previews.size(); ++i)
+				if (!set.previews[i].empty())
+					channels[i]->out_preview.write(set.previews[i]);
+
+			for (size_t i = 0; i < channels.size(); ++i)
+			{
+				channels[i]->write_latency.record(write_end - write_start);
+				recordDelivery(*channels[i], set.meta[i].received, write_end);
+			}
+		}
 
-					 sendInfo(image, capture_time);*/
-				 }
-			 }
+		void CameraPGR_Source::publishEncoded(unsigned int index, const EncodedFrame & frame) {
+			channels[index]->out_encoded.write(frame);
+		}
+
+		void CameraPGR_Source::publishRegions(CameraChannel & channel, const cv::Mat & image, const FrameMeta & meta) {
+			if (channel.out_roi.empty())
+				return;
+			boost::shared_ptr<const std::vector<cv::Rect> > rects;
+			{
+				boost::mutex::scoped_lock lock(roi_mutex);
+				rects = roi_rects;
+			}
+
+			// regions are in sensor coordinates, the frame starts at the camera window
+			for (size_t i = 0; i < rects->size() && i < channel.out_roi.size(); ++i)
+			{
+				const cv::Rect & region = (*rects)[i];
+				const int x0 = std::max(region.x - (int) meta.offset_x, 0);
+				const int y0 = std::max(region.y - (int) meta.offset_y, 0);
+				const int x1 = std::min(region.x + region.width - (int) meta.offset_x, image.cols);
+				const int y1 = std::min(region.y + region.height - (int) meta.offset_y, image.rows);
+				// header into the shared frame, no pixels are copied
+				if (x1 > x0 && y1 > y0)
+					channel.out_roi[i]->write(image(cv::Rect(x0, y0, x1 - x0, y1 - y0)));
+			}
+		}
+
+		void CameraPGR_Source::trackFrame(CameraChannel & channel, FrameMeta & meta) {
+			FrameMeta & last_meta = channel.last_meta;
+			// a reconnected camera starts counting again
+			const bool restarted = channel.counter_restart.exchange(false);
+			// counters wrap at 32 bits, camera clock every 128 s
+			const unsigned int gap = meta.frame_counter - last_meta.frame_counter;
+			if (channel.delivered > 0 && !restarted && gap > 0 && gap <= max_frame_gap) {
+				meta.frames_lost = gap - 1;
+				const boost::uint64_t wrap = 128 * 1000000000ull;
+				meta.interval = (meta.camera_time + wrap - last_meta.camera_time) % wrap;
+			} else if (channel.delivered > 0) {
+				// counter went back or jumped (camera power-cycled): counting starts over from this frame
+				meta.frames_lost = 0;
+				meta.interval = 0;
+			}
+			last_meta = meta;
+			channel.frames_lost += meta.frames_lost;
+		}
+
+		void CameraPGR_Source::recordDelivery(CameraChannel & channel, boost::uint64_t received, boost::uint64_t written) {
+			const boost::uint64_t latency = written - received;
+			channel.delivery_latency_sum += latency;
+			channel.lag.record(latency);
+			boost::uint64_t max = channel.delivery_latency_max.load(boost::memory_order_relaxed);
+			while (latency > max && !channel.delivery_latency_max.compare_exchange_weak(max, latency, boost::memory_order_relaxed))
+				;
+			++channel.delivered;
+		}
+
+		void CameraPGR_Source::triggerCameras() {
+			const boost::uint64_t period = (boost::uint64_t) (1e9 / (trigger_rate > 0 ? (float) trigger_rate : 30.0f));
+			boost::uint64_t next = monotonicNanoseconds();
+			try {
+				for (;;) {
+					for (size_t i = 0; i < channels.size(); ++i)
+						if (channels[i]->control.state() == CaptureControl::STREAMING && !channels[i]->camera->fireSoftwareTrigger())
+							LOG(LDEBUG) << "FireSoftwareTrigger error (camera " << channels[i]->serial << "): " << channels[i]->camera->lastError();
+					const boost::uint64_t governed = governed_period;
+					next += (governed > 0) ? governed : period;
+					sleepUntilNanoseconds(next);
+				}
+			} catch (boost::thread_interrupted &) {
+			}
+		}
+
+namespace {
+
+void appendStage(std::ostream & os, const char * name, const LatencyHistogram::Summary & summary) {
+	os << "\n  " << name << ": p50 " << summary.p50 / 1000.0 << " us, p99 " << summary.p99 / 1000.0
+			<< " us, max " << summary.max / 1000.0 << " us (" << summary.count << " samples)";
+}
+
+}
+
+		void CameraPGR_Source::sendStats(CameraChannel & channel, boost::uint64_t now) {
+			const double seconds = (now - channel.stats_time) / 1e9;
+			const boost::uint64_t cpu_time = threadCpuNanoseconds();
+			const unsigned long published = channel.delivered;
+			const FramePool & pool = channel.pool;
+
+			std::stringstream ss;
+			ss.setf(std::ios::fixed);
+			ss.precision(1);
+			ss << "CameraPGR " << channel.info.serialNumber << " over " << seconds << " s: "
+					<< (published - channel.stats_delivered) / seconds << " FPS, capture thread CPU "
+					<< 100.0 * (cpu_time - channel.stats_cpu_time) / (now - channel.stats_time) << "%"
+					<< "\n  frames lost " << channel.frames_lost << ", retrieve errors " << channel.retrieve_errors
+					<< ", convert errors " << channel.convert_errors
+					<< ", pool exhausted " << pool.exhausted() << " (high-water " << pool.highWater() << "/" << pool.size() << ")"
+					<< "\n  properties sent " << channel.properties.sent() << ", unchanged " << channel.properties.skipped();
+			if (channel.frames && !event_delivery && !matcher)
+				ss << ", queue dropped " << channel.frames->dropped() << ", stale " << channel.frames->stale();
+			if (matcher && channel.index == 0)
+			{
+				// sets are common to all cameras, reported with the first one
+				const FrameSetMatcher::Stats sets = matcher->collect();
+				ss << "\n  frame sets " << sets.sets << ", complete "
+						<< (sets.frames > 0 ? 100.0 * sets.sets * channels.size() / sets.frames : 0.0)
+						<< "% of frames, unmatched " << sets.unmatched;
+				if (frame_sets && !event_delivery)
+					ss << ", queue dropped " << frame_sets->dropped() << ", stale " << frame_sets->stale();
+				appendStage(ss, "skew", sets.skew);
+			}
+			appendStage(ss, "retrieve", channel.retrieve_latency.collect());
+			appendStage(ss, "convert", channel.convert_latency.collect());
+			appendStage(ss, "swap", channel.swap_latency.collect());
+			if (channel.undistorter.calibrated())
+				appendStage(ss, "undistort", channel.undistort_latency.collect());
+			appendStage(ss, "write", channel.write_latency.collect());
+			if (governor && channel.index == 0)
+				ss << "\n  rate governor " << governor->rate() << " FPS (ceiling " << governor->ceiling() << ")";
+			if (rate_control == RATE_DECIMATION && governor)
+				ss << "\n  decimated " << channel.decimated << " frames";
+			if (encoder)
+			{
+				FrameEncoder::Counters & counters = encoder->counters(channel.index);
+				ss << "\n  encoded " << counters.encoded << " frames, late " << counters.late << ", queue full " << counters.overflow << ", failed " << counters.failed;
+				appendStage(ss, "encode", counters.latency.collect());
+			}
+			if (channel.shared)
+				ss << "\n  shared memory published " << channel.shared->published() << " frames, too large " << channel.shared->oversized();
+			const LatencyHistogram::Summary reconfigure = channel.reconfigure_latency.collect();
+			if (reconfigure.count > 0)
+				appendStage(ss, "reconfigure", reconfigure);
+			if (channel.recorder)
+			{
+				const RawRecorder & recorder = *channel.recorder;
+				const boost::uint64_t bytes = recorder.bytesWritten();
+				ss << "\n  recorded " << recorder.recorded() << " frames, dropped " << recorder.dropped()
+						<< ", written " << (bytes - channel.stats_recorded_bytes) / seconds / 1e6 << " MB/s, write errors "
+						<< recorder.writeErrors() << ", chunks waiting high-water " << recorder.queueHighWater() << "/" << recorder.chunkCount()
+						<< ", chunks enlarged " << recorder.chunkGrowths() << " times";
+				appendStage(ss, "disk write", channel.recorder->write_latency.collect());
+				channel.stats_recorded_bytes = bytes;
+			}
+
+			ss << "\n  time in state:";
+			for (int i = 0; i < CaptureControl::STATE_COUNT; ++i)
+			{
+				const CaptureControl::State state = (CaptureControl::State) i;
+				const boost::uint64_t time = channel.control.timeIn(state);
+				ss << " " << CaptureControl::name(state) << " " << 100.0 * (time - channel.stats_state_time[i]) / (now - channel.stats_time) << "%";
+				channel.stats_state_time[i] = time;
+			}
+
+			{
+				boost::mutex::scoped_lock lock(info_mutex);
+				out_info.write(ss.str());
+			}
+			LOG(LDEBUG) << ss.str();
+
+			channel.stats_time = now;
+			channel.stats_cpu_time = cpu_time;
+			channel.stats_delivered = published;
+		}
+
+		void CameraPGR_Source::governRate(boost::uint64_t now) {
+			// configured rate, followed at run time; measured from the first frames when cameras choose it
+			if (rate_control == RATE_TRIGGER)
+				governor->setCeiling(trigger_rate > 0 ? (float) trigger_rate : 30.0f);
+			else if (rate_control == RATE_FRAME_RATE && frame_rate_mode == "manual" && frame_rate_value > 0)
+				governor->setCeiling(frame_rate_value);
+
+			RateGovernor::Sample sample;
+			sample.seconds = (now - governor_time) / 1e9;
+			sample.captured_fps = sample.delivered_fps = 0;
+			sample.dropped = 0;
+			sample.latency = 0;
+			for (size_t i = 0; i < channels.size(); ++i)
+			{
+				CameraChannel & channel = *channels[i];
+				const unsigned long retrieved = channel.retrieved;
+				const unsigned long delivered = channel.delivered;
+				const unsigned long lost = channel.frames_lost;
+				const unsigned long decimated = channel.decimated;
+				// gaps in frame counters include frames skipped on purpose
+				const long dropped = (long) (lost - channel.governor_lost) - (long) (decimated - channel.governor_decimated);
+				const double captured_fps = (retrieved - channel.governor_retrieved) / sample.seconds;
+				const double delivered_fps = (delivered - channel.governor_delivered) / sample.seconds;
+				if (i == 0 || captured_fps < sample.captured_fps)
+					sample.captured_fps = captured_fps;
+				if (i == 0 || delivered_fps < sample.delivered_fps)
+					sample.delivered_fps = delivered_fps;
+				sample.dropped += std::max(dropped, 0L);
+				sample.latency = std::max(sample.latency, channel.lag.collect().p99);
+
+				channel.governor_retrieved = retrieved;
+				channel.governor_delivered = delivered;
+				channel.governor_lost = lost;
+				channel.governor_decimated = decimated;
+			}
+			governor_time = now;
+
+			const RateGovernor::Decision decision = governor->update(sample);
+			if (!decision.changed)
+				return;
+			LOG(LNOTICE) << "Rate governor: " << decision.reason;
+			// back at the ceiling triggers and decimation follow the configuration again; a frame rate
+			// stays set, cameras left in "previous" mode would not return to their own
+			governed_period = (decision.rate < governor->ceiling() || rate_control == RATE_FRAME_RATE) ? (boost::uint64_t) (1e9 / decision.rate) : 0;
+			decimation_factor = std::max(1, (int) (governor->ceiling() / decision.rate + 0.5));
+			if (rate_control == RATE_FRAME_RATE)
+				for (size_t i = 0; i < channels.size(); ++i)
+					channels[i]->governed_rate.post(decision.rate);
 		}
 
 		void CameraPGR_Source::onNewConfig() {
-			/* This should be uncommented if you want to automatically modify camera's configuration from other software
-			CameraPGR::Config config = configChange.read();
+			// values from other components land in the properties, as if edited in discode_gui
+			const Config config = configChange.read();
+			// one snapshot for the whole message, not one per property
+			applying_config = true;
 			brightness_mode = config.brightness_mode;
 			brightness_value = config.brightness_value;
 			exposure_mode = config.exposure_mode;
@@ -384,227 +1589,248 @@ namespace CameraPGR {
 			shutter_value = config.shutter_value;
 			gain_mode = config.gain_mode;
 			gain_value = config.gain_value;
-			*/
-			
-			//Above code should be commented if you want to modify camera's configuration using discode_gui
+			applying_config = false;
+
 			configure();
 		}
 
-		void CameraPGR_Source::configure() {
-			changing = true;
-				FlyCapture2::Property prop;
-				if(frame_rate_mode != "previous")
-				{
-
-					prop.type = FlyCapture2::FRAME_RATE;
-					prop.onOff = true;
-					if(frame_rate_mode == "auto")
-						prop.autoManualMode = true;
-					/*else if(frame_rate_mode == "onepush")
-					{
-						prop.autoManualMode = false;
-						prop.onePush = true;
-					}*/
-					else if(frame_rate_mode == "manual" && (int) frame_rate_value != -1)
-					{
-						prop.autoManualMode = false;
-						prop.absControl = true;
-						prop.absValue = frame_rate_value;
-					}
-					cam.SetProperty(&prop);
-				}
-				
-				if(exposure_mode != "previous")
-				{
-
-					prop.type = FlyCapture2::AUTO_EXPOSURE;
-					prop.onOff = true;
-					if(exposure_mode == "auto")
-						prop.autoManualMode = true;
-					else if(exposure_mode == "onepush")
-					{
-						prop.autoManualMode = false;
-						prop.onePush = true;
-					}
-					else if(exposure_mode == "manual" && (int) exposure_value != -1)
-					{
-						prop.autoManualMode = false;
-						prop.absControl = true;
-						prop.absValue = exposure_value;
-					}
-					cam.SetProperty(&prop);
-				}
+		void CameraPGR_Source::onModeChanged(const std::string & old_value, const std::string & new_value) {
+			if (old_value != new_value && !applying_config)
+				configure();
+		}
 
-				if(shutter_mode != "previous")
-				{
+		void CameraPGR_Source::onValueChanged(float old_value, float new_value) {
+			if (old_value != new_value && !applying_config)
+				configure();
+		}
 
-					prop.type = FlyCapture2::SHUTTER;
-					prop.onOff = true;
-					if(shutter_mode == "auto")
-						prop.autoManualMode = true;
-					else if(shutter_mode == "onepush")
-					{
-						prop.autoManualMode = false;
-						prop.onePush = true;
-					}
-					else if(shutter_mode == "manual" && (int) shutter_value != -1)
-					{
-						prop.autoManualMode = false;
-						prop.absControl = true;
-						prop.absValue = shutter_value;
-					}
-					cam.SetProperty(&prop);
-				}
+		void CameraPGR_Source::onRegionsChanged(const std::string & old_value, const std::string & new_value) {
+			// before prepareInterface the regions are read from the property there
+			if (old_value == new_value || channels.empty())
+				return;
 
-				if(gain_mode != "previous")
-				{
+			RegionList regions;
+			std::string error;
+			if (!parseRegions(new_value, regions, error))
+			{
+				LOG(LERROR) << "Invalid roi, regions not changed: " << error;
+				return;
+			}
 
-					prop.type = FlyCapture2::GAIN;
-					prop.onOff = true;
-					if(gain_mode == "auto")
-						prop.autoManualMode = true;
-					else if(gain_mode == "onepush")
-					{
-						prop.autoManualMode = false;
-						prop.onePush = true;
-					}
-					else if(gain_mode == "manual" && (int) gain_value != -1)
-					{
-						prop.autoManualMode = false;
-						prop.absControl = true;
-						prop.absValue = gain_value;
-					}
-					cam.SetProperty(&prop);
-				}
+			// regions left out are not published until they are set again
+			boost::shared_ptr<std::vector<cv::Rect> > rects(new std::vector<cv::Rect>(roi_names.size()));
+			for (size_t i = 0; i < regions.size(); ++i)
+			{
+				const std::vector<std::string>::const_iterator name = std::find(roi_names.begin(), roi_names.end(), regions[i].name);
+				if (name == roi_names.end())
+					LOG(LWARNING) << "Region " << regions[i].name << " has no stream, streams are created at start";
+				else
+					(*rects)[name - roi_names.begin()] = regions[i].rect;
+			}
+			{
+				boost::mutex::scoped_lock lock(roi_mutex);
+				roi_rects = rects;
+			}
+			if (roi_crop)
+				reshape();
+		}
 
-				if(white_balance_mode != "previous")
-				{
+		void CameraPGR_Source::onOnePushTriggered(bool old_value, bool new_value) {
+			if (old_value == new_value)
+				return;
+			for (size_t i = 0; i < channels.size(); ++i)
+				channels[i]->one_push.post(true);
+			configure();
+		}
 
-					prop.type = FlyCapture2::WHITE_BALANCE;
-					prop.onOff = true;
-					if(white_balance_mode == "auto")
-						prop.autoManualMode = true;
-					else if(white_balance_mode == "onepush")
-					{
-						prop.autoManualMode = false;
-						prop.onePush = true;
-					}
-					else if(white_balance_mode == "manual" && (int) white_balance_value != -1)
-					{
-						prop.autoManualMode = false;
-						prop.absControl = true;
-						prop.absValue = white_balance_value;
-					}
-					cam.SetProperty(&prop);
-				}
+		void CameraPGR_Source::onWindowChanged(int old_value, int new_value) {
+			if (old_value != new_value)
+				reshape();
+		}
 
-				if(brightness_mode != "previous")
-				{
+		void CameraPGR_Source::onCropChanged(bool old_value, bool new_value) {
+			if (old_value != new_value)
+				reshape();
+		}
 
-					prop.type = FlyCapture2::BRIGHTNESS;
-					prop.onOff = true;
-					/*if(auto_exposure_mode == "auto")
-						prop.autoManualMode = true;
-					else if(auto_exposure_mode == "onepush")
-					{
-						prop.autoManualMode = false;
-						prop.onePush = true;
-					}
-					else*/ if(brightness_mode == "manual" && (int) brightness_value != -1)
-					{
-						prop.autoManualMode = false;
-						prop.absControl = true;
-						prop.absValue = brightness_value;
-					}
-					cam.SetProperty(&prop);
-				}
+		void CameraPGR_Source::onPixelFormatChanged(const std::string & old_value, const std::string & new_value) {
+			// before onInit the format is resolved there
+			if (old_value == new_value || channels.empty() || !channels[0]->camera)
+				return;
+			InputFormat format;
+			if (!inputFormatFromString(new_value, format))
+			{
+				LOG(LERROR) << "Unsupported pixel_format, format not changed: " << new_value;
+				return;
+			}
+			input_format = format;
+			reshape();
+		}
 
-				if(sharpness_mode != "previous")
-				{
+		void CameraPGR_Source::reshape() {
+			ImageFormat format;
+			format.input = input_format;
+			format.window = imageWindow(format.input);
+			// cameras not opened yet take the settings when they connect
+			for (size_t i = 0; i < channels.size(); ++i)
+				if (channels[i]->camera)
+					channels[i]->format_request.post(format);
+		}
 
-					prop.type = FlyCapture2::SHARPNESS;
-					prop.onOff = true;
-					/*if(auto_exposure_mode == "auto")
-						prop.autoManualMode = true;
-					else if(auto_exposure_mode == "onepush")
-					{
-						prop.autoManualMode = false;
-						prop.onePush = true;
-					}
-					else*/ if(sharpness_mode == "manual" && (int) sharpness_value != -1)
-					{
-						prop.autoManualMode = false;
-						prop.absControl = true;
-						prop.absValue = sharpness_value;
-					}
-					cam.SetProperty(&prop);
-				}
+		void CameraPGR_Source::resizeSharedRing(CameraChannel & channel) {
+			// slots of shm_slot_mb stay, larger frames are skipped and logged
+			if (!channel.shared || shm_slot_mb > 0)
+				return;
+			const size_t slot_bytes = (size_t) channel.window.width * channel.window.height * CV_ELEM_SIZE(outputType(output_format_id));
+			if (slot_bytes <= channel.shared->slotBytes())
+				return;
+			if (channel.shared->reopen(slot_bytes))
+				LOG(LNOTICE) << "Camera " << channel.info.serialNumber << " shared memory created again for the larger window, slots of "
+						<< slot_bytes << " bytes";
+			else
+				LOG(LERROR) << "Cannot create shared memory again (camera " << channel.info.serialNumber << "), frames not published: "
+						<< channel.shared->lastError();
+		}
 
-				if(hue_mode != "previous")
-				{
+		void CameraPGR_Source::useImageFormat(CameraChannel & channel, const ImageFormat & format) {
+			channel.window = format.window;
+			channel.input_format = format.input;
+			channel.row_converter = rowConverter(format.input, output_format_id);
+			channel.sdk_demosaic = (demosaic == "sdk" && format.input == INPUT_RAW8 && output_format_id == OUTPUT_BGR8);
+
+			// while the stream is stopped, so that the first frames allocate nothing
+			const int type = outputType(output_format_id);
+			channel.pool.reserve(format.window.height, format.window.width, type);
+			if (preview_scale > 1)
+				channel.preview_pool.reserve(format.window.height / preview_scale, format.window.width / preview_scale, type);
+		}
 
-					prop.type = FlyCapture2::HUE;
-					prop.onOff = true;
-					/*if(auto_exposure_mode == "auto")
-						prop.autoManualMode = true;
-					else if(auto_exposure_mode == "onepush")
-					{
-						prop.autoManualMode = false;
-						prop.onePush = true;
-					}
-					else*/ if(hue_mode == "manual" && (int) hue_value != -1)
-					{
-						prop.autoManualMode = false;
-						prop.absControl = true;
-						prop.absValue = hue_value;
-					}
-					cam.SetProperty(&prop);
-				}
+		FlyCapture2::GigEImageSettings CameraPGR_Source::imageWindow(InputFormat input) {
+			FlyCapture2::GigEImageSettings settings;
+			settings.offsetX = offsetX;
+			settings.offsetY = offsetY;
+			settings.width = width;
+			settings.height = height;
+			settings.pixelFormat = sdkPixelFormat(input);
+			if (!roi_crop)
+				return settings;
+
+			boost::shared_ptr<const std::vector<cv::Rect> > rects;
+			{
+				boost::mutex::scoped_lock lock(roi_mutex);
+				rects = roi_rects;
+			}
+			if (!rects)
+				return settings;
+			const cv::Rect box = boundingBox(*rects) & cv::Rect(offsetX, offsetY, width, height);
+			if (box.area() <= 0)
+				return settings;
+
+			// grown to the steps of the window, counted from the configured offset
+			const int left = (box.x - offsetX) / window_step_x * window_step_x;
+			const int top = (box.y - offsetY) / window_step_y * window_step_y;
+			const int right = std::min<int>(alignUp(box.x + box.width - offsetX, window_step_x), width);
+			const int bottom = std::min<int>(alignUp(box.y + box.height - offsetY, window_step_y), height);
+			settings.offsetX = offsetX + left;
+			settings.offsetY = offsetY + top;
+			settings.width = right - left;
+			settings.height = bottom - top;
+			return settings;
+		}
 
-				if(saturation_mode != "previous")
-				{
+		Config CameraPGR_Source::currentConfig() {
+			Config config;
+			config.brightness_mode = brightness_mode;
+			config.brightness_value = brightness_value;
+			config.exposure_mode = exposure_mode;
+			config.exposure_value = exposure_value;
+			config.sharpness_mode = sharpness_mode;
+			config.sharpness_value = sharpness_value;
+			config.white_balance_mode = white_balance_mode;
+			config.white_balance_value = white_balance_value;
+			config.hue_mode = hue_mode;
+			config.hue_value = hue_value;
+			config.saturation_mode = saturation_mode;
+			config.saturation_value = saturation_value;
+			config.gamma_mode = gamma_mode;
+			config.gamma_value = gamma_value;
+			config.frame_rate_mode = frame_rate_mode;
+			config.frame_rate_value = frame_rate_value;
+			config.shutter_mode = shutter_mode;
+			config.shutter_value = shutter_value;
+			config.gain_mode = gain_mode;
+			config.gain_value = gain_value;
+			return config;
+		}
 
-					prop.type = FlyCapture2::SATURATION;
-					prop.onOff = true;
-					/*if(auto_exposure_mode == "auto")
-						prop.autoManualMode = true;
-					else if(auto_exposure_mode == "onepush")
-					{
-						prop.autoManualMode = false;
-						prop.onePush = true;
-					}
-					else*/ if(saturation_mode == "manual" && (int) saturation_value != -1)
-					{
-						prop.autoManualMode = false;
-						prop.absControl = true;
-						prop.absValue = saturation_value;
-					}
-					cam.SetProperty(&prop);
-				}
+		void CameraPGR_Source::configure() {
+			// applied by the capture threads between frames
+			const Config config = currentConfig();
+			for (size_t i = 0; i < channels.size(); ++i)
+				channels[i]->config.post(config);
+		}
 
-				if(gamma_mode != "previous")
-				{
+namespace {
 
-					prop.type = FlyCapture2::GAMMA;
-					prop.onOff = true;
-					/*if(auto_exposure_mode == "auto")
-						prop.autoManualMode = true;
-					else if(auto_exposure_mode == "onepush")
-					{
-						prop.autoManualMode = false;
-						prop.onePush = true;
-					}
-					else*/ if(gamma_mode == "manual" && (int) gamma_value != -1)
-					{
-						prop.autoManualMode = false;
-						prop.absControl = true;
-						prop.absValue = gamma_value;
-					}
-					cam.SetProperty(&prop);
-				}
+/*!
+ * Adds property of given mode to props, nothing for "previous" or a mode
+ * the property does not support.
+ */
+void addProperty(std::vector<FlyCapture2::Property> & props, FlyCapture2::PropertyType type, const std::string & mode, float value,
+		bool automatic, bool one_push) {
+	FlyCapture2::Property prop(type);
+	prop.onOff = true;
+	if (mode == "auto" && automatic)
+		prop.autoManualMode = true;
+	else if (mode == "onepush" && one_push)
+	{
+		prop.autoManualMode = false;
+		prop.onePush = true;
+	}
+	else if (mode == "manual" && (int) value != -1)
+	{
+		prop.autoManualMode = false;
+		prop.absControl = true;
+		prop.absValue = value;
+	}
+	else
+		return;
+	props.push_back(prop);
+}
+
+}
+
+		void CameraPGR_Source::configureCamera(CameraChannel & channel, const Config & config) {
+			std::vector<FlyCapture2::Property> props;
+			// the rate governor slows free running cameras down through their frame rate
+			if (channel.governed_frame_rate > 0)
+				addProperty(props, FlyCapture2::FRAME_RATE, "manual", channel.governed_frame_rate, true, false);
+			else
+				addProperty(props, FlyCapture2::FRAME_RATE, config.frame_rate_mode, config.frame_rate_value, true, false);
+			addProperty(props, FlyCapture2::AUTO_EXPOSURE, config.exposure_mode, config.exposure_value, true, true);
+			addProperty(props, FlyCapture2::SHUTTER, config.shutter_mode, config.shutter_value, true, true);
+			addProperty(props, FlyCapture2::GAIN, config.gain_mode, config.gain_value, true, true);
+			addProperty(props, FlyCapture2::WHITE_BALANCE, config.white_balance_mode, config.white_balance_value, true, true);
+			addProperty(props, FlyCapture2::BRIGHTNESS, config.brightness_mode, config.brightness_value, false, false);
+			addProperty(props, FlyCapture2::SHARPNESS, config.sharpness_mode, config.sharpness_value, false, false);
+			addProperty(props, FlyCapture2::HUE, config.hue_mode, config.hue_value, false, false);
+			addProperty(props, FlyCapture2::SATURATION, config.saturation_mode, config.saturation_value, false, false);
+			addProperty(props, FlyCapture2::GAMMA, config.gamma_mode, config.gamma_value, false, false);
+
+			// only properties changed since the last configuration go to the camera
+			for (size_t i = 0; i < props.size(); ++i)
+				if (!channel.properties.apply(*channel.camera, props[i]))
+					LOG(LWARNING) << "SetProperty error (camera " << channel.serial << ", property " << props[i].type << "): "
+							<< channel.camera->lastError();
+		}
 
-			changing = false;
-			sendCameraInfo();
+		void CameraPGR_Source::governFrameRate(CameraChannel & channel, float rate) {
+			// stays manual from now on, cameras left in "previous" mode would not return to their own
+			channel.governed_frame_rate = rate;
+			std::vector<FlyCapture2::Property> props;
+			addProperty(props, FlyCapture2::FRAME_RATE, "manual", rate, true, false);
+			if (!channel.properties.apply(*channel.camera, props[0]))
+				LOG(LWARNING) << "SetProperty error (camera " << channel.serial << ", frame rate " << rate << "): " << channel.camera->lastError();
 		}
 
 } //: namespace CameraPGR
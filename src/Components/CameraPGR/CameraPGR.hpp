@@ -14,14 +14,26 @@
 #include "EventHandler2.hpp"
 
 #include "Config.hpp"
+#include "CaptureBackend.hpp"
+#include "BayerDemosaic.hpp"
+#include "FrameConverter.hpp"
+#include "CameraChannel.hpp"
+#include "FrameSetMatcher.hpp"
+#include "RegionOfInterest.hpp"
+#include "StreamTuner.hpp"
+#include "RateGovernor.hpp"
+#include "FrameEncoder.hpp"
 
 #include <opencv2/opencv.hpp>
 
+#include <vector>
+
 #include <boost/thread.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/atomic.hpp>
 //FlyCapture2 imports
 #include <FlyCapture2.h>
-#include <GigECamera.h>
-#include <BusManager.h>
 #include <Image.h>
 
 namespace Sources {
@@ -74,27 +86,256 @@ protected:
 	 */
 	bool onStop();
 
-	void captureAndSendImages();
+	/*!
+	 * Connects camera of the channel and starts capture. Cameras are
+	 * opened concurrently, one thread per channel.
+	 */
+	void openCamera(CameraChannel * channel);
+
+	/*!
+	 * Connects camera of the channel and writes all its settings, with the
+	 * window and format last applied to the channel. Capture is started by
+	 * the capture thread.
+	 */
+	bool connectCamera(CameraChannel & channel);
+
+	/*!
+	 * Image window for the camera: width, height, offsetX and offsetY,
+	 * shrunk to the regions of interest when roi_crop is set, with the
+	 * pixel format of given input.
+	 */
+	FlyCapture2::GigEImageSettings imageWindow(InputFormat input);
+
+	/*!
+	 * Posts current window and pixel format to all capture threads, which
+	 * restart the stream with them.
+	 */
+	void reshape();
+
+	/*!
+	 * Takes format just set on the camera of the channel: selects the
+	 * conversion and grows frame buffers to the window.
+	 */
+	void useImageFormat(CameraChannel & channel, const ImageFormat & format);
+
+	/*!
+	 * Creates the shared memory ring of the channel again when its window no
+	 * longer fits the slots sized from the window. No frame may be in
+	 * conversion.
+	 */
+	void resizeSharedRing(CameraChannel & channel);
+
+	/*!
+	 * Stream settings given in properties.
+	 */
+	StreamSettings streamSettings();
+
+	/*!
+	 * Measures packet sizes and delays of stream_tune_* on the camera of the
+	 * channel and keeps the best in the channel.
+	 */
+	void tuneStream(CameraChannel & channel);
+
+	/*!
+	 * Drops connection to the camera after repeated errors and connects
+	 * it again.
+	 */
+	bool reconnectCamera(CameraChannel & channel);
+
+	/*!
+	 * Capture thread of the channel, follows commands of its CaptureControl.
+	 */
+	void captureAndSendImages(CameraChannel * channel);
+
+	/*!
+	 * Passes converted frame on: to the frame set matcher, straight to the
+	 * output streams or to the queue emptied by onStep.
+	 */
+	void deliver(CameraChannel * channel, const Frame & frame);
+
+	/*!
+	 * Posts current camera properties to all capture threads.
+	 */
 	void configure();
+
+	/*!
+	 * Writes properties of config to the camera of the channel, skipping
+	 * those already set. Called by the capture thread of the channel.
+	 */
+	void configureCamera(CameraChannel & channel, const Config & config);
+
+	/*!
+	 * Writes frame rate chosen by the rate governor to the camera of the
+	 * channel. Called by the capture thread of the channel.
+	 */
+	void governFrameRate(CameraChannel & channel, float rate);
+
+	/*!
+	 * Camera properties as set in the component.
+	 */
+	Config currentConfig();
 	void sendConfigInfo();
 
+	/*!
+	 * Writes frame to output streams of the channel.
+	 */
+	void publish(CameraChannel & channel, const Frame & frame);
+
+	/*!
+	 * Writes regions of interest of the frame to out_roi_<name> streams of
+	 * the channel, as headers sharing the frame buffer.
+	 */
+	void publishRegions(CameraChannel & channel, const cv::Mat & image, const FrameMeta & meta);
+
+	/*!
+	 * Writes set of frames of all cameras to out_frame_set.
+	 */
+	void publishSet(const FrameSet & set);
+
+	/*!
+	 * Writes encoded frame to out_encoded of the camera. Called by the
+	 * encoding threads, in order of frames of each camera.
+	 */
+	void publishEncoded(unsigned int index, const EncodedFrame & frame);
+
+	/*!
+	 * Fills frames_lost and interval of meta, counts lost frames of the channel.
+	 */
+	void trackFrame(CameraChannel & channel, FrameMeta & meta);
+
+	/*!
+	 * Counts time from receiving frame to writing it to the output.
+	 */
+	void recordDelivery(CameraChannel & channel, boost::uint64_t received, boost::uint64_t written);
+
+	/*!
+	 * Fires software trigger of all cameras at trigger_rate.
+	 */
+	void triggerCameras();
+
+	/*!
+	 * Writes summary of the last stats_interval of the channel to out_info.
+	 */
+	void sendStats(CameraChannel & channel, boost::uint64_t now);
+
+	/*!
+	 * Feeds consumption of all cameras since the previous call to the rate
+	 * governor and applies its decision. Called by the executor in onStep,
+	 * the new rate reaches capture threads through their mailboxes.
+	 */
+	void governRate(boost::uint64_t now);
+
 	// Input data streams
 	Base::DataStreamIn<Config> configChange;
 
-	// Output data streams
-	Base::DataStreamOut<cv::Mat> out_img;
+	// Output data streams (out_img, out_frame_meta and out_trigger belong to CameraChannel)
 	Base::DataStreamOut<string> out_info;
+	/// Frames of all cameras taken at the same time, when sync is on
+	Base::DataStreamOut<FrameSet> out_frame_set;
 
 	// Handlers
 	Base::EventHandler2 h_onConfigChanged;
+	Base::EventHandler2 h_onStep;
 	// Properties
+	/// Camera to use: "null" (Point Grey GigE camera), "synthetic://?..." (see SyntheticBackend) or "file:///..." (see ReplayBackend)
 	Base::Property<string> camera_url;
-	Base::Property<unsigned int> camera_serial;
+	/// Serial numbers of cameras, separated with commas, 0 - any camera found on the bus
+	Base::Property<string> camera_serial;
+	/// CPU cores the capture threads are pinned to, in order of camera_serial, -1 or empty - not pinned
+	Base::Property<string> camera_cores;
+	/// Format sent by the camera: "RGB", "RAW" (Bayer), "MONO", "MONO16" or "RAW16"; may be changed while capturing
 	Base::Property<string> pixel_format;
+	/// Format of out_img: "BGR", "MONO" or "MONO16"
+	Base::Property<string> output_format;
+	/// Image window on the sensor, may be changed while capturing (the stream is restarted, the camera stays connected)
 	Base::Property<int> width;
 	Base::Property<int> height;
 	Base::Property<int> offsetX;
 	Base::Property<int> offsetY;
+	/// RAW to BGR conversion: "bilinear", "edge" (edge-aware) or "sdk" (FlyCapture2 converter)
+	Base::Property<string> demosaic;
+	/// Instruction set of the conversion kernels: "auto" (best supported), "avx2", "sse2" or "scalar"
+	Base::Property<string> simd;
+	/// Number of frame buffers shared with downstream components
+	Base::Property<int> buffer_count;
+	/// GigE stream packet size in bytes, 0 - as set on the camera
+	Base::Property<int> packet_size;
+	/// Delay between stream packets in ticks of 8 ns, -1 - as set on the camera
+	Base::Property<int> packet_delay;
+	/// Frames buffered by the SDK (FC2Config::numBuffers), 0 - SDK default
+	Base::Property<int> sdk_buffers;
+	/// SDK buffering: "drop" (keep the newest frames), "buffer" (keep all) or "" - SDK default
+	Base::Property<string> grab_mode;
+	/// Time (ms) to wait for a frame, -1 - no limit, 0 - SDK default
+	Base::Property<int> grab_timeout;
+	/// Measure stream_tune_sizes x stream_tune_delays when cameras connect and keep the best packet size and delay
+	Base::Property<bool> stream_tune;
+	Base::Property<string> stream_tune_sizes;
+	Base::Property<string> stream_tune_delays;
+	/// Time (s) each setting is measured
+	Base::Property<float> stream_tune_seconds;
+	/// Frames waiting between capture thread and executor: "latest", "drop_oldest" or "block"
+	Base::Property<string> queue_policy;
+	Base::Property<int> queue_size;
+	/// "step" - frames are sent in executor steps, "event" - as soon as they are captured
+	Base::Property<string> delivery;
+	/// Remove lens distortion from frames, using camera_matrix and dist_coeffs
+	Base::Property<bool> undistort;
+	/// Calibration of the full sensor, e.g. "fx 0 cx ; 0 fy cy ; 0 0 1" and "k1 k2 p1 p2 k3";
+	/// with several cameras calibrations of consecutive cameras are separated with '|'
+	Base::Property<string> camera_matrix;
+	Base::Property<string> dist_coeffs;
+	/// Threads converting frames of each camera, 0 - conversion on the capture thread
+	Base::Property<int> conversion_threads;
+	/// Binning factor of out_preview (2 - half width and height), 0 - no preview
+	Base::Property<int> preview_scale;
+	/// Maximal rate (Hz) of out_preview, 0 - every frame
+	Base::Property<float> preview_fps;
+	/// Period (s) of statistics written to out_info, 0 - off
+	Base::Property<float> stats_interval;
+	/// Highest acceptable time (ms) from receiving frames to writing them; the rate governor lowers the frame rate to meet it, 0 - off
+	Base::Property<float> latency_target_ms;
+	/// Period (s) of rate governor decisions
+	Base::Property<float> governor_interval;
+	/// Frame rate the governor never goes below
+	Base::Property<float> governor_min_rate;
+	/// Compression of frames written to out_encoded: "jpeg", "png" or "" - no out_encoded
+	Base::Property<string> encode_format;
+	/// JPEG quality, 0-100 (PNG uses the fastest compression)
+	Base::Property<int> encode_quality;
+	/// Threads encoding frames of all cameras
+	Base::Property<int> encode_threads;
+	/// Frames not encoded within this time (ms) from receiving them are dropped, 0 - no limit
+	Base::Property<float> encode_deadline_ms;
+	/// Synchronized capture: "off", "timestamp" (free running cameras), "hardware" or "software" (triggered)
+	Base::Property<string> sync;
+	/// Maximal difference (ms) of capture times of frames in a set
+	Base::Property<float> sync_tolerance;
+	/// GPIO pin of the external trigger
+	Base::Property<int> trigger_source;
+	/// 0 - falling edge, 1 - rising edge
+	Base::Property<int> trigger_polarity;
+	/// Delay (s) of exposure after trigger, -1 - camera default
+	Base::Property<float> trigger_delay;
+	/// Rate (Hz) of the software trigger
+	Base::Property<float> trigger_rate;
+	/// Directory raw frames are recorded to (camera_<serial>.pgrraw), empty - no recording
+	Base::Property<string> record_path;
+	/// Size (MB) of a single write to the recording
+	Base::Property<int> record_chunk_mb;
+	/// Memory (MB) per camera for frames waiting for the disk
+	Base::Property<int> record_buffer_mb;
+	/// POSIX shared memory ring out_img frames are copied to for other processes (e.g. "/camerapgr", "/camerapgr_<index>"
+	/// with several cameras), read with Types/SharedFrameReader.hpp; empty - none
+	Base::Property<string> shm_name;
+	/// Frames kept in the ring
+	Base::Property<int> shm_slots;
+	/// Largest frame (MB) the ring takes, 0 - width x height of the output format
+	Base::Property<float> shm_slot_mb;
+	/// Named regions of out_img in sensor coordinates, "name:x,y,width,height;...", each written to out_roi_<name>
+	Base::Property<string> roi;
+	/// Shrink the image window of the camera to the bounding box of the regions, for higher frame rates
+	Base::Property<bool> roi_crop;
 	
 	/* Camera properties:
 		 * BRIGHTNESS
@@ -118,6 +359,8 @@ protected:
 		 * 
 		 * Po dwie własności na atrybut, tj. czy auto czy nie i jeśli nie to jaka wartość. Jeśli nie ma wartości to ta z flasha kamery.
 		 * */
+	/// Any change runs one-push adjustments (modes set to "onepush") again; otherwise they run when their property changes
+	Base::Property<bool> one_push_trigger;
 	Base::Property<string> brightness_mode;
 	Base::Property<float> brightness_value;
     Base::Property<string> exposure_mode;
@@ -139,16 +382,68 @@ protected:
 	Base::Property<string> gain_mode;
 	Base::Property<float> gain_value;
 
-	void sendCameraInfo();
+	void sendCameraInfo(const FlyCapture2::CameraInfo & camInfo);
 	// Handlers
 	void onNewConfig();
+	void onModeChanged(const std::string & old_value, const std::string & new_value);
+	void onValueChanged(float old_value, float new_value);
+	void onRegionsChanged(const std::string & old_value, const std::string & new_value);
+	void onWindowChanged(int old_value, int new_value);
+	void onCropChanged(bool old_value, bool new_value);
+	void onOnePushTriggered(bool old_value, bool new_value);
+	void onPixelFormatChanged(const std::string & old_value, const std::string & new_value);
+
+	/*!
+	 * Executor step - passes frame from capture thread to out_img.
+	 */
+	void onStep();
 
 private:
-	bool ok;
-	bool changing;
-	FlyCapture2::GigECamera cam;
-	FlyCapture2::CameraInfo camInfo;
-	boost::thread image_thread;
+	/// One per camera in camera_serial, created in prepareInterface
+	std::vector<boost::shared_ptr<CameraChannel> > channels;
+	bool event_delivery;
+	/// Set while onNewConfig assigns properties, their callbacks leave configure() to it
+	bool applying_config;
+	/// out_info is written by capture threads of all cameras
+	boost::mutex info_mutex;
+
+	/// Frame sets, present when sync is on
+	boost::shared_ptr<FrameSetMatcher> matcher;
+	boost::shared_ptr<FrameQueue<FrameSet> > frame_sets;
+	/// out_frame_set is written by capture threads of all cameras in event delivery
+	boost::mutex set_mutex;
+	boost::thread trigger_thread;
+
+	/// How the rate governor slows the cameras down
+	enum RateControl {
+		/// FRAME_RATE property of free running cameras
+		RATE_FRAME_RATE,
+		/// Period of software triggers
+		RATE_TRIGGER,
+		/// Frames of externally triggered cameras skipped before conversion
+		RATE_DECIMATION
+	};
+	/// Present when latency_target_ms is set, used by the executor
+	boost::scoped_ptr<RateGovernor> governor;
+	RateControl rate_control;
+	boost::uint64_t governor_time;
+	/// Frame period chosen by the governor (ns), 0 - cameras run as configured
+	boost::atomic<boost::uint64_t> governed_period;
+	/// One frame in that many is kept with RATE_DECIMATION
+	boost::atomic<unsigned int> decimation_factor;
+	/// Present when encode_format is set, shared by all cameras
+	boost::scoped_ptr<FrameEncoder> encoder;
+	DemosaicMethod demosaic_method;
+	SimdLevel simd_level;
+	/// Names of regions with streams, fixed in prepareInterface
+	std::vector<std::string> roi_names;
+	/// Current rectangles of the named regions, empty - region not defined; replaced as a whole under roi_mutex
+	boost::shared_ptr<const std::vector<cv::Rect> > roi_rects;
+	boost::mutex roi_mutex;
+	/// pixel_format and output_format, resolved in onInit; input_format follows pixel_format and reaches capture
+	/// threads only through format_request, they use the format last applied to their channel
+	boost::atomic<InputFormat> input_format;
+	OutputFormat output_format_id;
 };
 
 } //: namespace CameraPGR
@@ -0,0 +1,65 @@
+/*!
+ * \file
+ * \brief Capture backend factory
+ * \author Mikolaj Kojdecki
+ */
+
+#include "CaptureBackend.hpp"
+#include "FlyCaptureBackend.hpp"
+#include "ReplayBackend.hpp"
+#include "SyntheticBackend.hpp"
+
+namespace Sources {
+namespace CameraPGR {
+
+		bool parseUrl(const std::string & url, std::string & scheme, std::string & path, std::map<std::string, std::string> & params) {
+			size_t scheme_end = url.find("://");
+			if (scheme_end == std::string::npos)
+				return false;
+
+			scheme = url.substr(0, scheme_end);
+			std::string rest = url.substr(scheme_end + 3);
+
+			size_t query = rest.find('?');
+			path = rest.substr(0, query);
+			params.clear();
+			if (query == std::string::npos)
+				return true;
+
+			std::string::size_type pos = query + 1;
+			while (pos < rest.size()) {
+				std::string::size_type end = rest.find('&', pos);
+				if (end == std::string::npos)
+					end = rest.size();
+				std::string item = rest.substr(pos, end - pos);
+				std::string::size_type eq = item.find('=');
+				if (eq == std::string::npos)
+					params[item] = "";
+				else
+					params[item.substr(0, eq)] = item.substr(eq + 1);
+				pos = end + 1;
+			}
+			return true;
+		}
+
+		CaptureBackend * CaptureBackend::create(const std::string & url) {
+			if (url.empty() || url == "null")
+				return new FlyCaptureBackend();
+
+			std::string scheme, path;
+			std::map<std::string, std::string> params;
+			if (!parseUrl(url, scheme, path, params))
+				return 0;
+
+			if (scheme == "pgr")
+				return new FlyCaptureBackend();
+			if (scheme == "synthetic")
+				return new SyntheticBackend(params);
+			if (scheme == "file")
+				return new ReplayBackend(path, params);
+
+			return 0;
+		}
+
+} //: namespace CameraPGR
+} //: namespace Sources
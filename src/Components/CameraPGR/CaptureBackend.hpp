@@ -0,0 +1,183 @@
+/*!
+ * \file
+ * \brief Interface of the image sources used by CameraPGR_Source
+ * \author Mikolaj Kojdecki
+ */
+
+#ifndef CAPTUREBACKEND_HPP_
+#define CAPTUREBACKEND_HPP_
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <boost/lexical_cast.hpp>
+
+//FlyCapture2 imports
+#include <FlyCapture2.h>
+#include <Image.h>
+
+#include "FrameMeta.hpp"
+
+namespace Sources {
+namespace CameraPGR {
+
+/*!
+ * \struct StreamSettings
+ * \brief Transport of frames from a GigE camera to the host.
+ */
+struct StreamSettings {
+	/// Bytes of a stream packet, headers included, 0 - as set
+	unsigned int packet_size;
+	/// Pause between packets in ticks of the camera clock (8 ns), -1 - as set
+	int packet_delay;
+	/// Frames buffered by the SDK (FC2Config::numBuffers), 0 - as set
+	unsigned int buffers;
+	/// UNSPECIFIED_GRAB_MODE - as set
+	FlyCapture2::GrabMode grab_mode;
+	/// Time (ms) retrieveBuffer waits for a frame, TIMEOUT_INFINITE - no limit, TIMEOUT_UNSPECIFIED - as set
+	int grab_timeout;
+
+	StreamSettings() :
+		packet_size(0), packet_delay(-1), buffers(0), grab_mode(FlyCapture2::UNSPECIFIED_GRAB_MODE),
+		grab_timeout(FlyCapture2::TIMEOUT_UNSPECIFIED) {
+	}
+
+	/*!
+	 * Takes values of other that are not "as set".
+	 */
+	void update(const StreamSettings & other) {
+		if (other.packet_size > 0)
+			packet_size = other.packet_size;
+		if (other.packet_delay >= 0)
+			packet_delay = other.packet_delay;
+		if (other.buffers > 0)
+			buffers = other.buffers;
+		if (other.grab_mode != FlyCapture2::UNSPECIFIED_GRAB_MODE)
+			grab_mode = other.grab_mode;
+		if (other.grab_timeout != FlyCapture2::TIMEOUT_UNSPECIFIED)
+			grab_timeout = other.grab_timeout;
+	}
+};
+
+/*!
+ * \class CaptureBackend
+ * \brief Camera seen by the component.
+ *
+ * The component talks to the camera only through this interface, so the
+ * same capture loop can run against a real Point Grey camera or a camera
+ * simulated in software. FlyCapture2 types are used as the vocabulary,
+ * since they are what the rest of the component is written against.
+ *
+ * All methods return false on failure; description of the last error is
+ * available through lastError().
+ */
+class CaptureBackend {
+public:
+	virtual ~CaptureBackend() {}
+
+	/*!
+	 * Serial numbers of cameras that can be connected, in bus order.
+	 */
+	virtual bool listCameras(std::vector<unsigned int> & serials) = 0;
+
+	/*!
+	 * Connects to camera with given serial number (0 - first camera found).
+	 */
+	virtual bool connect(unsigned int serial) = 0;
+
+	virtual void disconnect() = 0;
+
+	virtual bool getCameraInfo(FlyCapture2::CameraInfo & info) = 0;
+
+	virtual bool setImageSettings(const FlyCapture2::GigEImageSettings & settings) = 0;
+
+	virtual bool startCapture() = 0;
+
+	virtual bool stopCapture() = 0;
+
+	/*!
+	 * Reads all transport settings of the stream.
+	 */
+	virtual bool getStreamSettings(StreamSettings & settings) = 0;
+
+	/*!
+	 * Changes transport settings of the stream, values left "as set" are
+	 * not touched. Called with capture stopped.
+	 */
+	virtual bool setStreamSettings(const StreamSettings & settings) = 0;
+
+	/*!
+	 * Waits for the next frame and returns the image holding it, 0 on
+	 * failure. The SDK fills image; a backend whose frames are already in
+	 * memory returns an image of its own over them instead. The returned
+	 * image is only read; it and its data stay valid until the next call
+	 * with the same image object.
+	 *
+	 * Fills camera side of meta: camera_time, timestamp, frame_counter,
+	 * shutter, gain and embedded values.
+	 */
+	virtual const FlyCapture2::Image * retrieveBuffer(FlyCapture2::Image & image, FrameMeta & meta) = 0;
+
+	/*!
+	 * Arms camera for external or software trigger (mode.onOff) or
+	 * returns it to free running. Source 7 is the software trigger.
+	 */
+	virtual bool setTriggerMode(const FlyCapture2::TriggerMode & mode) = 0;
+
+	/*!
+	 * Starts exposure of a camera armed for software trigger.
+	 */
+	virtual bool fireSoftwareTrigger() = 0;
+
+	virtual bool setProperty(const FlyCapture2::Property & prop) = 0;
+
+	/*!
+	 * Reads property of type prop.type.
+	 */
+	virtual bool getProperty(FlyCapture2::Property & prop) = 0;
+
+	const std::string & lastError() const {
+		return error_message;
+	}
+
+	/*!
+	 * Creates backend selected by camera_url.
+	 *
+	 * "null", empty url or "pgr://" - FlyCapture2 GigE camera,
+	 * "synthetic://?param=value&..." - simulated camera, see SyntheticBackend,
+	 * "file:///path?param=value&..." - recorded sequence, see ReplayBackend.
+	 *
+	 * Returns 0 for unknown schemes.
+	 */
+	static CaptureBackend * create(const std::string & url);
+
+protected:
+	std::string error_message;
+};
+
+/*!
+ * Splits url of form scheme://path?key=value&key=value into its parts.
+ * Returns false if url has no scheme.
+ */
+bool parseUrl(const std::string & url, std::string & scheme, std::string & path, std::map<std::string, std::string> & params);
+
+/*!
+ * Value of url parameter key, def if it is missing or malformed.
+ */
+template <typename T>
+T urlParam(const std::map<std::string, std::string> & params, const std::string & key, T def) {
+	std::map<std::string, std::string>::const_iterator it = params.find(key);
+	if (it == params.end())
+		return def;
+	try {
+		return boost::lexical_cast<T>(it->second);
+	} catch (boost::bad_lexical_cast &) {
+		return def;
+	}
+}
+
+} //: namespace CameraPGR
+} //: namespace Sources
+
+#endif /* CAPTUREBACKEND_HPP_ */
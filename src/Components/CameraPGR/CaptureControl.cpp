@@ -0,0 +1,105 @@
+/*!
+ * \file
+ * \brief State of the capture thread of one camera
+ * \author Mikolaj Kojdecki
+ */
+
+#include <algorithm>
+
+#include "CaptureControl.hpp"
+#include "Timing.hpp"
+
+namespace Sources {
+namespace CameraPGR {
+
+namespace {
+
+/// Longest single wait of sleepFor(), bounds the effect of a wall clock step on the condition variable
+const boost::uint64_t max_wait = 100000000ull;
+
+}
+
+		CaptureControl::CaptureControl() :
+			command(PAUSE), current(IDLE), entered(monotonicNanoseconds()) {
+			for (int i = 0; i < STATE_COUNT; ++i)
+				totals[i] = 0;
+		}
+
+		const char * CaptureControl::name(State state) {
+			switch (state) {
+			case IDLE:
+				return "idle";
+			case STREAMING:
+				return "streaming";
+			case RECONFIGURING:
+				return "reconfiguring";
+			case RECOVERING:
+				return "recovering";
+			case STOPPING:
+				return "stopping";
+			default:
+				return "unknown";
+			}
+		}
+
+		void CaptureControl::run() {
+			give(RUN);
+		}
+
+		void CaptureControl::pause() {
+			give(PAUSE);
+		}
+
+		void CaptureControl::stop() {
+			give(STOP);
+		}
+
+		void CaptureControl::give(Command new_command) {
+			{
+				boost::mutex::scoped_lock lock(mutex);
+				// stop is final
+				if (command != STOP)
+					command = new_command;
+			}
+			changed.notify_all();
+		}
+
+		void CaptureControl::enter(State state) {
+			const int previous = current;
+			if (previous == state)
+				return;
+			const boost::uint64_t now = monotonicNanoseconds();
+			totals[previous] += now - entered;
+			entered = now;
+			current = state;
+		}
+
+		void CaptureControl::waitWhilePaused() {
+			boost::mutex::scoped_lock lock(mutex);
+			while (command == PAUSE)
+				changed.wait(lock);
+		}
+
+		bool CaptureControl::sleepFor(boost::uint64_t ns) {
+			// the deadline is on the monotonic clock, waits are relative, as in sleepUntilNanoseconds()
+			const boost::uint64_t deadline = monotonicNanoseconds() + ns;
+			boost::mutex::scoped_lock lock(mutex);
+			while (command == RUN) {
+				const boost::uint64_t now = monotonicNanoseconds();
+				if (now >= deadline)
+					return true;
+				const boost::uint64_t wait = std::min(deadline - now, max_wait);
+				changed.timed_wait(lock, boost::posix_time::microseconds((wait + 999) / 1000));
+			}
+			return false;
+		}
+
+		boost::uint64_t CaptureControl::timeIn(State state) const {
+			boost::uint64_t time = totals[state];
+			if (current == state)
+				time += monotonicNanoseconds() - entered;
+			return time;
+		}
+
+} //: namespace CameraPGR
+} //: namespace Sources
@@ -0,0 +1,113 @@
+/*!
+ * \file
+ * \brief State of the capture thread of one camera
+ * \author Mikolaj Kojdecki
+ */
+
+#ifndef CAPTURECONTROL_HPP_
+#define CAPTURECONTROL_HPP_
+
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/thread.hpp>
+
+namespace Sources {
+namespace CameraPGR {
+
+/*!
+ * \class CaptureControl
+ * \brief Commands given to the capture thread and states it goes through.
+ *
+ * The component asks the thread to run, pause or stop; the thread follows
+ * at the next frame and reports the state it is in. Paused or backing off
+ * after errors the thread sleeps on a condition variable, so it wakes as
+ * soon as the command changes and uses no CPU meanwhile. Time spent in
+ * every state is counted.
+ */
+class CaptureControl {
+public:
+	enum State {
+		/// Paused, camera not capturing
+		IDLE,
+		/// Retrieving and converting frames
+		STREAMING,
+		/// Writing changed properties to the camera
+		RECONFIGURING,
+		/// Waiting after errors, reconnecting the camera
+		RECOVERING,
+		/// Leaving the capture loop
+		STOPPING,
+		STATE_COUNT
+	};
+
+	static const char * name(State state);
+
+	CaptureControl();
+
+	// Commands, given by the component
+
+	void run();
+
+	void pause();
+
+	/*!
+	 * Stops the thread for good.
+	 */
+	void stop();
+
+	bool running() const {
+		return command == RUN;
+	}
+
+	bool stopping() const {
+		return command == STOP;
+	}
+
+	// Called by the capture thread
+
+	/*!
+	 * Switches current state, time spent in the previous one is added to
+	 * its total.
+	 */
+	void enter(State state);
+
+	State state() const {
+		return (State) current.load();
+	}
+
+	/*!
+	 * Blocks while paused.
+	 */
+	void waitWhilePaused();
+
+	/*!
+	 * Sleeps for given time. Returns false if woken earlier by pause() or
+	 * stop().
+	 */
+	bool sleepFor(boost::uint64_t ns);
+
+	/*!
+	 * Time (ns) spent in state so far, including the current stay.
+	 */
+	boost::uint64_t timeIn(State state) const;
+
+private:
+	enum Command {
+		PAUSE, RUN, STOP
+	};
+
+	void give(Command command);
+
+	boost::atomic<int> command;
+	boost::mutex mutex;
+	boost::condition_variable changed;
+
+	boost::atomic<int> current;
+	boost::atomic<boost::uint64_t> entered;
+	boost::atomic<boost::uint64_t> totals[STATE_COUNT];
+};
+
+} //: namespace CameraPGR
+} //: namespace Sources
+
+#endif /* CAPTURECONTROL_HPP_ */
@@ -24,7 +24,7 @@ public:
 	string shutter_mode;
 	float shutter_value;
 	string gain_mode;
-	int gain_value;
+	float gain_value;
 	
 	Config() {
 		brightness_mode = "previous";
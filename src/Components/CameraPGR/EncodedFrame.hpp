@@ -0,0 +1,42 @@
+/*!
+ * \file
+ * \brief Compressed frame written to out_encoded
+ * \author Mikolaj Kojdecki
+ */
+
+#ifndef ENCODEDFRAME_HPP_
+#define ENCODEDFRAME_HPP_
+
+#include <string>
+
+#include <opencv2/opencv.hpp>
+
+#include "FrameMeta.hpp"
+
+namespace Sources {
+namespace CameraPGR {
+
+/*!
+ * \class EncodedFrame
+ * \brief Frame of out_img compressed once by the component, for every
+ * component archiving or forwarding it.
+ */
+class EncodedFrame {
+public:
+	/// File extension of the format: ".jpg" or ".png"
+	std::string format;
+	/// Encoded file, one row of CV_8UC1; shared, not copied, between readers
+	cv::Mat data;
+	/// Capture information of the frame (frames_lost and interval are not filled)
+	FrameMeta meta;
+	/// Number of the frame of the camera, counted from 0; gaps are frames dropped by the encoder
+	unsigned long sequence;
+
+	EncodedFrame() {
+		sequence = 0;
+	}
+};
+
+}
+}
+#endif
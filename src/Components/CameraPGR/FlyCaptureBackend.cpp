@@ -0,0 +1,261 @@
+/*!
+ * \file
+ * \brief Capture backend for Point Grey GigE cameras
+ * \author Mikolaj Kojdecki
+ */
+
+#include "FlyCaptureBackend.hpp"
+#include "Timing.hpp"
+
+#include <boost/thread.hpp>
+
+namespace Sources {
+namespace CameraPGR {
+
+namespace {
+
+// Constructing a BusManager scans the network, so one is shared by all
+// cameras of the process. Its lookups are serialized with bus_mutex.
+FlyCapture2::BusManager * bus_manager = 0;
+boost::once_flag bus_once = BOOST_ONCE_INIT;
+boost::mutex bus_mutex;
+
+void createBusManager() {
+	bus_manager = new FlyCapture2::BusManager();
+}
+
+/// Shortest time (ns) between reads of shutter and gain changed by the camera
+const boost::uint64_t exposure_read_period = 100000000ull;
+
+/// Value field of a shutter or gain register, as embedded in the image
+unsigned int registerValue(unsigned int reg) {
+	return reg & 0xfff;
+}
+
+FlyCapture2::BusManager & busManager() {
+	boost::call_once(&createBusManager, bus_once);
+	return *bus_manager;
+}
+
+}
+
+		FlyCaptureBackend::FlyCaptureBackend() :
+			embedded_frame_counter(false), embedded_exposure(false), frame_counter(0), shutter(-1), gain(-1), shutter_register(0),
+			gain_register(0), exposure_auto(false), next_exposure_read(0) {
+		}
+
+		FlyCaptureBackend::~FlyCaptureBackend() {
+			disconnect();
+		}
+
+		bool FlyCaptureBackend::check(const FlyCapture2::Error & error) {
+			if (error != FlyCapture2::PGRERROR_OK) {
+				error_message = error.GetDescription();
+				return false;
+			}
+			return true;
+		}
+
+		bool FlyCaptureBackend::listCameras(std::vector<unsigned int> & serials) {
+			FlyCapture2::BusManager & busMgr = busManager();
+			boost::mutex::scoped_lock lock(bus_mutex);
+
+			unsigned int count = 0;
+			if (!check(busMgr.GetNumOfCameras(&count)))
+				return false;
+
+			serials.clear();
+			for (unsigned int i = 0; i < count; ++i) {
+				unsigned int serial = 0;
+				if (!check(busMgr.GetCameraSerialNumberFromIndex(i, &serial)))
+					return false;
+				serials.push_back(serial);
+			}
+			return true;
+		}
+
+		bool FlyCaptureBackend::connect(unsigned int serial) {
+			FlyCapture2::BusManager & busMgr = busManager();
+			FlyCapture2::PGRGuid guid;
+
+			{
+				boost::mutex::scoped_lock lock(bus_mutex);
+				if (serial != 0) {
+					if (!check(busMgr.GetCameraFromSerialNumber(serial, &guid)))
+						return false;
+				} else {
+					// Connect(0) is documented to pick the first camera, but it
+					// does not work for GigE cameras - take the first one from the bus.
+					if (!check(busMgr.GetCameraFromIndex(0, &guid)))
+						return false;
+				}
+			}
+
+			// cameras connect concurrently, only the bus lookup is serialized
+			if (!check(cam.Connect(&guid)))
+				return false;
+
+			enableEmbeddedInfo();
+			readExposure();
+			return true;
+		}
+
+		void FlyCaptureBackend::enableEmbeddedInfo() {
+			FlyCapture2::EmbeddedImageInfo info;
+			if (cam.GetEmbeddedImageInfo(&info) != FlyCapture2::PGRERROR_OK)
+				return;
+
+			info.timestamp.onOff = info.timestamp.available;
+			info.frameCounter.onOff = info.frameCounter.available;
+			info.shutter.onOff = info.shutter.available;
+			info.gain.onOff = info.gain.available;
+			if (cam.SetEmbeddedImageInfo(&info) == FlyCapture2::PGRERROR_OK) {
+				embedded_frame_counter = info.frameCounter.available;
+				embedded_exposure = info.shutter.available && info.gain.available;
+			}
+		}
+
+		void FlyCaptureBackend::readExposure() {
+			exposure_auto = false;
+			FlyCapture2::Property prop(FlyCapture2::SHUTTER);
+			if (cam.GetProperty(&prop) == FlyCapture2::PGRERROR_OK) {
+				shutter = prop.absValue;
+				shutter_register = prop.valueA;
+				exposure_auto = prop.autoManualMode;
+			}
+			prop.type = FlyCapture2::GAIN;
+			if (cam.GetProperty(&prop) == FlyCapture2::PGRERROR_OK) {
+				gain = prop.absValue;
+				gain_register = prop.valueA;
+				exposure_auto = exposure_auto || prop.autoManualMode;
+			}
+			next_exposure_read = monotonicNanoseconds() + exposure_read_period;
+		}
+
+		void FlyCaptureBackend::disconnect() {
+			if (cam.IsConnected())
+				cam.Disconnect();
+		}
+
+		bool FlyCaptureBackend::getCameraInfo(FlyCapture2::CameraInfo & info) {
+			return check(cam.GetCameraInfo(&info));
+		}
+
+		bool FlyCaptureBackend::setImageSettings(const FlyCapture2::GigEImageSettings & settings) {
+			FlyCapture2::GigEImageSettingsInfo imageSettingsInfo;
+			if (!check(cam.GetGigEImageSettingsInfo(&imageSettingsInfo)))
+				return false;
+
+			return check(cam.SetGigEImageSettings(&settings));
+		}
+
+		bool FlyCaptureBackend::startCapture() {
+			return check(cam.StartCapture());
+		}
+
+		bool FlyCaptureBackend::stopCapture() {
+			return check(cam.StopCapture());
+		}
+
+		bool FlyCaptureBackend::getStreamSettings(StreamSettings & settings) {
+			FlyCapture2::GigEProperty packet;
+			packet.propType = FlyCapture2::PACKET_SIZE;
+			if (!check(cam.GetGigEProperty(&packet)))
+				return false;
+			FlyCapture2::GigEProperty delay;
+			delay.propType = FlyCapture2::PACKET_DELAY;
+			if (!check(cam.GetGigEProperty(&delay)))
+				return false;
+			FlyCapture2::FC2Config config;
+			if (!check(cam.GetConfiguration(&config)))
+				return false;
+
+			settings.packet_size = packet.value;
+			settings.packet_delay = delay.value;
+			settings.buffers = config.numBuffers;
+			settings.grab_mode = config.grabMode;
+			settings.grab_timeout = config.grabTimeout;
+			return true;
+		}
+
+		bool FlyCaptureBackend::setStreamSettings(const StreamSettings & settings) {
+			if (settings.packet_size > 0) {
+				FlyCapture2::GigEProperty packet;
+				packet.propType = FlyCapture2::PACKET_SIZE;
+				packet.value = settings.packet_size;
+				if (!check(cam.SetGigEProperty(&packet)))
+					return false;
+			}
+			if (settings.packet_delay >= 0) {
+				FlyCapture2::GigEProperty delay;
+				delay.propType = FlyCapture2::PACKET_DELAY;
+				delay.value = settings.packet_delay;
+				if (!check(cam.SetGigEProperty(&delay)))
+					return false;
+			}
+
+			if (settings.buffers == 0 && settings.grab_mode == FlyCapture2::UNSPECIFIED_GRAB_MODE
+					&& settings.grab_timeout == FlyCapture2::TIMEOUT_UNSPECIFIED)
+				return true;
+			FlyCapture2::FC2Config config;
+			if (!check(cam.GetConfiguration(&config)))
+				return false;
+			if (settings.buffers > 0)
+				config.numBuffers = settings.buffers;
+			if (settings.grab_mode != FlyCapture2::UNSPECIFIED_GRAB_MODE)
+				config.grabMode = settings.grab_mode;
+			if (settings.grab_timeout != FlyCapture2::TIMEOUT_UNSPECIFIED)
+				config.grabTimeout = settings.grab_timeout;
+			return check(cam.SetConfiguration(&config));
+		}
+
+		bool FlyCaptureBackend::setTriggerMode(const FlyCapture2::TriggerMode & mode) {
+			return check(cam.SetTriggerMode(&mode));
+		}
+
+		bool FlyCaptureBackend::fireSoftwareTrigger() {
+			// not broadcast - other cameras on the bus may belong to someone else
+			return check(cam.FireSoftwareTrigger(false));
+		}
+
+		const FlyCapture2::Image * FlyCaptureBackend::retrieveBuffer(FlyCapture2::Image & image, FrameMeta & meta) {
+			if (!check(cam.RetrieveBuffer(&image)))
+				return 0;
+
+			const FlyCapture2::TimeStamp stamp = image.GetTimeStamp();
+			meta.timestamp_seconds = stamp.seconds;
+			meta.timestamp_microseconds = stamp.microSeconds;
+			// cycle count runs at 8 kHz, cycle offset splits it in 3072 parts
+			meta.camera_time = stamp.cycleSeconds * 1000000000ull + stamp.cycleCount * 125000ull + stamp.cycleOffset * 125000ull / 3072;
+
+			const FlyCapture2::ImageMetadata embedded = image.GetMetadata();
+			meta.frame_counter = embedded_frame_counter ? embedded.embeddedFrameCounter : frame_counter;
+			++frame_counter;
+			meta.embedded_shutter = embedded.embeddedShutter;
+			meta.embedded_gain = embedded.embeddedGain;
+
+			// registers embedded in the frame tell when the camera changed shutter
+			// or gain, without them the values are re-read while either is automatic
+			const bool exposure_changed = embedded_exposure ? (registerValue(embedded.embeddedShutter) != shutter_register
+					|| registerValue(embedded.embeddedGain) != gain_register) : exposure_auto;
+			if (exposure_changed && monotonicNanoseconds() >= next_exposure_read)
+				readExposure();
+			meta.shutter = shutter;
+			meta.gain = gain;
+			return &image;
+		}
+
+		bool FlyCaptureBackend::setProperty(const FlyCapture2::Property & prop) {
+			if (!check(cam.SetProperty(&prop)))
+				return false;
+			if (prop.type == FlyCapture2::SHUTTER || prop.type == FlyCapture2::GAIN)
+				readExposure();
+			return true;
+		}
+
+		bool FlyCaptureBackend::getProperty(FlyCapture2::Property & prop) {
+			return check(cam.GetProperty(&prop));
+		}
+
+} //: namespace CameraPGR
+} //: namespace Sources
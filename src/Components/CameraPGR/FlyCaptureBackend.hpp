@@ -0,0 +1,80 @@
+/*!
+ * \file
+ * \brief Capture backend for Point Grey GigE cameras
+ * \author Mikolaj Kojdecki
+ */
+
+#ifndef FLYCAPTUREBACKEND_HPP_
+#define FLYCAPTUREBACKEND_HPP_
+
+#include "CaptureBackend.hpp"
+
+//FlyCapture2 imports
+#include <GigECamera.h>
+#include <BusManager.h>
+
+namespace Sources {
+namespace CameraPGR {
+
+/*!
+ * \class FlyCaptureBackend
+ * \brief Real camera accessed through FlyCapture2::GigECamera.
+ */
+class FlyCaptureBackend: public CaptureBackend {
+public:
+	FlyCaptureBackend();
+
+	virtual ~FlyCaptureBackend();
+
+	bool listCameras(std::vector<unsigned int> & serials);
+	bool connect(unsigned int serial);
+	void disconnect();
+	bool getCameraInfo(FlyCapture2::CameraInfo & info);
+	bool setImageSettings(const FlyCapture2::GigEImageSettings & settings);
+	bool startCapture();
+	bool stopCapture();
+	bool getStreamSettings(StreamSettings & settings);
+	bool setStreamSettings(const StreamSettings & settings);
+	const FlyCapture2::Image * retrieveBuffer(FlyCapture2::Image & image, FrameMeta & meta);
+	bool setTriggerMode(const FlyCapture2::TriggerMode & mode);
+	bool fireSoftwareTrigger();
+	bool setProperty(const FlyCapture2::Property & prop);
+	bool getProperty(FlyCapture2::Property & prop);
+
+private:
+	/*!
+	 * Stores error description, returns true if error is PGRERROR_OK.
+	 */
+	bool check(const FlyCapture2::Error & error);
+
+	/*!
+	 * Turns on information embedded in the first pixels of each image.
+	 */
+	void enableEmbeddedInfo();
+
+	/*!
+	 * Reads absolute values of shutter and gain reported with frames.
+	 */
+	void readExposure();
+
+	FlyCapture2::GigECamera cam;
+
+	bool embedded_frame_counter;
+	/// Shutter and gain registers are embedded in the images
+	bool embedded_exposure;
+	unsigned int frame_counter;
+	float shutter;
+	float gain;
+	/// Register values of shutter and gain when last read
+	unsigned int shutter_register;
+	unsigned int gain_register;
+	/// Shutter or gain is set by the camera
+	bool exposure_auto;
+	/// Monotonic time (ns) before which shutter and gain are not read again
+	boost::uint64_t next_exposure_read;
+};
+
+} //: namespace CameraPGR
+} //: namespace Sources
+
+#endif /* FLYCAPTUREBACKEND_HPP_ */
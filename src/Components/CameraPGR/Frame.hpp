@@ -0,0 +1,43 @@
+/*!
+ * \file
+ * \brief Frame passed from the capture thread to the output streams
+ * \author Mikolaj Kojdecki
+ */
+
+#ifndef FRAME_HPP_
+#define FRAME_HPP_
+
+#include <opencv2/opencv.hpp>
+
+#include <boost/cstdint.hpp>
+
+#include "FrameMeta.hpp"
+
+namespace Sources {
+namespace CameraPGR {
+
+/*!
+ * \class Frame
+ * \brief Converted image together with what is known about its capture.
+ */
+class Frame {
+public:
+	cv::Mat image;
+
+	/// Binned copy of image for out_preview, empty when no preview is due
+	cv::Mat preview;
+
+	FrameMeta meta;
+
+	/// Number of the frame in the shared memory ring, -1 - not published there
+	boost::int64_t shared_frame;
+
+	Frame() {
+		shared_frame = -1;
+	}
+};
+
+} //: namespace CameraPGR
+} //: namespace Sources
+
+#endif /* FRAME_HPP_ */
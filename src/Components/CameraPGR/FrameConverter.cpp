@@ -0,0 +1,313 @@
+/*!
+ * \file
+ * \brief Conversion of camera frames to the output format
+ * \author Mikolaj Kojdecki
+ */
+
+#include <cstring>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include <boost/thread/tss.hpp>
+
+#include "FrameConverter.hpp"
+
+namespace Sources {
+namespace CameraPGR {
+
+namespace {
+
+/*!
+ * Conversion of rows [begin, end), one specialization per pair of formats.
+ */
+template <InputFormat In, OutputFormat Out>
+void convertRows(const SourceImage & src, unsigned char * dst, size_t dst_step, DemosaicMethod method, SimdLevel simd, int begin, int end);
+
+template <typename T>
+inline const T * sourceRow(const SourceImage & src, int row) {
+	return (const T *) (src.data + row * src.step);
+}
+
+template <typename T>
+inline T * destinationRow(unsigned char * dst, size_t dst_step, int row) {
+	return (T *) (dst + row * dst_step);
+}
+
+/*!
+ * Sample of one depth in another.
+ */
+template <typename Src, typename Dst>
+inline Dst convertSample(unsigned int value);
+
+template <>
+inline unsigned char convertSample<unsigned char, unsigned char>(unsigned int value) {
+	return (unsigned char) value;
+}
+
+template <>
+inline unsigned short convertSample<unsigned char, unsigned short>(unsigned int value) {
+	return (unsigned short) (value * 257);
+}
+
+template <>
+inline unsigned char convertSample<unsigned short, unsigned char>(unsigned int value) {
+	return (unsigned char) (value >> 8);
+}
+
+template <>
+inline unsigned short convertSample<unsigned short, unsigned short>(unsigned int value) {
+	return (unsigned short) value;
+}
+
+/*!
+ * Rounded mean of four samples of one depth, given by their sum, in another.
+ */
+template <typename Src, typename Dst>
+inline Dst windowMean(unsigned int sum);
+
+template <>
+inline unsigned short windowMean<unsigned char, unsigned short>(unsigned int sum) {
+	return (unsigned short) ((sum * 257 + 2) >> 2);
+}
+
+template <>
+inline unsigned char windowMean<unsigned short, unsigned char>(unsigned int sum) {
+	return (unsigned char) (sum >> 10);
+}
+
+template <>
+inline unsigned short windowMean<unsigned short, unsigned short>(unsigned int sum) {
+	return (unsigned short) ((sum + 2) >> 2);
+}
+
+/*!
+ * OpenCV conversion of a band, for pairs OpenCV has vectorized kernels for.
+ */
+template <int InType, int OutType, int Code>
+void cvtColorRows(const SourceImage & src, unsigned char * dst, size_t dst_step, int begin, int end) {
+	const cv::Mat in(end - begin, src.cols, InType, (void *) (src.data + begin * src.step), src.step);
+	cv::Mat out(end - begin, src.cols, OutType, dst + begin * dst_step, dst_step);
+	cv::cvtColor(in, out, Code);
+}
+
+void copyRows(const SourceImage & src, unsigned char * dst, size_t dst_step, size_t pixel_size, int begin, int end) {
+	for (int row = begin; row < end; ++row)
+		memcpy(dst + row * dst_step, src.data + row * src.step, src.cols * pixel_size);
+}
+
+/*!
+ * Single channel to single channel of another depth.
+ */
+template <typename Src, typename Dst>
+void monoRows(const SourceImage & src, unsigned char * dst, size_t dst_step, int begin, int end) {
+	for (int row = begin; row < end; ++row) {
+		const Src * in = sourceRow<Src>(src, row);
+		Dst * out = destinationRow<Dst>(dst, dst_step, row);
+		for (int col = 0; col < src.cols; ++col)
+			out[col] = convertSample<Src, Dst>(in[col]);
+	}
+}
+
+/*!
+ * Luminance of a Bayer mosaic as in bayerLuma(), for the depths it has no kernel for.
+ */
+template <typename Src, typename Dst>
+void lumaRows(const SourceImage & src, unsigned char * dst, size_t dst_step, int begin, int end) {
+	if (src.rows < 2 || src.cols < 2) {
+		monoRows<Src, Dst>(src, dst, dst_step, begin, end);
+		return;
+	}
+	const int last = src.cols - 1;
+	for (int row = begin; row < end; ++row) {
+		const Src * top = sourceRow<Src>(src, row);
+		const Src * bottom = sourceRow<Src>(src, row + 1 < src.rows ? row + 1 : row - 1);
+		Dst * out = destinationRow<Dst>(dst, dst_step, row);
+		for (int col = 0; col < last; ++col)
+			out[col] = windowMean<Src, Dst>(top[col] + top[col + 1] + bottom[col] + bottom[col + 1]);
+		out[last] = windowMean<Src, Dst>(top[last - 1] + top[last] + bottom[last - 1] + bottom[last]);
+	}
+}
+
+/*!
+ * Tile seen from the next row.
+ */
+BayerPattern nextRowPattern(BayerPattern pattern) {
+	switch (pattern) {
+	case BAYER_GRBG:
+		return BAYER_BGGR;
+	case BAYER_GBRG:
+		return BAYER_RGGB;
+	case BAYER_BGGR:
+		return BAYER_GRBG;
+	default:
+		return BAYER_GBRG;
+	}
+}
+
+template <>
+void convertRows<INPUT_RGB8, OUTPUT_BGR8>(const SourceImage & src, unsigned char * dst, size_t dst_step, DemosaicMethod, SimdLevel, int begin, int end) {
+	cvtColorRows<CV_8UC3, CV_8UC3, CV_RGB2BGR>(src, dst, dst_step, begin, end);
+}
+
+template <>
+void convertRows<INPUT_RGB8, OUTPUT_MONO8>(const SourceImage & src, unsigned char * dst, size_t dst_step, DemosaicMethod, SimdLevel, int begin, int end) {
+	cvtColorRows<CV_8UC3, CV_8UC1, CV_RGB2GRAY>(src, dst, dst_step, begin, end);
+}
+
+/*!
+ * 8-bit luminance written to the first half of each row, then widened in
+ * place from the end of the row.
+ */
+template <>
+void convertRows<INPUT_RGB8, OUTPUT_MONO16>(const SourceImage & src, unsigned char * dst, size_t dst_step, DemosaicMethod, SimdLevel, int begin, int end) {
+	cvtColorRows<CV_8UC3, CV_8UC1, CV_RGB2GRAY>(src, dst, dst_step, begin, end);
+	for (int row = begin; row < end; ++row) {
+		const unsigned char * gray = dst + row * dst_step;
+		unsigned short * out = destinationRow<unsigned short>(dst, dst_step, row);
+		for (int col = src.cols - 1; col >= 0; --col)
+			out[col] = convertSample<unsigned char, unsigned short>(gray[col]);
+	}
+}
+
+template <>
+void convertRows<INPUT_RAW8, OUTPUT_BGR8>(const SourceImage & src, unsigned char * dst, size_t dst_step, DemosaicMethod method, SimdLevel simd, int begin, int end) {
+	demosaicBGR(src.data, src.step, dst, dst_step, src.rows, src.cols, begin, end, src.pattern, method, simd);
+}
+
+template <>
+void convertRows<INPUT_RAW8, OUTPUT_MONO8>(const SourceImage & src, unsigned char * dst, size_t dst_step, DemosaicMethod, SimdLevel simd, int begin, int end) {
+	bayerLuma(src.data, src.step, dst, dst_step, src.rows, src.cols, begin, end, simd);
+}
+
+template <>
+void convertRows<INPUT_RAW8, OUTPUT_MONO16>(const SourceImage & src, unsigned char * dst, size_t dst_step, DemosaicMethod, SimdLevel, int begin, int end) {
+	lumaRows<unsigned char, unsigned short>(src, dst, dst_step, begin, end);
+}
+
+template <>
+void convertRows<INPUT_MONO8, OUTPUT_BGR8>(const SourceImage & src, unsigned char * dst, size_t dst_step, DemosaicMethod, SimdLevel, int begin, int end) {
+	cvtColorRows<CV_8UC1, CV_8UC3, CV_GRAY2BGR>(src, dst, dst_step, begin, end);
+}
+
+template <>
+void convertRows<INPUT_MONO8, OUTPUT_MONO8>(const SourceImage & src, unsigned char * dst, size_t dst_step, DemosaicMethod, SimdLevel, int begin, int end) {
+	copyRows(src, dst, dst_step, 1, begin, end);
+}
+
+template <>
+void convertRows<INPUT_MONO8, OUTPUT_MONO16>(const SourceImage & src, unsigned char * dst, size_t dst_step, DemosaicMethod, SimdLevel, int begin, int end) {
+	monoRows<unsigned char, unsigned short>(src, dst, dst_step, begin, end);
+}
+
+template <>
+void convertRows<INPUT_MONO16, OUTPUT_BGR8>(const SourceImage & src, unsigned char * dst, size_t dst_step, DemosaicMethod, SimdLevel, int begin, int end) {
+	for (int row = begin; row < end; ++row) {
+		const unsigned short * in = sourceRow<unsigned short>(src, row);
+		unsigned char * out = dst + row * dst_step;
+		for (int col = 0; col < src.cols; ++col)
+			out[3 * col] = out[3 * col + 1] = out[3 * col + 2] = convertSample<unsigned short, unsigned char>(in[col]);
+	}
+}
+
+template <>
+void convertRows<INPUT_MONO16, OUTPUT_MONO8>(const SourceImage & src, unsigned char * dst, size_t dst_step, DemosaicMethod, SimdLevel, int begin, int end) {
+	monoRows<unsigned short, unsigned char>(src, dst, dst_step, begin, end);
+}
+
+template <>
+void convertRows<INPUT_MONO16, OUTPUT_MONO16>(const SourceImage & src, unsigned char * dst, size_t dst_step, DemosaicMethod, SimdLevel, int begin, int end) {
+	copyRows(src, dst, dst_step, 2, begin, end);
+}
+
+/// Band of RAW16 high bytes, one per converting thread, kept between frames
+boost::thread_specific_ptr<std::vector<unsigned char> > raw16_band;
+
+/*!
+ * High bytes of the band and its neighbour rows are demosaiced as RAW8.
+ */
+template <>
+void convertRows<INPUT_RAW16, OUTPUT_BGR8>(const SourceImage & src, unsigned char * dst, size_t dst_step, DemosaicMethod method, SimdLevel simd, int begin, int end) {
+	if (begin >= end || src.cols == 0)
+		return;
+	const int first = begin > 0 ? begin - 1 : 0;
+	const int last = end < src.rows ? end + 1 : src.rows;
+	if (!raw16_band.get())
+		raw16_band.reset(new std::vector<unsigned char>());
+	std::vector<unsigned char> & band = *raw16_band;
+	if (band.size() < (size_t) (last - first) * src.cols)
+		band.resize((size_t) (last - first) * src.cols);
+	for (int row = first; row < last; ++row) {
+		const unsigned short * in = sourceRow<unsigned short>(src, row);
+		unsigned char * out = &band[(row - first) * src.cols];
+		for (int col = 0; col < src.cols; ++col)
+			out[col] = convertSample<unsigned short, unsigned char>(in[col]);
+	}
+	const BayerPattern pattern = (first & 1) ? nextRowPattern(src.pattern) : src.pattern;
+	demosaicBGR(&band[0], src.cols, dst + first * dst_step, dst_step, last - first, src.cols, begin - first, end - first, pattern, method, simd);
+}
+
+template <>
+void convertRows<INPUT_RAW16, OUTPUT_MONO8>(const SourceImage & src, unsigned char * dst, size_t dst_step, DemosaicMethod, SimdLevel, int begin, int end) {
+	lumaRows<unsigned short, unsigned char>(src, dst, dst_step, begin, end);
+}
+
+template <>
+void convertRows<INPUT_RAW16, OUTPUT_MONO16>(const SourceImage & src, unsigned char * dst, size_t dst_step, DemosaicMethod, SimdLevel, int begin, int end) {
+	lumaRows<unsigned short, unsigned short>(src, dst, dst_step, begin, end);
+}
+
+}
+
+		bool inputFormatFromString(const std::string & name, InputFormat & format) {
+			if (name == "RGB" || name == "RGB8")
+				format = INPUT_RGB8;
+			else if (name == "RAW" || name == "RAW8")
+				format = INPUT_RAW8;
+			else if (name == "MONO" || name == "MONO8")
+				format = INPUT_MONO8;
+			else if (name == "MONO16")
+				format = INPUT_MONO16;
+			else if (name == "RAW16")
+				format = INPUT_RAW16;
+			else
+				return false;
+			return true;
+		}
+
+		bool outputFormatFromString(const std::string & name, OutputFormat & format) {
+			if (name == "BGR" || name == "BGR8")
+				format = OUTPUT_BGR8;
+			else if (name == "MONO" || name == "MONO8" || name == "GRAY")
+				format = OUTPUT_MONO8;
+			else if (name == "MONO16" || name == "GRAY16")
+				format = OUTPUT_MONO16;
+			else
+				return false;
+			return true;
+		}
+
+		int outputType(OutputFormat format) {
+			switch (format) {
+			case OUTPUT_MONO8:
+				return CV_8UC1;
+			case OUTPUT_MONO16:
+				return CV_16UC1;
+			default:
+				return CV_8UC3;
+			}
+		}
+
+		RowConverter rowConverter(InputFormat input, OutputFormat output) {
+			static const RowConverter converters[5][3] = {
+				{ convertRows<INPUT_RGB8, OUTPUT_BGR8>, convertRows<INPUT_RGB8, OUTPUT_MONO8>, convertRows<INPUT_RGB8, OUTPUT_MONO16> },
+				{ convertRows<INPUT_RAW8, OUTPUT_BGR8>, convertRows<INPUT_RAW8, OUTPUT_MONO8>, convertRows<INPUT_RAW8, OUTPUT_MONO16> },
+				{ convertRows<INPUT_MONO8, OUTPUT_BGR8>, convertRows<INPUT_MONO8, OUTPUT_MONO8>, convertRows<INPUT_MONO8, OUTPUT_MONO16> },
+				{ convertRows<INPUT_MONO16, OUTPUT_BGR8>, convertRows<INPUT_MONO16, OUTPUT_MONO8>, convertRows<INPUT_MONO16, OUTPUT_MONO16> },
+				{ convertRows<INPUT_RAW16, OUTPUT_BGR8>, convertRows<INPUT_RAW16, OUTPUT_MONO8>, convertRows<INPUT_RAW16, OUTPUT_MONO16> }
+			};
+			return converters[input][output];
+		}
+
+} //: namespace CameraPGR
+} //: namespace Sources
@@ -0,0 +1,95 @@
+/*!
+ * \file
+ * \brief Conversion of camera frames to the output format
+ * \author Mikolaj Kojdecki
+ */
+
+#ifndef FRAMECONVERTER_HPP_
+#define FRAMECONVERTER_HPP_
+
+#include <cstddef>
+#include <string>
+
+#include "BayerDemosaic.hpp"
+
+namespace Sources {
+namespace CameraPGR {
+
+/*!
+ * Pixel format of frames sent by the camera.
+ */
+enum InputFormat {
+	INPUT_RGB8,
+	/// Bayer mosaic, tile given by the camera
+	INPUT_RAW8,
+	INPUT_MONO8,
+	/// 16-bit samples in host (little endian) order, as GigE cameras send them
+	INPUT_MONO16,
+	INPUT_RAW16
+};
+
+/*!
+ * Pixel format of frames written to out_img.
+ */
+enum OutputFormat {
+	/// CV_8UC3
+	OUTPUT_BGR8,
+	/// CV_8UC1
+	OUTPUT_MONO8,
+	/// CV_16UC1
+	OUTPUT_MONO16
+};
+
+/*!
+ * Parses pixel_format: "RGB", "RGB8", "RAW", "RAW8", "MONO", "MONO8",
+ * "MONO16" or "RAW16".
+ */
+bool inputFormatFromString(const std::string & name, InputFormat & format);
+
+/*!
+ * Parses output_format: "BGR", "BGR8", "MONO", "MONO8", "GRAY", "MONO16"
+ * or "GRAY16".
+ */
+bool outputFormatFromString(const std::string & name, OutputFormat & format);
+
+/*!
+ * OpenCV type of frames in given format.
+ */
+int outputType(OutputFormat format);
+
+/*!
+ * Frame as delivered by the camera.
+ */
+struct SourceImage {
+	const unsigned char * data;
+	size_t step;
+	int rows;
+	int cols;
+	/// Tile of RAW8 and RAW16 frames
+	BayerPattern pattern;
+};
+
+/*!
+ * Converts rows [begin, end) of src to dst. method is used by Bayer input
+ * with colour output only, simd by the kernels that have SIMD versions.
+ */
+typedef void (*RowConverter)(const SourceImage & src, unsigned char * dst, size_t dst_step, DemosaicMethod method, SimdLevel simd,
+		int begin, int end);
+
+/*!
+ * Converter of given pair of formats.
+ *
+ * Every pair is a separate specialization of one templated routine, so
+ * formats are resolved once, when the converter is chosen, and the pixel
+ * loops contain no format checks. Pairs OpenCV has vectorized kernels for
+ * use them, RAW8 input uses the kernels of BayerDemosaic.hpp, the rest
+ * are plain loops the compiler can vectorize. Samples change depth by
+ * scaling (8 to 16 bits multiplies by 257, 16 to 8 keeps the high byte).
+ * Colour output from RAW16 demosaics the high bytes.
+ */
+RowConverter rowConverter(InputFormat input, OutputFormat output);
+
+} //: namespace CameraPGR
+} //: namespace Sources
+
+#endif /* FRAMECONVERTER_HPP_ */
@@ -0,0 +1,124 @@
+/*!
+ * \file
+ * \brief Threads compressing frames for out_encoded
+ * \author Mikolaj Kojdecki
+ */
+
+#include "FrameEncoder.hpp"
+#include "Timing.hpp"
+
+#include <boost/bind.hpp>
+
+namespace Sources {
+namespace CameraPGR {
+
+		FrameEncoder::FrameEncoder(int threads, unsigned int stream_count, const std::string & extension, const std::vector<int> & params,
+				boost::uint64_t deadline, const Handler & handler) :
+			thread_count(threads > 0 ? threads : 1), extension(extension), params(params), deadline(deadline), handler(handler), quit(false) {
+			streams.resize(stream_count);
+			for (size_t i = 0; i < streams.size(); ++i) {
+				streams[i].submitted = 0;
+				streams[i].next = 0;
+				streams[i].emitting = false;
+				streams[i].counters.reset(new Counters());
+			}
+			for (int i = 0; i < thread_count; ++i)
+				workers.create_thread(boost::bind(&FrameEncoder::worker, this));
+		}
+
+		FrameEncoder::~FrameEncoder() {
+			{
+				boost::mutex::scoped_lock lock(mutex);
+				quit = true;
+				jobs.clear();
+			}
+			work_ready.notify_all();
+			workers.join_all();
+		}
+
+		void FrameEncoder::submit(unsigned int stream, const cv::Mat & image, const FrameMeta & meta) {
+			Job job;
+			job.stream = stream;
+			job.image = image;
+			job.meta = meta;
+			{
+				boost::mutex::scoped_lock lock(mutex);
+				job.sequence = streams[stream].submitted++;
+				jobs.push_back(job);
+				if (jobs.size() > waitingLimit()) {
+					// its buffer goes back to the pool; the gap is skipped by the thread handing over frames after it
+					const Job & oldest = jobs.front();
+					++streams[oldest.stream].counters->overflow;
+					streams[oldest.stream].finished[oldest.sequence] = EncodedFrame();
+					jobs.pop_front();
+				}
+			}
+			work_ready.notify_one();
+		}
+
+		void FrameEncoder::worker() {
+			// kept between frames, so encoding does not grow a new buffer every time
+			std::vector<unsigned char> buffer;
+			boost::mutex::scoped_lock lock(mutex);
+			for (;;) {
+				while (!quit && jobs.empty())
+					work_ready.wait(lock);
+				if (quit)
+					return;
+
+				Job job = jobs.front();
+				jobs.pop_front();
+				Counters & counters = *streams[job.stream].counters;
+				lock.unlock();
+
+				EncodedFrame frame;
+				frame.format = extension;
+				frame.meta = job.meta;
+				frame.sequence = job.sequence;
+				const boost::uint64_t start = monotonicNanoseconds();
+				if (deadline > 0 && start - job.meta.received > deadline) {
+					// late already, encoding it would only delay the frames behind it
+					++counters.late;
+				} else if (!cv::imencode(extension, job.image, buffer, params)) {
+					++counters.failed;
+				} else {
+					const boost::uint64_t end = monotonicNanoseconds();
+					counters.latency.record(end - start);
+					if (deadline > 0 && end - job.meta.received > deadline) {
+						++counters.late;
+					} else {
+						frame.data = cv::Mat(buffer, true).reshape(1, 1);
+						++counters.encoded;
+					}
+				}
+				// the frame buffer goes back to the pool before waiting for earlier frames
+				job.image.release();
+
+				lock.lock();
+				Stream & stream = streams[job.stream];
+				stream.finished[job.sequence] = frame;
+				if (!stream.emitting)
+					emit(stream, job.stream, lock);
+			}
+		}
+
+		void FrameEncoder::emit(Stream & stream, unsigned int index, boost::mutex::scoped_lock & lock) {
+			stream.emitting = true;
+			for (;;) {
+				std::map<unsigned long, EncodedFrame>::iterator it = stream.finished.find(stream.next);
+				if (it == stream.finished.end())
+					break;
+				const EncodedFrame frame = it->second;
+				stream.finished.erase(it);
+				++stream.next;
+				if (frame.data.empty() || quit)
+					continue;
+				lock.unlock();
+				handler(index, frame);
+				lock.lock();
+			}
+			stream.emitting = false;
+		}
+
+} //: namespace CameraPGR
+} //: namespace Sources
@@ -0,0 +1,153 @@
+/*!
+ * \file
+ * \brief Threads compressing frames for out_encoded
+ * \author Mikolaj Kojdecki
+ */
+
+#ifndef FRAMEENCODER_HPP_
+#define FRAMEENCODER_HPP_
+
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+
+#include "EncodedFrame.hpp"
+#include "LatencyHistogram.hpp"
+
+namespace Sources {
+namespace CameraPGR {
+
+/*!
+ * \class FrameEncoder
+ * \brief Pool of threads encoding frames of several streams (cameras) with
+ * cv::imencode.
+ *
+ * Frames are taken as headers of the component's buffers, which stay out of
+ * the frame pool until encoded. Any free thread encodes the oldest waiting
+ * frame; results of a stream are handed to the handler in the order the
+ * frames were submitted, by one thread at a time. A frame older than the
+ * deadline (counted from receiving it from the camera) when a thread takes
+ * it, or when its encoding ends, is dropped and counted. At most
+ * waitingLimit() frames wait for a thread, beyond that the oldest waiting
+ * one is dropped, so the encoder never holds more than heldFrames() buffers.
+ */
+class FrameEncoder {
+public:
+	/// Called with the index of the stream and its next frame
+	typedef boost::function<void(unsigned int, const EncodedFrame &)> Handler;
+
+	/*!
+	 * Frames of one stream handled so far.
+	 */
+	struct Counters {
+		boost::atomic<unsigned long> encoded;
+		/// Dropped for missing the deadline
+		boost::atomic<unsigned long> late;
+		/// Dropped from the full queue
+		boost::atomic<unsigned long> overflow;
+		/// cv::imencode failed
+		boost::atomic<unsigned long> failed;
+		/// Time of cv::imencode
+		LatencyHistogram latency;
+
+		Counters() :
+			encoded(0), late(0), overflow(0), failed(0) {
+		}
+	};
+
+	/*!
+	 * \param threads number of encoding threads
+	 * \param streams number of streams, frames of each are kept in order
+	 * \param extension ".jpg" or ".png"
+	 * \param params parameters of cv::imencode, e.g. IMWRITE_JPEG_QUALITY
+	 * \param deadline longest time (ns) from receiving a frame to the end of its encoding, 0 - none
+	 */
+	FrameEncoder(int threads, unsigned int streams, const std::string & extension, const std::vector<int> & params,
+			boost::uint64_t deadline, const Handler & handler);
+
+	/*!
+	 * Drops frames still waiting, and frames being encoded, and stops the
+	 * threads.
+	 */
+	~FrameEncoder();
+
+	/*!
+	 * Queues frame of the stream, dropping the oldest waiting frame when the
+	 * queue is full. Never blocks.
+	 */
+	void submit(unsigned int stream, const cv::Mat & image, const FrameMeta & meta);
+
+	Counters & counters(unsigned int stream) {
+		return *streams[stream].counters;
+	}
+
+	int threads() const {
+		return thread_count;
+	}
+
+	/// Frames waiting for a thread at most
+	size_t waitingLimit() const {
+		return 2 * thread_count;
+	}
+
+	/// Frame buffers the encoder may hold at once: waiting and being encoded
+	size_t heldFrames() const {
+		return waitingLimit() + thread_count;
+	}
+
+private:
+	struct Job {
+		unsigned int stream;
+		unsigned long sequence;
+		cv::Mat image;
+		FrameMeta meta;
+	};
+
+	/// Frames of one stream between submit and the handler
+	struct Stream {
+		/// Number of the next frame submitted
+		unsigned long submitted;
+		/// Number of the next frame handed over
+		unsigned long next;
+		/// Finished frames waiting for earlier ones, empty data - dropped
+		std::map<unsigned long, EncodedFrame> finished;
+		/// A thread is calling the handler for this stream
+		bool emitting;
+		boost::shared_ptr<Counters> counters;
+	};
+
+	void worker();
+
+	/*!
+	 * Hands over finished frames of the stream that are next in order.
+	 * Called with the lock held, releases it around the handler.
+	 */
+	void emit(Stream & stream, unsigned int index, boost::mutex::scoped_lock & lock);
+
+	const int thread_count;
+	const std::string extension;
+	const std::vector<int> params;
+	const boost::uint64_t deadline;
+	const Handler handler;
+	boost::thread_group workers;
+
+	boost::mutex mutex;
+	boost::condition_variable work_ready;
+	bool quit;
+	std::deque<Job> jobs;
+	std::vector<Stream> streams;
+};
+
+} //: namespace CameraPGR
+} //: namespace Sources
+
+#endif /* FRAMEENCODER_HPP_ */
@@ -0,0 +1,64 @@
+#ifndef FRAMEMETA_HPP_
+#define FRAMEMETA_HPP_
+
+#include <boost/cstdint.hpp>
+
+namespace Sources {
+namespace CameraPGR {
+
+/*!
+ * \class FrameMeta
+ * \brief Capture information of one frame, written to out_frame_meta
+ * together with every image written to out_img.
+ */
+class FrameMeta {
+public:
+	/// Camera clock in ns (cycle seconds, count and offset); wraps every 128 s
+	boost::uint64_t camera_time;
+	/// Time stamp of the frame reported by the SDK
+	long long timestamp_seconds;
+	unsigned int timestamp_microseconds;
+
+	/// Host monotonic time (ns) at which the frame was received
+	boost::uint64_t received;
+
+	/// Frame counter of the camera (embedded in the image when supported)
+	unsigned int frame_counter;
+	/// Frames lost since the previous frame written to out_frame_meta, 0 (and interval 0) when the counter restarted
+	unsigned int frames_lost;
+	/// Time since the previous frame written to out_frame_meta (ns, camera clock)
+	boost::uint64_t interval;
+
+	/// Shutter (ms) and gain (dB) last read from the camera. Read again when the
+	/// camera changes them in auto mode, at most every 100 ms, so they may lag
+	/// the frame by that much (FlyCapture2 cameras only).
+	float shutter;
+	float gain;
+	/// Raw shutter and gain register values embedded in the image (0 if not available)
+	unsigned int embedded_shutter;
+	unsigned int embedded_gain;
+
+	/// Sensor position (pixels) of the top-left pixel of the frame
+	unsigned int offset_x;
+	unsigned int offset_y;
+
+	FrameMeta() {
+		camera_time = 0;
+		timestamp_seconds = 0;
+		timestamp_microseconds = 0;
+		received = 0;
+		frame_counter = 0;
+		frames_lost = 0;
+		interval = 0;
+		shutter = -1;
+		gain = -1;
+		embedded_shutter = 0;
+		embedded_gain = 0;
+		offset_x = 0;
+		offset_y = 0;
+	}
+};
+
+}
+}
+#endif
@@ -0,0 +1,121 @@
+/*!
+ * \file
+ * \brief Pool of preallocated frame buffers
+ * \author Mikolaj Kojdecki
+ */
+
+#include <unistd.h>
+
+#include "FramePool.hpp"
+
+namespace Sources {
+namespace CameraPGR {
+
+namespace {
+
+/*!
+ * Number of Mat headers sharing the data of m.
+ */
+int refcount(const cv::Mat & m) {
+#if CV_MAJOR_VERSION >= 3
+	return m.u ? m.u->refcount : 0;
+#else
+	return m.refcount ? *m.refcount : 0;
+#endif
+}
+
+/*!
+ * Buffer is free when the pool holds the only reference to it.
+ */
+bool isFree(const cv::Mat & storage) {
+	return storage.empty() || refcount(storage) <= 1;
+}
+
+}
+
+		FramePool::FramePool(unsigned int size) :
+			next_slot(0), high_water(0), exhausted_count(0), acquired_count(0) {
+			long page = sysconf(_SC_PAGESIZE);
+			page_size = page > 0 ? page : 4096;
+			resize(size);
+		}
+
+		void FramePool::resize(unsigned int size) {
+			// Dropping a slot only drops the pool's reference - Mats still
+			// held downstream keep their memory alive.
+			slots.resize(size);
+			for (size_t i = 0; i < slots.size(); ++i) {
+				if (slots[i].storage.empty()) {
+					slots[i].offset = 0;
+					slots[i].capacity = 0;
+				}
+			}
+			next_slot = 0;
+		}
+
+		void FramePool::allocate(Slot & slot, int depth, size_t elements) {
+			// One page of slack to move the start of the frame to a page boundary
+			const size_t elem_size = CV_ELEM_SIZE1(depth);
+			const size_t slack = page_size / elem_size;
+			slot.storage = cv::Mat(1, (int) (elements + slack), CV_MAKETYPE(depth, 1));
+
+			const size_t address = (size_t) slot.storage.data;
+			const size_t aligned = (address + page_size - 1) / page_size * page_size;
+			slot.offset = (aligned - address) / elem_size;
+			slot.capacity = elements;
+		}
+
+		cv::Mat FramePool::acquire(int rows, int cols, int type) {
+			const int depth = CV_MAT_DEPTH(type);
+			const int channels = CV_MAT_CN(type);
+			const size_t elements = (size_t) rows * cols * channels;
+
+			unsigned int in_use = 0;
+			Slot * found = 0;
+			for (size_t i = 0; i < slots.size(); ++i) {
+				Slot & slot = slots[(next_slot + i) % slots.size()];
+				if (!isFree(slot.storage)) {
+					++in_use;
+				} else if (!found) {
+					found = &slot;
+					next_slot = (next_slot + i + 1) % slots.size();
+				}
+			}
+
+			if (!found) {
+				++exhausted_count;
+				return cv::Mat();
+			}
+
+			if (found->storage.empty() || found->storage.depth() != depth || found->capacity < elements)
+				allocate(*found, depth, elements);
+
+			++acquired_count;
+			if (in_use + 1 > high_water)
+				high_water = in_use + 1;
+
+			// Both colRange and reshape keep the reference counter of storage,
+			// which is what brings the buffer back to the pool.
+			return found->storage.colRange((int) found->offset, (int) (found->offset + elements)).reshape(channels, rows);
+		}
+
+		void FramePool::reserve(int rows, int cols, int type) {
+			const int depth = CV_MAT_DEPTH(type);
+			const size_t elements = (size_t) rows * cols * CV_MAT_CN(type);
+			for (size_t i = 0; i < slots.size(); ++i) {
+				Slot & slot = slots[i];
+				if (isFree(slot.storage) && (slot.storage.empty() || slot.storage.depth() != depth || slot.capacity < elements))
+					allocate(slot, depth, elements);
+			}
+		}
+
+		unsigned int FramePool::inUse() const {
+			unsigned int in_use = 0;
+			for (size_t i = 0; i < slots.size(); ++i)
+				if (!isFree(slots[i].storage))
+					++in_use;
+			return in_use;
+		}
+
+} //: namespace CameraPGR
+} //: namespace Sources
@@ -0,0 +1,105 @@
+/*!
+ * \file
+ * \brief Pool of preallocated frame buffers
+ * \author Mikolaj Kojdecki
+ */
+
+#ifndef FRAMEPOOL_HPP_
+#define FRAMEPOOL_HPP_
+
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+namespace Sources {
+namespace CameraPGR {
+
+/*!
+ * \class FramePool
+ * \brief Fixed set of page-aligned frame buffers recycled between frames.
+ *
+ * Frames are handed out as cv::Mat headers sharing the reference counter
+ * of the buffer, so a buffer returns to the pool by itself when the last
+ * downstream copy of the Mat is released. No buffer is ever allocated or
+ * freed during capture unless the frame geometry grows.
+ *
+ * acquire() is meant to be called from one thread (the capture thread).
+ */
+class FramePool {
+public:
+	/*!
+	 * \param size number of buffers
+	 */
+	FramePool(unsigned int size = 8);
+
+	/*!
+	 * Changes number of buffers. Buffers still used downstream are
+	 * released by their last user.
+	 */
+	void resize(unsigned int size);
+
+	/*!
+	 * Returns continuous rows x cols Mat of given type backed by a free
+	 * buffer, or an empty Mat if all buffers are still in use.
+	 */
+	cv::Mat acquire(int rows, int cols, int type);
+
+	/*!
+	 * Grows free buffers to hold rows x cols frames of given type, so that
+	 * the next frames of that geometry allocate nothing. Buffers in use
+	 * downstream grow when they are acquired again.
+	 */
+	void reserve(int rows, int cols, int type);
+
+	unsigned int size() const {
+		return slots.size();
+	}
+
+	/*!
+	 * Number of buffers currently held downstream.
+	 */
+	unsigned int inUse() const;
+
+	/// Highest number of buffers ever in use at the same time
+	unsigned int highWater() const {
+		return high_water;
+	}
+
+	/// Number of acquire() calls that found no free buffer
+	unsigned long exhausted() const {
+		return exhausted_count;
+	}
+
+	/// Number of successful acquire() calls
+	unsigned long acquired() const {
+		return acquired_count;
+	}
+
+private:
+	struct Slot {
+		/// Owner of the memory, one row of elements of given depth
+		cv::Mat storage;
+		/// Offset (in elements) of the first page-aligned element
+		size_t offset;
+		/// Number of usable elements after offset
+		size_t capacity;
+	};
+
+	/*!
+	 * (Re)allocates slot memory for given number of elements.
+	 */
+	void allocate(Slot & slot, int depth, size_t elements);
+
+	std::vector<Slot> slots;
+	size_t page_size;
+	unsigned int next_slot;
+
+	unsigned int high_water;
+	unsigned long exhausted_count;
+	unsigned long acquired_count;
+};
+
+} //: namespace CameraPGR
+} //: namespace Sources
+
+#endif /* FRAMEPOOL_HPP_ */
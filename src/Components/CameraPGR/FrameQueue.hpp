@@ -0,0 +1,234 @@
+/*!
+ * \file
+ * \brief Bounded frame queue between the capture thread and the executor
+ * \author Mikolaj Kojdecki
+ */
+
+#ifndef FRAMEQUEUE_HPP_
+#define FRAMEQUEUE_HPP_
+
+#include <string>
+
+#include <boost/atomic.hpp>
+#include <boost/scoped_array.hpp>
+#include <boost/thread.hpp>
+
+namespace Sources {
+namespace CameraPGR {
+
+/*!
+ * What happens when the consumer falls behind.
+ */
+enum QueuePolicy {
+	/// Consumer always gets the newest frame, older ones are discarded
+	QUEUE_LATEST_ONLY,
+	/// Consumer gets frames in order, the oldest is discarded when the queue is full
+	QUEUE_DROP_OLDEST,
+	/// Consumer gets every frame, producer waits when the queue is full
+	QUEUE_BLOCK
+};
+
+/*!
+ * Parses "latest", "drop_oldest" or "block" (anything else - latest).
+ */
+inline QueuePolicy queuePolicyFromString(const std::string & name) {
+	if (name == "drop_oldest")
+		return QUEUE_DROP_OLDEST;
+	if (name == "block")
+		return QUEUE_BLOCK;
+	return QUEUE_LATEST_ONLY;
+}
+
+/*!
+ * \class FrameQueue
+ * \brief Bounded lock-free single-producer/single-consumer ring.
+ *
+ * Each cell carries a sequence number telling whether it is free for the
+ * producer or ready for the consumer, so neither side ever takes a lock.
+ * Taking an item out is also safe from the producer, which is how the
+ * oldest item is evicted when the queue is full.
+ *
+ * The only lock is the one the producer sleeps on in QUEUE_BLOCK mode
+ * while the queue is full.
+ *
+ * Counters:
+ * - enqueued - items accepted by push(),
+ * - dropped - items evicted by the producer because the queue was full,
+ * - stale - items skipped by pop() because a newer one was available.
+ */
+template <typename T>
+class FrameQueue {
+public:
+	/*!
+	 * \param capacity maximal number of queued items (rounded up to a power of two, at least 2)
+	 */
+	FrameQueue(size_t capacity, QueuePolicy queue_policy) :
+		policy(queue_policy), head(0), tail(0), closed(false), producer_waiting(false),
+		enqueued_count(0), dropped_count(0), stale_count(0) {
+		size_t size = 2;
+		while (size < capacity)
+			size *= 2;
+		mask = size - 1;
+		cells.reset(new Cell[size]);
+		for (size_t i = 0; i < size; ++i)
+			cells[i].sequence.store(i, boost::memory_order_relaxed);
+	}
+
+	/*!
+	 * Called by the producer. Returns false if the item was not queued,
+	 * which only happens after close().
+	 */
+	bool push(const T & item) {
+		while (!tryPush(item)) {
+			if (closed.load(boost::memory_order_acquire))
+				return false;
+
+			if (policy == QUEUE_BLOCK) {
+				waitForSpace();
+				continue;
+			}
+
+			// The cell under head may still be copied out by the consumer,
+			// give it a moment instead of evicting another item.
+			if (head.load(boost::memory_order_relaxed) - tail.load(boost::memory_order_acquire) <= mask) {
+				boost::this_thread::yield();
+				continue;
+			}
+
+			T evicted;
+			if (tryPop(evicted))
+				++dropped_count;
+		}
+		++enqueued_count;
+		return true;
+	}
+
+	/*!
+	 * Called by the consumer, never blocks. Returns false if there is nothing to read.
+	 * In QUEUE_LATEST_ONLY mode all but the newest item are skipped.
+	 */
+	bool pop(T & item) {
+		if (!tryPop(item))
+			return false;
+
+		if (policy == QUEUE_LATEST_ONLY) {
+			while (tryPop(item))
+				++stale_count;
+		}
+
+		if (producer_waiting.load(boost::memory_order_acquire)) {
+			boost::mutex::scoped_lock lock(wait_mutex);
+			space_available.notify_one();
+		}
+		return true;
+	}
+
+	/*!
+	 * Wakes up the producer waiting in push() and makes further pushes fail.
+	 */
+	void close() {
+		closed.store(true, boost::memory_order_release);
+		boost::mutex::scoped_lock lock(wait_mutex);
+		space_available.notify_all();
+	}
+
+	/*!
+	 * Number of items waiting for the consumer.
+	 */
+	size_t size() const {
+		return head.load(boost::memory_order_acquire) - tail.load(boost::memory_order_acquire);
+	}
+
+	size_t capacity() const {
+		return mask + 1;
+	}
+
+	unsigned long enqueued() const {
+		return enqueued_count.load(boost::memory_order_relaxed);
+	}
+
+	unsigned long dropped() const {
+		return dropped_count.load(boost::memory_order_relaxed);
+	}
+
+	unsigned long stale() const {
+		return stale_count.load(boost::memory_order_relaxed);
+	}
+
+private:
+	struct Cell {
+		Cell() : sequence(0) {
+		}
+
+		boost::atomic<size_t> sequence;
+		T data;
+	};
+
+	bool tryPush(const T & item) {
+		const size_t pos = head.load(boost::memory_order_relaxed);
+		Cell & cell = cells[pos & mask];
+		if (cell.sequence.load(boost::memory_order_acquire) != pos)
+			return false;
+
+		cell.data = item;
+		// single producer, nobody else moves head; it is moved before the
+		// cell is published so that tail never overtakes it
+		head.store(pos + 1, boost::memory_order_release);
+		cell.sequence.store(pos + 1, boost::memory_order_release);
+		return true;
+	}
+
+	bool tryPop(T & item) {
+		size_t pos = tail.load(boost::memory_order_relaxed);
+		Cell * cell;
+		for (;;) {
+			cell = &cells[pos & mask];
+			const size_t sequence = cell->sequence.load(boost::memory_order_acquire);
+			const long diff = (long) sequence - (long) (pos + 1);
+			if (diff == 0) {
+				// both the consumer and the evicting producer may get here
+				if (tail.compare_exchange_weak(pos, pos + 1, boost::memory_order_relaxed))
+					break;
+			} else if (diff < 0) {
+				return false;
+			} else {
+				pos = tail.load(boost::memory_order_relaxed);
+			}
+		}
+
+		item = cell->data;
+		// release our reference, e.g. to let a pool buffer go back to the pool
+		cell->data = T();
+		cell->sequence.store(pos + mask + 1, boost::memory_order_release);
+		return true;
+	}
+
+	void waitForSpace() {
+		boost::mutex::scoped_lock lock(wait_mutex);
+		producer_waiting.store(true, boost::memory_order_release);
+		if (size() > mask && !closed.load(boost::memory_order_acquire))
+			space_available.timed_wait(lock, boost::posix_time::milliseconds(10));
+		producer_waiting.store(false, boost::memory_order_release);
+	}
+
+	const QueuePolicy policy;
+	boost::scoped_array<Cell> cells;
+	size_t mask;
+
+	boost::atomic<size_t> head;
+	boost::atomic<size_t> tail;
+	boost::atomic<bool> closed;
+
+	boost::atomic<bool> producer_waiting;
+	boost::mutex wait_mutex;
+	boost::condition_variable space_available;
+
+	boost::atomic<unsigned long> enqueued_count;
+	boost::atomic<unsigned long> dropped_count;
+	boost::atomic<unsigned long> stale_count;
+};
+
+} //: namespace CameraPGR
+} //: namespace Sources
+
+#endif /* FRAMEQUEUE_HPP_ */
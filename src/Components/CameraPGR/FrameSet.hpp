@@ -0,0 +1,50 @@
+/*!
+ * \file
+ * \brief Frames of all cameras taken at the same time
+ * \author Mikolaj Kojdecki
+ */
+
+#ifndef FRAMESET_HPP_
+#define FRAMESET_HPP_
+
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include <boost/cstdint.hpp>
+
+#include "FrameMeta.hpp"
+
+namespace Sources {
+namespace CameraPGR {
+
+/*!
+ * \class FrameSet
+ * \brief One frame of every camera, matched by capture time, written to
+ * out_frame_set.
+ */
+class FrameSet {
+public:
+	/// Images and their capture information, in order of camera_serial
+	std::vector<cv::Mat> images;
+	std::vector<FrameMeta> meta;
+	/// Previews of the images, empty where none was made
+	std::vector<cv::Mat> previews;
+
+	/// Capture time (ns, host monotonic clock) of the earliest frame of the set
+	boost::uint64_t time;
+	/// Difference (ns) between capture times of the latest and the earliest frame
+	boost::uint64_t skew;
+	/// Number of the set, counted from 0
+	unsigned long sequence;
+
+	FrameSet() {
+		time = 0;
+		skew = 0;
+		sequence = 0;
+	}
+};
+
+}
+}
+#endif
@@ -0,0 +1,119 @@
+/*!
+ * \file
+ * \brief Matching frames of several cameras into sets
+ * \author Mikolaj Kojdecki
+ */
+
+#include "FrameSetMatcher.hpp"
+
+namespace Sources {
+namespace CameraPGR {
+
+		FrameSetMatcher::FrameSetMatcher(unsigned int cameras, boost::uint64_t tolerance, unsigned int depth) :
+			tolerance(tolerance), depth(depth > 0 ? depth : 1), pending(cameras), clocks(cameras), counter_offsets(cameras, 0),
+			counters_aligned(false), unmatched_since_set(0), total_frames(0), total_sets(0) {
+			stats.frames = stats.sets = stats.unmatched = 0;
+			for (size_t i = 0; i < clocks.size(); ++i)
+				clocks[i].known = false;
+		}
+
+		boost::uint64_t FrameSetMatcher::hostTime(unsigned int camera, const FrameMeta & meta) {
+			if (meta.timestamp_seconds == 0 && meta.timestamp_microseconds == 0)
+				return meta.received;
+			const boost::int64_t stamp = (boost::int64_t) meta.timestamp_seconds * 1000000000ll + meta.timestamp_microseconds * 1000ll;
+			// the frame delivered fastest gives the lowest offset, later ones only add transfer time
+			const boost::int64_t sample = (boost::int64_t) meta.received - stamp;
+			ClockOffset & clock = clocks[camera];
+			const boost::int64_t elapsed = stamp - clock.stamp;
+			if (clock.known && (elapsed < 0 || sample - clock.offset > 1000000000ll))
+				// camera clock went back or jumped, e.g. the camera was reconnected
+				clock.known = false;
+			if (clock.known)
+				clock.offset += elapsed / 1000000000ll * max_clock_drift + elapsed % 1000000000ll * max_clock_drift / 1000000000ll;
+			if (!clock.known || sample < clock.offset)
+				clock.offset = sample;
+			clock.known = true;
+			clock.stamp = stamp;
+			return stamp + clock.offset;
+		}
+
+		bool FrameSetMatcher::add(unsigned int camera, const Frame & frame, FrameSet & set) {
+			boost::mutex::scoped_lock lock(mutex);
+			++stats.frames;
+			++total_frames;
+
+			std::deque<Pending> & queue = pending[camera];
+			Pending waiting;
+			waiting.frame = frame;
+			waiting.time = hostTime(camera, frame.meta);
+			queue.push_back(waiting);
+			if (queue.size() > depth) {
+				queue.pop_front();
+				++stats.unmatched;
+				++unmatched_since_set;
+			}
+
+			for (;;) {
+				size_t oldest = 0;
+				boost::uint64_t first = 0, last = 0;
+				for (size_t i = 0; i < pending.size(); ++i) {
+					if (pending[i].empty())
+						return false;
+					const boost::uint64_t time = pending[i].front().time;
+					if (i == 0 || time < first) {
+						first = time;
+						oldest = i;
+					}
+					if (i == 0 || time > last)
+						last = time;
+				}
+
+				if (last - first > tolerance) {
+					// the oldest frame is too old for any frame still to come
+					pending[oldest].pop_front();
+					++stats.unmatched;
+					// a full queue of every camera without a set: offsets are no longer to be trusted
+					if (++unmatched_since_set > depth * pending.size())
+						counters_aligned = false;
+					continue;
+				}
+
+				set.images.resize(pending.size());
+				set.meta.resize(pending.size());
+				set.previews.resize(pending.size());
+				for (size_t i = 0; i < pending.size(); ++i) {
+					const Frame & matched = pending[i].front().frame;
+					set.images[i] = matched.image;
+					set.meta[i] = matched.meta;
+					set.previews[i] = matched.preview;
+					pending[i].pop_front();
+					counter_offsets[i] = (boost::int64_t) set.meta[i].frame_counter - set.meta[0].frame_counter;
+				}
+				counters_aligned = true;
+				unmatched_since_set = 0;
+				set.time = first;
+				set.skew = last - first;
+				set.sequence = total_sets;
+				skew.record(set.skew);
+				++stats.sets;
+				++total_sets;
+				return true;
+			}
+		}
+
+		bool FrameSetMatcher::counterOffset(unsigned int camera, boost::int64_t & offset) {
+			boost::mutex::scoped_lock lock(mutex);
+			offset = counter_offsets[camera];
+			return counters_aligned;
+		}
+
+		FrameSetMatcher::Stats FrameSetMatcher::collect() {
+			boost::mutex::scoped_lock lock(mutex);
+			Stats result = stats;
+			result.skew = skew.collect();
+			stats.frames = stats.sets = stats.unmatched = 0;
+			return result;
+		}
+
+} //: namespace CameraPGR
+} //: namespace Sources
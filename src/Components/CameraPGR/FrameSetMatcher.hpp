@@ -0,0 +1,134 @@
+/*!
+ * \file
+ * \brief Matching frames of several cameras into sets
+ * \author Mikolaj Kojdecki
+ */
+
+#ifndef FRAMESETMATCHER_HPP_
+#define FRAMESETMATCHER_HPP_
+
+#include <deque>
+#include <vector>
+
+#include <boost/cstdint.hpp>
+#include <boost/thread.hpp>
+
+#include "Frame.hpp"
+#include "FrameSet.hpp"
+#include "LatencyHistogram.hpp"
+
+namespace Sources {
+namespace CameraPGR {
+
+/*!
+ * \class FrameSetMatcher
+ * \brief Collects frames of all cameras and releases them as sets of
+ * frames captured within tolerance of each other.
+ *
+ * Cameras stamp frames with clocks of their own, neither shared nor in
+ * step, so each stamp is moved to the host monotonic clock (the one of
+ * FrameMeta::received) by an offset estimated per camera: received minus
+ * stamp of the frame delivered fastest. The offset follows clock drift of
+ * up to max_clock_drift and starts over when the camera clock jumps.
+ *
+ * Every camera has a short queue of frames waiting for the others. When
+ * all queues are non-empty the oldest frames either form a set or the
+ * oldest of them is dropped, since no later frame can match it. Frames
+ * of a camera that stopped delivering are dropped when its queue
+ * overflows. add() may be called from capture threads of all cameras.
+ */
+class FrameSetMatcher {
+public:
+	/*!
+	 * Counters since the previous collect().
+	 */
+	struct Stats {
+		unsigned long frames;
+		unsigned long sets;
+		/// Frames dropped without a match
+		unsigned long unmatched;
+		LatencyHistogram::Summary skew;
+	};
+
+	/*!
+	 * \param cameras number of frames in a set
+	 * \param tolerance maximal difference of capture times (ns) in a set
+	 * \param depth frames of one camera waiting for the others
+	 */
+	FrameSetMatcher(unsigned int cameras, boost::uint64_t tolerance, unsigned int depth = 4);
+
+	/*!
+	 * Adds frame of camera. Returns true and fills set if the frame
+	 * completed a set.
+	 */
+	bool add(unsigned int camera, const Frame & frame, FrameSet & set);
+
+	/*!
+	 * Returns counters and clears them.
+	 */
+	Stats collect();
+
+	unsigned long totalSets() const {
+		return total_sets;
+	}
+
+	unsigned long totalFrames() const {
+		return total_frames;
+	}
+
+	/*!
+	 * Frame counter of the camera minus that of the first camera, taken from
+	 * the last set, so all cameras can tell frames of one exposure apart.
+	 * Returns false before the first set and when sets stopped forming
+	 * (counters went out of step, e.g. a camera restarted).
+	 */
+	bool counterOffset(unsigned int camera, boost::int64_t & offset);
+
+	/// Drift (ns per second) of camera clocks against the host followed by the offsets
+	static const boost::int64_t max_clock_drift = 100000;
+
+private:
+	/// Offset of the clock of one camera to the host clock
+	struct ClockOffset {
+		bool known;
+		/// Host time minus camera time (ns)
+		boost::int64_t offset;
+		/// Camera time of the last frame (ns)
+		boost::int64_t stamp;
+	};
+
+	/// Frame waiting for the others, with its capture time on the host clock
+	struct Pending {
+		Frame frame;
+		boost::uint64_t time;
+	};
+
+	/*!
+	 * Capture time of the frame on the host clock (ns), the time it was
+	 * received when the camera gives no time stamp. Updates the offset of
+	 * the camera.
+	 */
+	boost::uint64_t hostTime(unsigned int camera, const FrameMeta & meta);
+
+	const boost::uint64_t tolerance;
+	const unsigned int depth;
+
+	boost::mutex mutex;
+	std::vector<std::deque<Pending> > pending;
+	std::vector<ClockOffset> clocks;
+	/// Frame counter offsets of the last set, valid while counters_aligned
+	std::vector<boost::int64_t> counter_offsets;
+	bool counters_aligned;
+	/// Frames dropped without a match since the last set
+	unsigned long unmatched_since_set;
+
+	Stats stats;
+	LatencyHistogram skew;
+	unsigned long total_frames;
+	unsigned long total_sets;
+};
+
+} //: namespace CameraPGR
+} //: namespace Sources
+
+#endif /* FRAMESETMATCHER_HPP_ */
@@ -0,0 +1,80 @@
+/*!
+ * \file
+ * \brief Lock-free latency histogram
+ * \author Mikolaj Kojdecki
+ */
+
+#include "LatencyHistogram.hpp"
+
+namespace Sources {
+namespace CameraPGR {
+
+		LatencyHistogram::LatencyHistogram() : max_value(0) {
+			for (int i = 0; i < bucket_count; ++i)
+				buckets[i].store(0, boost::memory_order_relaxed);
+		}
+
+		int LatencyHistogram::bucketIndex(boost::uint64_t value) {
+			if (value < (boost::uint64_t) sub_buckets)
+				return (int) value;
+
+			const int exponent = 63 - __builtin_clzll(value);
+			if (exponent > max_exponent)
+				return bucket_count - 1;
+
+			const int sub = (int) (value >> (exponent - sub_bits)) & (sub_buckets - 1);
+			return sub_buckets + (exponent - sub_bits) * sub_buckets + sub;
+		}
+
+		boost::uint64_t LatencyHistogram::bucketValue(int index) {
+			if (index < sub_buckets)
+				return index;
+
+			const int exponent = (index - sub_buckets) / sub_buckets + sub_bits;
+			const int sub = (index - sub_buckets) % sub_buckets;
+			const boost::uint64_t width = 1ull << (exponent - sub_bits);
+			return (1ull << exponent) + sub * width + width / 2;
+		}
+
+		void LatencyHistogram::record(boost::uint64_t nanoseconds) {
+			buckets[bucketIndex(nanoseconds)].fetch_add(1, boost::memory_order_relaxed);
+
+			boost::uint64_t current = max_value.load(boost::memory_order_relaxed);
+			while (nanoseconds > current && !max_value.compare_exchange_weak(current, nanoseconds, boost::memory_order_relaxed))
+				;
+		}
+
+		LatencyHistogram::Summary LatencyHistogram::collect() {
+			boost::uint32_t counts[bucket_count];
+			Summary summary;
+			summary.count = 0;
+			for (int i = 0; i < bucket_count; ++i) {
+				counts[i] = buckets[i].exchange(0, boost::memory_order_relaxed);
+				summary.count += counts[i];
+			}
+			summary.max = max_value.exchange(0, boost::memory_order_relaxed);
+			summary.p50 = summary.p99 = 0;
+
+			const boost::uint64_t rank50 = (summary.count + 1) / 2;
+			const boost::uint64_t rank99 = summary.count - summary.count / 100;
+			boost::uint64_t seen = 0;
+			for (int i = 0; i < bucket_count && seen < rank99; ++i) {
+				if (counts[i] == 0)
+					continue;
+				if (seen < rank50 && seen + counts[i] >= rank50)
+					summary.p50 = bucketValue(i);
+				seen += counts[i];
+				if (seen >= rank99)
+					summary.p99 = bucketValue(i);
+			}
+
+			// bucket middle may exceed the largest value recorded
+			if (summary.p50 > summary.max)
+				summary.p50 = summary.max;
+			if (summary.p99 > summary.max)
+				summary.p99 = summary.max;
+			return summary;
+		}
+
+} //: namespace CameraPGR
+} //: namespace Sources
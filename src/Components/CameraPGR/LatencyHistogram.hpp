@@ -0,0 +1,66 @@
+/*!
+ * \file
+ * \brief Lock-free latency histogram
+ * \author Mikolaj Kojdecki
+ */
+
+#ifndef LATENCYHISTOGRAM_HPP_
+#define LATENCYHISTOGRAM_HPP_
+
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+
+namespace Sources {
+namespace CameraPGR {
+
+/*!
+ * \class LatencyHistogram
+ * \brief Log-linear histogram of durations in nanoseconds.
+ *
+ * Every power of two is split into 16 buckets (as in HdrHistogram), which
+ * keeps relative error of percentiles below 1/16 for values from 1 ns to
+ * about 18 minutes in a fixed array. record() is a single relaxed atomic
+ * increment and may be called from any thread.
+ */
+class LatencyHistogram {
+public:
+	/*!
+	 * Percentiles of values recorded since the previous collect().
+	 */
+	struct Summary {
+		boost::uint64_t count;
+		boost::uint64_t p50;
+		boost::uint64_t p99;
+		boost::uint64_t max;
+	};
+
+	LatencyHistogram();
+
+	void record(boost::uint64_t nanoseconds);
+
+	/*!
+	 * Returns summary of recorded values and clears the histogram.
+	 */
+	Summary collect();
+
+private:
+	static const int sub_bits = 4;
+	static const int sub_buckets = 1 << sub_bits;
+	static const int max_exponent = 40;
+	static const int bucket_count = sub_buckets + (max_exponent - sub_bits + 1) * sub_buckets;
+
+	static int bucketIndex(boost::uint64_t value);
+
+	/*!
+	 * Middle of the range of values falling into bucket.
+	 */
+	static boost::uint64_t bucketValue(int index);
+
+	boost::atomic<boost::uint32_t> buckets[bucket_count];
+	boost::atomic<boost::uint64_t> max_value;
+};
+
+} //: namespace CameraPGR
+} //: namespace Sources
+
+#endif /* LATENCYHISTOGRAM_HPP_ */
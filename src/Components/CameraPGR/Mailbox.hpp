@@ -0,0 +1,57 @@
+/*!
+ * \file
+ * \brief Lock-free single-slot mailbox
+ * \author Mikolaj Kojdecki
+ */
+
+#ifndef MAILBOX_HPP_
+#define MAILBOX_HPP_
+
+#include <boost/atomic.hpp>
+#include <boost/noncopyable.hpp>
+
+namespace Sources {
+namespace CameraPGR {
+
+/*!
+ * \class Mailbox
+ * \brief Holds the newest message posted and not taken yet.
+ *
+ * A message posted before the previous one was taken replaces it, so the
+ * reader always gets the latest state and never a backlog. post() and
+ * take() are a single atomic exchange each and never block.
+ */
+template <typename T>
+class Mailbox: private boost::noncopyable {
+public:
+	Mailbox() : slot(0) {
+	}
+
+	~Mailbox() {
+		delete slot.exchange(0, boost::memory_order_acquire);
+	}
+
+	void post(const T & message) {
+		delete slot.exchange(new T(message), boost::memory_order_acq_rel);
+	}
+
+	/*!
+	 * Takes message, returns false if there is none.
+	 */
+	bool take(T & message) {
+		T * posted = slot.exchange(0, boost::memory_order_acquire);
+		if (!posted)
+			return false;
+		message = *posted;
+		delete posted;
+		return true;
+	}
+
+private:
+	boost::atomic<T *> slot;
+};
+
+} //: namespace CameraPGR
+} //: namespace Sources
+
+#endif /* MAILBOX_HPP_ */
@@ -0,0 +1,55 @@
+/*!
+ * \file
+ * \brief Camera property values last written to the camera
+ * \author Mikolaj Kojdecki
+ */
+
+#include "PropertyCache.hpp"
+
+namespace Sources {
+namespace CameraPGR {
+
+		PropertyCache::PropertyCache() :
+			sent_count(0), skipped_count(0) {
+		}
+
+		bool PropertyCache::same(const FlyCapture2::Property & a, const FlyCapture2::Property & b) {
+			if (a.onOff != b.onOff || a.autoManualMode != b.autoManualMode || a.absControl != b.absControl || a.onePush != b.onePush)
+				return false;
+			// value does not matter while the camera controls it
+			if (a.autoManualMode || a.onePush)
+				return true;
+			return a.absControl ? a.absValue == b.absValue : (a.valueA == b.valueA && a.valueB == b.valueB);
+		}
+
+		bool PropertyCache::apply(CaptureBackend & camera, const FlyCapture2::Property & prop) {
+			std::map<int, FlyCapture2::Property>::iterator it = applied.find(prop.type);
+			if (it != applied.end() && same(it->second, prop)) {
+				++skipped_count;
+				return true;
+			}
+
+			++sent_count;
+			if (!camera.setProperty(prop)) {
+				applied.erase(prop.type);
+				return false;
+			}
+			applied[prop.type] = prop;
+			return true;
+		}
+
+		void PropertyCache::repeatOnePush() {
+			for (std::map<int, FlyCapture2::Property>::iterator it = applied.begin(); it != applied.end();) {
+				if (it->second.onePush)
+					applied.erase(it++);
+				else
+					++it;
+			}
+		}
+
+		void PropertyCache::clear() {
+			applied.clear();
+		}
+
+} //: namespace CameraPGR
+} //: namespace Sources
@@ -0,0 +1,69 @@
+/*!
+ * \file
+ * \brief Camera property values last written to the camera
+ * \author Mikolaj Kojdecki
+ */
+
+#ifndef PROPERTYCACHE_HPP_
+#define PROPERTYCACHE_HPP_
+
+#include <map>
+
+//FlyCapture2 imports
+#include <FlyCapture2.h>
+
+#include "CaptureBackend.hpp"
+
+namespace Sources {
+namespace CameraPGR {
+
+/*!
+ * \class PropertyCache
+ * \brief Sends property to the camera only if it differs from the value
+ * written before.
+ *
+ * Every SetProperty is a round trip over GigE, so reapplying the whole
+ * configuration after a single change is expensive. A one-push request is
+ * kept like a value: it is sent again only when the property changes or
+ * after repeatOnePush(), since every send restarts the adjustment.
+ */
+class PropertyCache {
+public:
+	PropertyCache();
+
+	/*!
+	 * Writes prop to camera unless it is already set. Returns false if
+	 * writing failed.
+	 */
+	bool apply(CaptureBackend & camera, const FlyCapture2::Property & prop);
+
+	/*!
+	 * Forgets one-push requests, so the next apply() runs them again.
+	 */
+	void repeatOnePush();
+
+	/*!
+	 * Forgets all values, e.g. after the camera was reconnected.
+	 */
+	void clear();
+
+	unsigned long sent() const {
+		return sent_count;
+	}
+
+	unsigned long skipped() const {
+		return skipped_count;
+	}
+
+private:
+	static bool same(const FlyCapture2::Property & a, const FlyCapture2::Property & b);
+
+	std::map<int, FlyCapture2::Property> applied;
+	unsigned long sent_count;
+	unsigned long skipped_count;
+};
+
+} //: namespace CameraPGR
+} //: namespace Sources
+
+#endif /* PROPERTYCACHE_HPP_ */
@@ -0,0 +1,84 @@
+/*!
+ * \file
+ * \brief Frame rate following what downstream components consume
+ * \author Mikolaj Kojdecki
+ */
+
+#include <algorithm>
+#include <sstream>
+
+#include "RateGovernor.hpp"
+
+namespace Sources {
+namespace CameraPGR {
+
+namespace {
+
+/// Lowered rate stays this much under the delivered one, so that queues drain
+const double drain_margin = 0.1;
+/// Smaller changes are not made
+const double hysteresis = 0.02;
+/// Calm intervals in a row before the rate is raised
+const unsigned int calm_intervals = 3;
+/// Relative step of raising
+const double raise_step = 0.1;
+
+}
+
+		RateGovernor::RateGovernor(boost::uint64_t latency_target, double min_rate) :
+			latency_target(latency_target), min_rate(min_rate), max_rate(0), current(0), calm(0) {
+		}
+
+		void RateGovernor::setCeiling(double rate) {
+			max_rate = rate;
+			if (current > max_rate && max_rate > 0)
+				current = max_rate;
+		}
+
+		RateGovernor::Decision RateGovernor::update(const Sample & sample) {
+			Decision decision;
+			decision.changed = false;
+			if (max_rate <= 0)
+				max_rate = sample.captured_fps;
+			if (current <= 0)
+				current = max_rate;
+			decision.rate = current;
+			if (current <= 0)
+				return decision;
+
+			std::stringstream reason;
+			reason.setf(std::ios::fixed);
+			reason.precision(1);
+			const double latency_ms = sample.latency / 1e6;
+			const double target_ms = latency_target / 1e6;
+			if (sample.dropped > 0 || sample.latency > latency_target) {
+				calm = 0;
+				const double rate = std::max(min_rate, std::min(current, sample.delivered_fps) * (1 - drain_margin));
+				if (rate >= current * (1 - hysteresis))
+					return decision;
+				reason << "lowering rate " << current << " -> " << rate << " FPS: ";
+				if (sample.dropped > 0)
+					reason << sample.dropped << " frames dropped in " << sample.seconds << " s, ";
+				reason << "delivered " << sample.delivered_fps << " FPS, latency p99 " << latency_ms << " ms (target " << target_ms << " ms)";
+				current = rate;
+			} else if (sample.latency < latency_target / 2 && current < max_rate) {
+				if (++calm < calm_intervals)
+					return decision;
+				calm = 0;
+				const double rate = std::min(max_rate, std::max(current * (1 + raise_step), current + 1));
+				reason << "raising rate " << current << " -> " << rate << " FPS: no drops for " << calm_intervals << " intervals, latency p99 "
+						<< latency_ms << " ms (target " << target_ms << " ms)";
+				current = rate;
+			} else {
+				calm = 0;
+				return decision;
+			}
+
+			decision.changed = true;
+			decision.rate = current;
+			decision.reason = reason.str();
+			return decision;
+		}
+
+} //: namespace CameraPGR
+} //: namespace Sources
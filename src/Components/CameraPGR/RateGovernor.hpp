@@ -0,0 +1,88 @@
+/*!
+ * \file
+ * \brief Frame rate following what downstream components consume
+ * \author Mikolaj Kojdecki
+ */
+
+#ifndef RATEGOVERNOR_HPP_
+#define RATEGOVERNOR_HPP_
+
+#include <string>
+
+#include <boost/cstdint.hpp>
+
+namespace Sources {
+namespace CameraPGR {
+
+/*!
+ * \class RateGovernor
+ * \brief Chooses the frame rate from consumption measured over intervals.
+ *
+ * When frames are dropped before reaching the outputs or the delivery
+ * latency exceeds the target, the rate is lowered below the rate at which
+ * frames were actually delivered, so that queues drain. After several calm
+ * intervals (no drops, latency under half the target) it is raised again by
+ * steps, up to the ceiling. Every change comes with the metric that caused it.
+ */
+class RateGovernor {
+public:
+	/*!
+	 * Consumption over one interval, of the slowest camera.
+	 */
+	struct Sample {
+		/// Length of the interval (s)
+		double seconds;
+		/// Frames retrieved from the camera per second
+		double captured_fps;
+		/// Frames written to the outputs per second
+		double delivered_fps;
+		/// Frames captured or sent by the camera and never written to the outputs
+		unsigned long dropped;
+		/// Time from receiving frames to writing them, 99th percentile (ns)
+		boost::uint64_t latency;
+	};
+
+	struct Decision {
+		bool changed;
+		/// Rate to use (FPS)
+		double rate;
+		/// What was decided and why, for the log
+		std::string reason;
+	};
+
+	/*!
+	 * \param latency_target highest acceptable delivery latency (ns)
+	 * \param min_rate rate never to go below (FPS)
+	 */
+	RateGovernor(boost::uint64_t latency_target, double min_rate);
+
+	/*!
+	 * Rate not to exceed, the one configured; 0 - taken from the first
+	 * sample that has frames.
+	 */
+	void setCeiling(double rate);
+
+	Decision update(const Sample & sample);
+
+	/// Rate in effect, 0 - not known yet
+	double rate() const {
+		return current;
+	}
+
+	double ceiling() const {
+		return max_rate;
+	}
+
+private:
+	const boost::uint64_t latency_target;
+	const double min_rate;
+	double max_rate;
+	double current;
+	/// Calm intervals in a row
+	unsigned int calm;
+};
+
+} //: namespace CameraPGR
+} //: namespace Sources
+
+#endif /* RATEGOVERNOR_HPP_ */
@@ -0,0 +1,126 @@
+/*!
+ * \file
+ * \brief Layout of .pgrraw files with raw frames recorded from a camera
+ * \author Mikolaj Kojdecki
+ */
+
+#ifndef RAWCONTAINER_HPP_
+#define RAWCONTAINER_HPP_
+
+#include <cstddef>
+
+#include <boost/cstdint.hpp>
+#include <boost/static_assert.hpp>
+
+namespace Sources {
+namespace CameraPGR {
+
+/*
+ * A .pgrraw file is a sequence of blocks of raw_block_size bytes:
+ *
+ *   file header | chunk | chunk | ... | index
+ *
+ * - the file header takes the first block,
+ * - a chunk starts with RawChunkHeader, frames follow from byte
+ *   raw_chunk_header_space of the chunk, each a RawFrameHeader followed by
+ *   the image data exactly as received from the camera (rows x stride
+ *   bytes), padded to raw_frame_align; the chunk is padded to whole blocks,
+ * - the index lists all frames (RawIndexEntry) and ends with RawTrailer in
+ *   the last bytes of the file.
+ *
+ * A file of an interrupted recording has no index; its frames can still be
+ * found by walking the chunks. All values are in host (little endian) order.
+ */
+
+/// Unit of all writes, allows unbuffered (O_DIRECT) I/O
+const size_t raw_block_size = 4096;
+/// Offset of the first frame in a chunk
+const size_t raw_chunk_header_space = 64;
+/// Alignment of frames within a chunk
+const size_t raw_frame_align = 64;
+
+const boost::uint32_t raw_format_version = 1;
+
+struct RawFileHeader {
+	/// "PGRRAW" followed by two zero bytes
+	char magic[8];
+	boost::uint32_t version;
+	boost::uint32_t header_size;
+	/// Serial number of the camera
+	boost::uint32_t serial;
+	boost::uint32_t reserved;
+	/// Requested size of chunks, each chunk gives its actual size
+	boost::uint64_t chunk_size;
+	/// Start of the recording, seconds since the Unix epoch
+	boost::uint64_t created;
+	char model[64];
+};
+
+struct RawChunkHeader {
+	/// "CHNK"
+	char magic[4];
+	boost::uint32_t frames;
+	/// Number of the chunk in the file, from 0
+	boost::uint64_t index;
+	/// Size of the chunk including this header and padding
+	boost::uint64_t size;
+};
+
+struct RawFrameHeader {
+	/// "FRAM"
+	char magic[4];
+	boost::uint32_t header_size;
+	boost::uint32_t rows;
+	boost::uint32_t cols;
+	boost::uint32_t stride;
+	/// FlyCapture2::PixelFormat
+	boost::uint32_t pixel_format;
+	/// FlyCapture2::BayerTileFormat
+	boost::uint32_t bayer_tile;
+	/// Bytes of image data following the header
+	boost::uint32_t data_size;
+
+	// FrameMeta of the frame
+	boost::uint64_t camera_time;
+	boost::int64_t timestamp_seconds;
+	boost::uint32_t timestamp_microseconds;
+	boost::uint32_t frame_counter;
+	boost::uint64_t received;
+	float shutter;
+	float gain;
+	boost::uint32_t embedded_shutter;
+	boost::uint32_t embedded_gain;
+};
+
+struct RawIndexEntry {
+	/// Position of RawFrameHeader of the frame in the file
+	boost::uint64_t offset;
+	boost::uint64_t received;
+	boost::uint32_t frame_counter;
+	boost::uint32_t data_size;
+};
+
+struct RawTrailer {
+	/// "PGRIDX" followed by two zero bytes
+	char magic[8];
+	/// Position of the first RawIndexEntry
+	boost::uint64_t index_offset;
+	boost::uint64_t frames;
+	boost::uint64_t chunks;
+};
+
+// sizes are part of the format
+BOOST_STATIC_ASSERT(sizeof(RawFileHeader) == 104);
+BOOST_STATIC_ASSERT(sizeof(RawChunkHeader) == 24);
+BOOST_STATIC_ASSERT(sizeof(RawFrameHeader) == 80);
+BOOST_STATIC_ASSERT(sizeof(RawIndexEntry) == 24);
+BOOST_STATIC_ASSERT(sizeof(RawTrailer) == 32);
+
+inline size_t alignUp(size_t value, size_t alignment) {
+	return (value + alignment - 1) / alignment * alignment;
+}
+
+} //: namespace CameraPGR
+} //: namespace Sources
+
+#endif /* RAWCONTAINER_HPP_ */
@@ -0,0 +1,290 @@
+/*!
+ * \file
+ * \brief Recording of raw camera frames to .pgrraw files
+ * \author Mikolaj Kojdecki
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "RawRecorder.hpp"
+#include "Timing.hpp"
+
+#include <boost/bind.hpp>
+
+namespace Sources {
+namespace CameraPGR {
+
+namespace {
+
+unsigned char * allocateBlocks(size_t size) {
+	void * data = 0;
+	if (posix_memalign(&data, raw_block_size, size) != 0)
+		return 0;
+	memset(data, 0, size);
+	return (unsigned char *) data;
+}
+
+}
+
+		RawRecorder::RawRecorder(size_t chunk, size_t budget) :
+			requested_chunk_size(alignUp(std::max(chunk, raw_block_size), raw_block_size)), memory_budget(budget),
+			chunk_size(0), fd(-1), current(0), next_chunk_index(0), closing(false), file_offset(0),
+			recorded_count(0), dropped_count(0), written_bytes(0), write_errors(0), queue_high_water(0), grown_count(0) {
+		}
+
+		RawRecorder::~RawRecorder() {
+			close();
+			for (size_t i = 0; i < chunks.size(); ++i)
+				free(chunks[i].data);
+		}
+
+		bool RawRecorder::open(const std::string & path, const FlyCapture2::CameraInfo & info) {
+			// unbuffered writes keep the page cache out of the way, not every file system supports them
+#ifdef O_DIRECT
+			fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+			if (fd < 0 && errno == EINVAL)
+#endif
+				fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+			if (fd < 0) {
+				error_message = strerror(errno);
+				return false;
+			}
+
+			unsigned char * block = allocateBlocks(raw_block_size);
+			if (!block) {
+				error_message = "Out of memory";
+				::close(fd);
+				fd = -1;
+				return false;
+			}
+			RawFileHeader * header = (RawFileHeader *) block;
+			memcpy(header->magic, "PGRRAW\0\0", 8);
+			header->version = raw_format_version;
+			header->header_size = raw_block_size;
+			header->serial = info.serialNumber;
+			header->chunk_size = requested_chunk_size;
+			header->created = time(0);
+			strncpy(header->model, info.modelName, sizeof(header->model) - 1);
+			const bool written = writeAt(block, raw_block_size, 0);
+			free(block);
+			if (!written) {
+				error_message = strerror(errno);
+				::close(fd);
+				fd = -1;
+				return false;
+			}
+
+			file_offset = raw_block_size;
+			closing = false;
+			writer_thread = boost::thread(boost::bind(&RawRecorder::writer, this));
+			return true;
+		}
+
+		bool RawRecorder::allocate(size_t record_size) {
+			chunk_size = std::max(requested_chunk_size, alignUp(raw_chunk_header_space + record_size, raw_block_size));
+			const size_t count = std::max<size_t>(2, memory_budget / chunk_size);
+			chunks.resize(count);
+			for (size_t i = 0; i < count; ++i) {
+				chunks[i].data = allocateBlocks(chunk_size);
+				if (!chunks[i].data)
+					return false;
+				chunks[i].capacity = chunk_size;
+				chunks[i].entries.reserve(chunk_size / record_size + 1);
+				free_chunks.push_back(&chunks[i]);
+			}
+			return true;
+		}
+
+		bool RawRecorder::takeFreeChunk() {
+			{
+				boost::mutex::scoped_lock lock(mutex);
+				if (free_chunks.empty())
+					return false;
+				current = free_chunks.front();
+				free_chunks.pop_front();
+			}
+			if (current->capacity < chunk_size) {
+				unsigned char * data = allocateBlocks(chunk_size);
+				if (!data) {
+					boost::mutex::scoped_lock lock(mutex);
+					free_chunks.push_front(current);
+					current = 0;
+					return false;
+				}
+				free(current->data);
+				current->data = data;
+				current->capacity = chunk_size;
+			}
+			current->used = raw_chunk_header_space;
+			current->entries.clear();
+			return true;
+		}
+
+		bool RawRecorder::record(const FlyCapture2::Image & image, const FrameMeta & meta) {
+			if (fd < 0)
+				return false;
+
+			const size_t data_size = (size_t) image.GetStride() * image.GetRows();
+			const size_t record_size = alignUp(sizeof(RawFrameHeader) + data_size, raw_frame_align);
+			// buffers are allocated for the first frame, when its size is known
+			if (chunks.empty() && !allocate(record_size)) {
+				++dropped_count;
+				return false;
+			}
+			if (raw_chunk_header_space + record_size > chunk_size) {
+				// e.g. a larger window: chunks are enlarged one by one as they are taken
+				chunk_size = alignUp(raw_chunk_header_space + record_size, raw_block_size);
+				++grown_count;
+			}
+
+			if (current && current->used + record_size > current->capacity)
+				submit();
+			// the disk does not keep up (or no memory for a larger chunk)
+			if (!current && !takeFreeChunk()) {
+				++dropped_count;
+				return false;
+			}
+
+			unsigned char * out = current->data + current->used;
+			RawFrameHeader * header = (RawFrameHeader *) out;
+			memcpy(header->magic, "FRAM", 4);
+			header->header_size = sizeof(RawFrameHeader);
+			header->rows = image.GetRows();
+			header->cols = image.GetCols();
+			header->stride = image.GetStride();
+			header->pixel_format = image.GetPixelFormat();
+			header->bayer_tile = image.GetBayerTileFormat();
+			header->data_size = data_size;
+			header->camera_time = meta.camera_time;
+			header->timestamp_seconds = meta.timestamp_seconds;
+			header->timestamp_microseconds = meta.timestamp_microseconds;
+			header->frame_counter = meta.frame_counter;
+			header->received = meta.received;
+			header->shutter = meta.shutter;
+			header->gain = meta.gain;
+			header->embedded_shutter = meta.embedded_shutter;
+			header->embedded_gain = meta.embedded_gain;
+			memcpy(out + sizeof(RawFrameHeader), image.GetData(), data_size);
+
+			RawIndexEntry entry;
+			entry.offset = current->used;
+			entry.received = meta.received;
+			entry.frame_counter = meta.frame_counter;
+			entry.data_size = data_size;
+			current->entries.push_back(entry);
+			current->used += record_size;
+			++recorded_count;
+			return true;
+		}
+
+		void RawRecorder::submit() {
+			const size_t size = alignUp(current->used, raw_block_size);
+			memset(current->data + current->used, 0, size - current->used);
+			current->used = size;
+
+			RawChunkHeader * header = (RawChunkHeader *) current->data;
+			memcpy(header->magic, "CHNK", 4);
+			header->frames = current->entries.size();
+			header->index = next_chunk_index++;
+			header->size = size;
+
+			{
+				boost::mutex::scoped_lock lock(mutex);
+				full_chunks.push_back(current);
+				if (full_chunks.size() > queue_high_water)
+					queue_high_water = full_chunks.size();
+			}
+			chunk_ready.notify_one();
+			current = 0;
+		}
+
+		void RawRecorder::writer() {
+			for (;;) {
+				Chunk * chunk;
+				{
+					boost::mutex::scoped_lock lock(mutex);
+					while (full_chunks.empty() && !closing)
+						chunk_ready.wait(lock);
+					if (full_chunks.empty())
+						return;
+					chunk = full_chunks.front();
+					full_chunks.pop_front();
+				}
+
+				const boost::uint64_t start = monotonicNanoseconds();
+				if (writeAt(chunk->data, chunk->used, file_offset)) {
+					for (size_t i = 0; i < chunk->entries.size(); ++i) {
+						RawIndexEntry entry = chunk->entries[i];
+						entry.offset += file_offset;
+						index.push_back(entry);
+					}
+					file_offset += chunk->used;
+					written_bytes += chunk->used;
+				} else {
+					++write_errors;
+				}
+				write_latency.record(monotonicNanoseconds() - start);
+
+				boost::mutex::scoped_lock lock(mutex);
+				free_chunks.push_back(chunk);
+			}
+		}
+
+		bool RawRecorder::writeAt(const unsigned char * data, size_t size, boost::uint64_t offset) {
+			while (size > 0) {
+				const ssize_t written = pwrite(fd, data, size, offset);
+				if (written < 0) {
+					if (errno == EINTR)
+						continue;
+					return false;
+				}
+				data += written;
+				size -= written;
+				offset += written;
+			}
+			return true;
+		}
+
+		void RawRecorder::close() {
+			if (fd < 0)
+				return;
+
+			if (current && !current->entries.empty())
+				submit();
+			{
+				boost::mutex::scoped_lock lock(mutex);
+				closing = true;
+			}
+			chunk_ready.notify_all();
+			writer_thread.join();
+
+			// index with the trailer in the last bytes of the file
+			const size_t entries_size = index.size() * sizeof(RawIndexEntry);
+			const size_t size = alignUp(entries_size + sizeof(RawTrailer), raw_block_size);
+			unsigned char * block = allocateBlocks(size);
+			if (block) {
+				if (!index.empty())
+					memcpy(block, &index[0], entries_size);
+				RawTrailer * trailer = (RawTrailer *) (block + size - sizeof(RawTrailer));
+				memcpy(trailer->magic, "PGRIDX\0\0", 8);
+				trailer->index_offset = file_offset;
+				trailer->frames = index.size();
+				trailer->chunks = next_chunk_index;
+				if (!writeAt(block, size, file_offset))
+					++write_errors;
+				free(block);
+			}
+
+			::close(fd);
+			fd = -1;
+		}
+
+} //: namespace CameraPGR
+} //: namespace Sources
@@ -0,0 +1,176 @@
+/*!
+ * \file
+ * \brief Recording of raw camera frames to .pgrraw files
+ * \author Mikolaj Kojdecki
+ */
+
+#ifndef RAWRECORDER_HPP_
+#define RAWRECORDER_HPP_
+
+#include <deque>
+#include <string>
+#include <vector>
+
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread.hpp>
+
+//FlyCapture2 imports
+#include <FlyCapture2.h>
+#include <Image.h>
+
+#include "FrameMeta.hpp"
+#include "LatencyHistogram.hpp"
+#include "RawContainer.hpp"
+
+namespace Sources {
+namespace CameraPGR {
+
+/*!
+ * \class RawRecorder
+ * \brief Writes frames as received from the camera, with their metadata,
+ * to a chunked .pgrraw file (see RawContainer.hpp).
+ *
+ * The capture thread only copies the frame into the current chunk, a
+ * block-aligned buffer taken from a fixed set sized by the memory budget.
+ * Full chunks are written by a dedicated thread in single large writes,
+ * unbuffered where the file system allows it. When the disk falls behind
+ * and no free chunk is left, frames are dropped and counted; record()
+ * never waits for the disk.
+ */
+class RawRecorder: private boost::noncopyable {
+public:
+	/*!
+	 * \param chunk_size bytes of a chunk, grown to hold at least one frame (also a frame larger than the first one)
+	 * \param memory_budget bytes of all chunk buffers (at least two chunks are used)
+	 */
+	RawRecorder(size_t chunk_size, size_t memory_budget);
+
+	/*!
+	 * Closes the file.
+	 */
+	~RawRecorder();
+
+	/*!
+	 * Creates file and starts the writer thread.
+	 */
+	bool open(const std::string & path, const FlyCapture2::CameraInfo & info);
+
+	/*!
+	 * Copies frame to the current chunk. Returns false if the frame was
+	 * dropped. Called by the capture thread only.
+	 */
+	bool record(const FlyCapture2::Image & image, const FrameMeta & meta);
+
+	/*!
+	 * Writes remaining frames and the index, stops the writer thread.
+	 */
+	void close();
+
+	const std::string & lastError() const {
+		return error_message;
+	}
+
+	/// Frames copied to chunks
+	unsigned long recorded() const {
+		return recorded_count;
+	}
+
+	/// Frames dropped because all chunks were waiting for the disk (or a larger one could not be allocated)
+	unsigned long dropped() const {
+		return dropped_count;
+	}
+
+	boost::uint64_t bytesWritten() const {
+		return written_bytes;
+	}
+
+	unsigned long writeErrors() const {
+		return write_errors;
+	}
+
+	/// Highest number of full chunks waiting for the writer
+	unsigned int queueHighWater() const {
+		return queue_high_water;
+	}
+
+	unsigned int chunkCount() const {
+		return chunks.size();
+	}
+
+	/// Times chunks were enlarged for a frame larger than the earlier ones
+	unsigned int chunkGrowths() const {
+		return grown_count;
+	}
+
+	/// Duration of chunk writes
+	LatencyHistogram write_latency;
+
+private:
+	struct Chunk {
+		unsigned char * data;
+		/// Bytes of data, less than chunk_size until the chunk is enlarged
+		size_t capacity;
+		size_t used;
+		/// Frames of the chunk, offsets relative to the chunk
+		std::vector<RawIndexEntry> entries;
+	};
+
+	/*!
+	 * Allocates chunk buffers big enough for frames of given record size.
+	 */
+	bool allocate(size_t record_size);
+
+	/*!
+	 * Takes free chunk as the current one, enlarging it to chunk_size.
+	 */
+	bool takeFreeChunk();
+
+	/*!
+	 * Pads current chunk, fills its header and passes it to the writer.
+	 */
+	void submit();
+
+	void writer();
+
+	/*!
+	 * Writes whole buffer at offset, returns false on error.
+	 */
+	bool writeAt(const unsigned char * data, size_t size, boost::uint64_t offset);
+
+	const size_t requested_chunk_size;
+	const size_t memory_budget;
+	size_t chunk_size;
+	int fd;
+	std::string error_message;
+
+	std::vector<Chunk> chunks;
+	/// Chunk filled by the capture thread, 0 - none
+	Chunk * current;
+	boost::uint64_t next_chunk_index;
+
+	// Chunks passed between capture and writer threads, guarded by mutex
+	boost::mutex mutex;
+	boost::condition_variable chunk_ready;
+	std::deque<Chunk *> free_chunks;
+	std::deque<Chunk *> full_chunks;
+	bool closing;
+	boost::thread writer_thread;
+
+	// Owned by the writer thread
+	boost::uint64_t file_offset;
+	std::vector<RawIndexEntry> index;
+
+	boost::atomic<unsigned long> recorded_count;
+	boost::atomic<unsigned long> dropped_count;
+	boost::atomic<boost::uint64_t> written_bytes;
+	boost::atomic<unsigned long> write_errors;
+	boost::atomic<unsigned int> queue_high_water;
+	boost::atomic<unsigned int> grown_count;
+};
+
+} //: namespace CameraPGR
+} //: namespace Sources
+
+#endif /* RAWRECORDER_HPP_ */
@@ -0,0 +1,82 @@
+/*!
+ * \file
+ * \brief Named regions of the frame published on their own streams
+ * \author Mikolaj Kojdecki
+ */
+
+#include <cctype>
+#include <cstdio>
+
+#include "RegionOfInterest.hpp"
+
+namespace Sources {
+namespace CameraPGR {
+
+namespace {
+
+bool validName(const std::string & name) {
+	if (name.empty())
+		return false;
+	for (size_t i = 0; i < name.size(); ++i)
+		if (!isalnum((unsigned char) name[i]) && name[i] != '_')
+			return false;
+	return true;
+}
+
+std::string trim(const std::string & text) {
+	const std::string::size_type begin = text.find_first_not_of(" \t");
+	if (begin == std::string::npos)
+		return std::string();
+	const std::string::size_type end = text.find_last_not_of(" \t");
+	return text.substr(begin, end - begin + 1);
+}
+
+}
+
+		bool parseRegions(const std::string & text, RegionList & regions, std::string & error) {
+			regions.clear();
+			std::string::size_type pos = 0;
+			while (pos <= text.size()) {
+				std::string::size_type end = text.find(';', pos);
+				if (end == std::string::npos)
+					end = text.size();
+				const std::string item = trim(text.substr(pos, end - pos));
+				pos = end + 1;
+				if (item.empty())
+					continue;
+
+				const std::string::size_type colon = item.find(':');
+				RegionOfInterest region;
+				region.name = trim(item.substr(0, colon));
+				int x, y, width, height;
+				char rest;
+				if (colon == std::string::npos || !validName(region.name) ||
+						sscanf(item.c_str() + colon + 1, " %d , %d , %d , %d %c", &x, &y, &width, &height, &rest) != 4) {
+					error = "Invalid region \"" + item + "\", expected name:x,y,width,height";
+					return false;
+				}
+				if (x < 0 || y < 0 || width <= 0 || height <= 0) {
+					error = "Empty or negative region \"" + item + "\"";
+					return false;
+				}
+				for (size_t i = 0; i < regions.size(); ++i)
+					if (regions[i].name == region.name) {
+						error = "Region \"" + region.name + "\" given twice";
+						return false;
+					}
+				region.rect = cv::Rect(x, y, width, height);
+				regions.push_back(region);
+			}
+			return true;
+		}
+
+		cv::Rect boundingBox(const std::vector<cv::Rect> & rects) {
+			cv::Rect box;
+			for (size_t i = 0; i < rects.size(); ++i)
+				if (rects[i].area() > 0)
+					box = (box.area() > 0) ? (box | rects[i]) : rects[i];
+			return box;
+		}
+
+} //: namespace CameraPGR
+} //: namespace Sources
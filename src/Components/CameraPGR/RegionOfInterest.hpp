@@ -0,0 +1,44 @@
+/*!
+ * \file
+ * \brief Named regions of the frame published on their own streams
+ * \author Mikolaj Kojdecki
+ */
+
+#ifndef REGIONOFINTEREST_HPP_
+#define REGIONOFINTEREST_HPP_
+
+#include <string>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+namespace Sources {
+namespace CameraPGR {
+
+/*!
+ * Region in sensor coordinates, so it stays in place when the image
+ * window of the camera moves.
+ */
+struct RegionOfInterest {
+	std::string name;
+	cv::Rect rect;
+};
+
+typedef std::vector<RegionOfInterest> RegionList;
+
+/*!
+ * Parses roi: "name:x,y,width,height" items separated with ';', e.g.
+ * "left:0,0,320,240;right:960,0,320,240". Names consist of letters,
+ * digits and '_'. Returns false and describes the problem in error.
+ */
+bool parseRegions(const std::string & text, RegionList & regions, std::string & error);
+
+/*!
+ * Smallest rectangle holding all non-empty rectangles, empty if there are none.
+ */
+cv::Rect boundingBox(const std::vector<cv::Rect> & rects);
+
+} //: namespace CameraPGR
+} //: namespace Sources
+
+#endif /* REGIONOFINTEREST_HPP_ */
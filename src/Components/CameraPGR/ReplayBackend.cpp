@@ -0,0 +1,429 @@
+/*!
+ * \file
+ * \brief Replay of sequences recorded to .pgrraw files
+ * \author Mikolaj Kojdecki
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "ReplayBackend.hpp"
+#include "Timing.hpp"
+
+namespace Sources {
+namespace CameraPGR {
+
+namespace {
+
+/// Period of the camera clock, see FrameMeta::camera_time
+const boost::uint64_t camera_clock_period = 128 * 1000000000ull;
+
+/// Replay that fell behind the pacing by more than this is rebased instead of catching up in a burst
+const boost::uint64_t late_tolerance = 20000000ull;
+
+const char file_prefix[] = "camera_";
+const char file_suffix[] = ".pgrraw";
+
+/// RGB and RGB8 name the same format
+bool samePixelFormat(unsigned int a, unsigned int b) {
+	const bool rgb_a = (a == FlyCapture2::PIXEL_FORMAT_RGB || a == FlyCapture2::PIXEL_FORMAT_RGB8);
+	const bool rgb_b = (b == FlyCapture2::PIXEL_FORMAT_RGB || b == FlyCapture2::PIXEL_FORMAT_RGB8);
+	return a == b || (rgb_a && rgb_b);
+}
+
+bool isDirectory(const std::string & path) {
+	struct stat st;
+	return stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+/// Serial number from the header of a recording, 0 if it is not one
+unsigned int recordedSerial(const std::string & file) {
+	const int fd = ::open(file.c_str(), O_RDONLY);
+	if (fd < 0)
+		return 0;
+	RawFileHeader header;
+	const bool read = (pread(fd, &header, sizeof(header), 0) == (ssize_t) sizeof(header));
+	::close(fd);
+	if (!read || memcmp(header.magic, "PGRRAW\0\0", 8) != 0)
+		return 0;
+	return header.serial;
+}
+
+}
+
+		ReplayBackend::ReplayBackend(const std::string & file_path, const std::map<std::string, std::string> & params) :
+			path(file_path), data(0), size(0), header(0), counter_span(0), time_span(0), connected(false), capturing(false),
+			position(0), loops(0), pacing_start(0), pacing_received(0), paced_frames(0) {
+			directory = isDirectory(path);
+
+			std::string mode = urlParam<std::string>(params, "pacing", "original");
+			if (mode == "fixed")
+				pacing = PACING_FIXED;
+			else if (mode == "fast")
+				pacing = PACING_FAST;
+			else
+				pacing = PACING_ORIGINAL;
+			float fps = urlParam<float>(params, "fps", 30.0f);
+			if (fps <= 0)
+				fps = 30.0f;
+			period = (boost::uint64_t) (1e9 / fps);
+			loop = urlParam<int>(params, "loop", 0) != 0;
+			preload = urlParam<int>(params, "preload", 0) != 0;
+
+			settings.offsetX = 0;
+			settings.offsetY = 0;
+			settings.width = 0;
+			settings.height = 0;
+			settings.pixelFormat = FlyCapture2::PIXEL_FORMAT_RGB;
+		}
+
+		ReplayBackend::~ReplayBackend() {
+			unmap();
+		}
+
+		std::string ReplayBackend::filePath(unsigned int serial) const {
+			if (!directory)
+				return path;
+			char name[64];
+			snprintf(name, sizeof(name), "%s%u%s", file_prefix, serial, file_suffix);
+			return path + "/" + name;
+		}
+
+		bool ReplayBackend::listCameras(std::vector<unsigned int> & serials) {
+			serials.clear();
+			if (!directory) {
+				const unsigned int serial = recordedSerial(path);
+				if (serial == 0) {
+					error_message = "Not a recording: " + path;
+					return false;
+				}
+				serials.push_back(serial);
+				return true;
+			}
+
+			DIR * dir = opendir(path.c_str());
+			if (!dir) {
+				error_message = strerror(errno);
+				return false;
+			}
+			const size_t prefix = sizeof(file_prefix) - 1;
+			const size_t suffix = sizeof(file_suffix) - 1;
+			while (dirent * entry = readdir(dir)) {
+				const std::string name = entry->d_name;
+				if (name.size() <= prefix + suffix || name.compare(0, prefix, file_prefix) != 0 ||
+						name.compare(name.size() - suffix, suffix, file_suffix) != 0)
+					continue;
+				try {
+					serials.push_back(boost::lexical_cast<unsigned int>(name.substr(prefix, name.size() - prefix - suffix)));
+				} catch (boost::bad_lexical_cast &) {
+				}
+			}
+			closedir(dir);
+			std::sort(serials.begin(), serials.end());
+			return true;
+		}
+
+		bool ReplayBackend::connect(unsigned int serial) {
+			if (directory && serial == 0) {
+				std::vector<unsigned int> serials;
+				if (!listCameras(serials))
+					return false;
+				if (serials.empty()) {
+					error_message = "No recordings in " + path;
+					return false;
+				}
+				serial = serials[0];
+			}
+
+			const std::string file = filePath(serial);
+			if (file != mapped_file) {
+				unmap();
+				if (!map(file))
+					return false;
+				position = 0;
+				loops = 0;
+			}
+			connected = true;
+			return true;
+		}
+
+		void ReplayBackend::disconnect() {
+			capturing = false;
+			connected = false;
+		}
+
+		bool ReplayBackend::map(const std::string & file) {
+			const int fd = ::open(file.c_str(), O_RDONLY);
+			if (fd < 0) {
+				error_message = file + ": " + strerror(errno);
+				return false;
+			}
+			struct stat st;
+			if (fstat(fd, &st) != 0 || (size_t) st.st_size < raw_block_size) {
+				error_message = "Not a recording: " + file;
+				::close(fd);
+				return false;
+			}
+
+			int flags = MAP_SHARED;
+#ifdef MAP_POPULATE
+			if (preload)
+				flags |= MAP_POPULATE;
+#endif
+			void * mapping = mmap(0, st.st_size, PROT_READ, flags, fd, 0);
+			// the mapping keeps the file open
+			::close(fd);
+			if (mapping == MAP_FAILED) {
+				error_message = file + ": " + strerror(errno);
+				return false;
+			}
+			data = (const unsigned char *) mapping;
+			size = st.st_size;
+			madvise(mapping, size, MADV_SEQUENTIAL);
+
+			header = (const RawFileHeader *) data;
+			if (memcmp(header->magic, "PGRRAW\0\0", 8) != 0 || header->version != raw_format_version ||
+					header->header_size < sizeof(RawFileHeader) || header->header_size > size) {
+				error_message = "Not a recording: " + file;
+				unmap();
+				return false;
+			}
+
+			if (!readIndex())
+				walkChunks();
+			if (offsets.empty()) {
+				error_message = "No frames in " + file;
+				unmap();
+				return false;
+			}
+
+			// a looped sequence continues where it ended, one mean frame interval later
+			const RawFrameHeader * first = frameHeader(0);
+			const RawFrameHeader * last = frameHeader(offsets.size() - 1);
+			const boost::uint64_t duration = (last->received > first->received) ? last->received - first->received : 0;
+			time_span = (offsets.size() > 1 && duration > 0) ? duration + duration / (offsets.size() - 1) : period;
+			counter_span = (last->frame_counter >= first->frame_counter) ? last->frame_counter - first->frame_counter + 1 : offsets.size();
+
+			mapped_file = file;
+			return true;
+		}
+
+		void ReplayBackend::unmap() {
+			if (data)
+				munmap((void *) data, size);
+			data = 0;
+			size = 0;
+			header = 0;
+			offsets.clear();
+			mapped_file.clear();
+		}
+
+		bool ReplayBackend::readIndex() {
+			if (size < header->header_size + sizeof(RawTrailer))
+				return false;
+			const RawTrailer * trailer = (const RawTrailer *) (data + size - sizeof(RawTrailer));
+			if (memcmp(trailer->magic, "PGRIDX\0\0", 8) != 0 || trailer->index_offset < header->header_size ||
+					trailer->index_offset > size - sizeof(RawTrailer) ||
+					trailer->frames > (size - sizeof(RawTrailer) - trailer->index_offset) / sizeof(RawIndexEntry))
+				return false;
+
+			const RawIndexEntry * index = (const RawIndexEntry *) (data + trailer->index_offset);
+			offsets.reserve(trailer->frames);
+			for (boost::uint64_t i = 0; i < trailer->frames; ++i) {
+				if (index[i].offset + sizeof(RawFrameHeader) + index[i].data_size > trailer->index_offset) {
+					offsets.clear();
+					return false;
+				}
+				offsets.push_back(index[i].offset);
+			}
+			return true;
+		}
+
+		void ReplayBackend::walkChunks() {
+			offsets.clear();
+			boost::uint64_t chunk = header->header_size;
+			while (chunk + sizeof(RawChunkHeader) <= size) {
+				const RawChunkHeader * chunk_header = (const RawChunkHeader *) (data + chunk);
+				if (memcmp(chunk_header->magic, "CHNK", 4) != 0 || chunk_header->size < raw_chunk_header_space)
+					break;
+				// the last chunk of an interrupted recording may be cut short
+				const boost::uint64_t end = std::min<boost::uint64_t>(chunk + chunk_header->size, size);
+				boost::uint64_t frame = chunk + raw_chunk_header_space;
+				for (boost::uint32_t i = 0; i < chunk_header->frames && frame + sizeof(RawFrameHeader) <= end; ++i) {
+					const RawFrameHeader * frame_header = (const RawFrameHeader *) (data + frame);
+					if (memcmp(frame_header->magic, "FRAM", 4) != 0 || frame_header->header_size < sizeof(RawFrameHeader) ||
+							frame + frame_header->header_size + frame_header->data_size > end)
+						break;
+					offsets.push_back(frame);
+					frame += alignUp(frame_header->header_size + frame_header->data_size, raw_frame_align);
+				}
+				chunk += chunk_header->size;
+			}
+		}
+
+		bool ReplayBackend::getCameraInfo(FlyCapture2::CameraInfo & info) {
+			if (!connected) {
+				error_message = "Camera not connected";
+				return false;
+			}
+
+			memset(&info, 0, sizeof(info));
+			info.serialNumber = header->serial;
+			const size_t model = std::min(sizeof(info.modelName) - 1, sizeof(header->model));
+			strncpy(info.modelName, header->model, model);
+			strncpy(info.vendorName, "CameraPGR", sizeof(info.vendorName) - 1);
+			snprintf(info.sensorInfo, sizeof(info.sensorInfo), "Recording %s", mapped_file.c_str());
+			const RawFrameHeader * first = frameHeader(0);
+			snprintf(info.sensorResolution, sizeof(info.sensorResolution), "%ux%u", first->cols, first->rows);
+			return true;
+		}
+
+		bool ReplayBackend::setImageSettings(const FlyCapture2::GigEImageSettings & new_settings) {
+			if (capturing) {
+				error_message = "Image settings cannot be changed during capture";
+				return false;
+			}
+			settings = new_settings;
+			if (connected && !samePixelFormat(frameHeader(0)->pixel_format, settings.pixelFormat)) {
+				error_message = "Pixel format differs from the recording";
+				return false;
+			}
+			return true;
+		}
+
+		bool ReplayBackend::startCapture() {
+			if (!connected) {
+				error_message = "Camera not connected";
+				return false;
+			}
+			pacing_start = 0;
+			capturing = true;
+			return true;
+		}
+
+		bool ReplayBackend::stopCapture() {
+			capturing = false;
+			return true;
+		}
+
+		const FlyCapture2::Image * ReplayBackend::retrieveBuffer(FlyCapture2::Image & image, FrameMeta & meta) {
+			if (!capturing) {
+				error_message = "Capture not started";
+				return 0;
+			}
+			if (position >= offsets.size()) {
+				if (!loop) {
+					error_message = "End of recording";
+					return 0;
+				}
+				if (pacing_start != 0) {
+					// frame 0 of the next pass is due one span after frame 0 of this one
+					pacing_start += frameHeader(0)->received + time_span - pacing_received;
+					pacing_received = frameHeader(0)->received;
+				}
+				position = 0;
+				++loops;
+			}
+
+			const RawFrameHeader * frame = frameHeader(position);
+			if (memcmp(frame->magic, "FRAM", 4) != 0 || frame->header_size < sizeof(RawFrameHeader) ||
+					offsets[position] + frame->header_size + frame->data_size > size ||
+					(boost::uint64_t) frame->stride * frame->rows > frame->data_size) {
+				error_message = "Corrupted frame in the recording";
+				++position;
+				return 0;
+			}
+			// the converter was chosen for pixel_format, other data would be misread
+			if (!samePixelFormat(frame->pixel_format, settings.pixelFormat)) {
+				error_message = "Pixel format differs from the recording";
+				return 0;
+			}
+
+			if (pacing != PACING_FAST) {
+				const boost::uint64_t now = monotonicNanoseconds();
+				if (pacing_start == 0) {
+					pacing_start = now;
+					pacing_received = frame->received;
+					paced_frames = 0;
+				}
+				boost::uint64_t due = pacing_start;
+				if (pacing == PACING_FIXED)
+					due += paced_frames * period;
+				else if (frame->received > pacing_received)
+					due += frame->received - pacing_received;
+				if (now > due + late_tolerance) {
+					pacing_start = due = now;
+					pacing_received = frame->received;
+					paced_frames = 0;
+				}
+				sleepUntilNanoseconds(due);
+				++paced_frames;
+			}
+
+			const boost::uint64_t shift = loops * time_span;
+			meta.camera_time = (frame->camera_time + shift) % camera_clock_period;
+			const boost::uint64_t timestamp = (boost::uint64_t) frame->timestamp_seconds * 1000000ull + frame->timestamp_microseconds + shift / 1000;
+			meta.timestamp_seconds = timestamp / 1000000ull;
+			meta.timestamp_microseconds = timestamp % 1000000ull;
+			meta.frame_counter = frame->frame_counter + loops * counter_span;
+			meta.shutter = frame->shutter;
+			meta.gain = frame->gain;
+			meta.embedded_shutter = frame->embedded_shutter;
+			meta.embedded_gain = frame->embedded_gain;
+
+			// SetData() and assignment copy into a buffer of the image, only the constructor
+			// taking a buffer uses it in place. It takes a pointer to modifiable data, but
+			// the view is handed out read-only and nothing writes through it.
+			boost::shared_ptr<FlyCapture2::Image> & view = views[&image];
+			view.reset(new FlyCapture2::Image(frame->rows, frame->cols, frame->stride,
+					const_cast<unsigned char *>((const unsigned char *) frame + frame->header_size), frame->data_size,
+					(FlyCapture2::PixelFormat) frame->pixel_format, (FlyCapture2::BayerTileFormat) frame->bayer_tile));
+			++position;
+			return view.get();
+		}
+
+		bool ReplayBackend::setTriggerMode(const FlyCapture2::TriggerMode &) {
+			return true;
+		}
+
+		bool ReplayBackend::fireSoftwareTrigger() {
+			return true;
+		}
+
+		bool ReplayBackend::setProperty(const FlyCapture2::Property & prop) {
+			properties[prop.type] = prop;
+			properties[prop.type].present = true;
+			return true;
+		}
+
+		bool ReplayBackend::getStreamSettings(StreamSettings & settings) {
+			settings = stream;
+			return true;
+		}
+
+		bool ReplayBackend::setStreamSettings(const StreamSettings & new_settings) {
+			// frames come from the file, settings are only kept for getStreamSettings()
+			stream.update(new_settings);
+			return true;
+		}
+
+		bool ReplayBackend::getProperty(FlyCapture2::Property & prop) {
+			std::map<int, FlyCapture2::Property>::const_iterator it = properties.find(prop.type);
+			if (it == properties.end()) {
+				error_message = "Property not present";
+				return false;
+			}
+			prop = it->second;
+			return true;
+		}
+
+} //: namespace CameraPGR
+} //: namespace Sources
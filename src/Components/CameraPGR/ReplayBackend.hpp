@@ -0,0 +1,152 @@
+/*!
+ * \file
+ * \brief Replay of sequences recorded to .pgrraw files
+ * \author Mikolaj Kojdecki
+ */
+
+#ifndef REPLAYBACKEND_HPP_
+#define REPLAYBACKEND_HPP_
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <boost/cstdint.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include "CaptureBackend.hpp"
+#include "RawContainer.hpp"
+
+namespace Sources {
+namespace CameraPGR {
+
+/*!
+ * \class ReplayBackend
+ * \brief Camera played back from a recording made with record_path.
+ *
+ * The file is memory-mapped and frames are handed to the component
+ * straight from the mapping, without copying, as read-only images owned by
+ * the backend, so they go through the same
+ * conversion and output path as frames of a live camera. Frames come with
+ * the metadata recorded with them; when the sequence loops, frame
+ * counters and camera times continue past the end instead of jumping back.
+ *
+ * The path is either a .pgrraw file or a directory with camera_<serial>.pgrraw
+ * files; then cameras are listed and connected by serial number, just as
+ * on the bus. Frames keep the recorded geometry whatever width and height
+ * are set; pixel_format must match the recording. Trigger settings are
+ * accepted and ignored (timestamps of the recording keep the frames of
+ * several cameras together), properties and stream settings are stored only.
+ *
+ * Parameters (camera_url query):
+ * - pacing - "original" (intervals as recorded, the default), "fixed"
+ *   (at fps) or "fast" (as fast as the component takes frames),
+ * - fps - rate of fixed pacing, default 30,
+ * - loop - 1 to start over at the end, default 0 (retrieveBuffer fails
+ *   with "End of recording"),
+ * - preload - 1 to read the whole file into memory when connecting,
+ *   so that page faults do not disturb the timing, default 0.
+ *
+ * Frames are never skipped: when the component is slower than the pacing,
+ * the replay slows down with it.
+ *
+ * Example: file:///data/camera_13481977.pgrraw?pacing=fixed&fps=60&loop=1
+ */
+class ReplayBackend: public CaptureBackend {
+public:
+	ReplayBackend(const std::string & path, const std::map<std::string, std::string> & params);
+
+	virtual ~ReplayBackend();
+
+	bool listCameras(std::vector<unsigned int> & serials);
+	bool connect(unsigned int serial);
+	void disconnect();
+	bool getCameraInfo(FlyCapture2::CameraInfo & info);
+	bool setImageSettings(const FlyCapture2::GigEImageSettings & settings);
+	bool startCapture();
+	bool stopCapture();
+	bool getStreamSettings(StreamSettings & settings);
+	bool setStreamSettings(const StreamSettings & settings);
+	const FlyCapture2::Image * retrieveBuffer(FlyCapture2::Image & image, FrameMeta & meta);
+	bool setTriggerMode(const FlyCapture2::TriggerMode & mode);
+	bool fireSoftwareTrigger();
+	bool setProperty(const FlyCapture2::Property & prop);
+	bool getProperty(FlyCapture2::Property & prop);
+
+private:
+	enum Pacing {
+		PACING_ORIGINAL,
+		PACING_FIXED,
+		PACING_FAST
+	};
+
+	/*!
+	 * File with the recording of given camera.
+	 */
+	std::string filePath(unsigned int serial) const;
+
+	/*!
+	 * Maps file and finds its frames, returns false if it is not a recording.
+	 */
+	bool map(const std::string & file);
+
+	void unmap();
+
+	/*!
+	 * Frame offsets from the index at the end of the file.
+	 */
+	bool readIndex();
+
+	/*!
+	 * Frame offsets found by walking the chunks, for recordings without index.
+	 */
+	void walkChunks();
+
+	const RawFrameHeader * frameHeader(size_t frame) const {
+		return (const RawFrameHeader *) (data + offsets[frame]);
+	}
+
+	std::string path;
+	bool directory;
+	Pacing pacing;
+	boost::uint64_t period;
+	bool loop;
+	bool preload;
+
+	// Mapping is kept over disconnect(), so that reconnecting continues
+	// where the replay stopped and images already handed out stay valid
+	std::string mapped_file;
+	const unsigned char * data;
+	size_t size;
+	const RawFileHeader * header;
+	/// Position of every frame in the file
+	std::vector<boost::uint64_t> offsets;
+	/// Images over frames in the mapping, one for each image object of the caller
+	std::map<const FlyCapture2::Image *, boost::shared_ptr<FlyCapture2::Image> > views;
+
+	/// Frame counter and camera time added on every pass of the sequence
+	boost::uint32_t counter_span;
+	boost::uint64_t time_span;
+
+	bool connected;
+	bool capturing;
+	FlyCapture2::GigEImageSettings settings;
+	StreamSettings stream;
+	std::map<int, FlyCapture2::Property> properties;
+
+	/// Next frame to serve and number of finished passes
+	size_t position;
+	unsigned long loops;
+
+	/// Host time at which the pacing started, 0 - at the next frame
+	boost::uint64_t pacing_start;
+	/// Received time of the frame served at pacing_start
+	boost::uint64_t pacing_received;
+	/// Frames served since pacing_start
+	boost::uint64_t paced_frames;
+};
+
+} //: namespace CameraPGR
+} //: namespace Sources
+
+#endif /* REPLAYBACKEND_HPP_ */
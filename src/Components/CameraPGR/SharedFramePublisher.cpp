@@ -0,0 +1,144 @@
+/*!
+ * \file
+ * \brief Frames published to shared memory for other processes
+ * \author Mikolaj Kojdecki
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "SharedFramePublisher.hpp"
+
+namespace Sources {
+namespace CameraPGR {
+
+namespace {
+
+/// Slot 0 starts a page after the header, pixels of every slot start on a page
+const size_t page_size = 4096;
+
+size_t roundUp(size_t value, size_t alignment) {
+	return (value + alignment - 1) / alignment * alignment;
+}
+
+}
+
+		SharedFramePublisher::SharedFramePublisher() :
+			slot_count(0), ring(0), size(0), serial(0), next_frame(0), published_frames(0), oversized_frames(0) {
+		}
+
+		SharedFramePublisher::~SharedFramePublisher() {
+			close();
+		}
+
+		bool SharedFramePublisher::open(const std::string & ring_name, unsigned int slots, size_t slot_bytes, unsigned int camera_serial) {
+			close();
+			// readers of an earlier ring keep their mapping and see it closed
+			shm_unlink(ring_name.c_str());
+			const int fd = shm_open(ring_name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+			if (fd < 0) {
+				error_message = strerror(errno);
+				return false;
+			}
+
+			const unsigned int count = std::max(2u, slots);
+			const size_t stride = shared_slot_header_bytes + roundUp(slot_bytes, page_size);
+			const size_t total = page_size + count * stride;
+			if (ftruncate(fd, total) != 0) {
+				error_message = strerror(errno);
+				::close(fd);
+				shm_unlink(ring_name.c_str());
+				return false;
+			}
+			void * mapping = mmap(0, total, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+			::close(fd);
+			if (mapping == MAP_FAILED) {
+				error_message = strerror(errno);
+				shm_unlink(ring_name.c_str());
+				return false;
+			}
+
+			// a new object is zero-filled: no frame in any slot, nothing published
+			SharedRingHeader * ring_header = static_cast<SharedRingHeader *>(mapping);
+			ring_header->version = shared_ring_version;
+			ring_header->slot_count = count;
+			ring_header->slot_bytes = slot_bytes;
+			ring_header->first_slot = page_size;
+			ring_header->slot_stride = stride;
+			ring_header->open.store(1, boost::memory_order_relaxed);
+			ring_header->magic.store(shared_ring_magic, boost::memory_order_release);
+
+			name = ring_name;
+			slot_count = count;
+			ring = mapping;
+			size = total;
+			serial = camera_serial;
+			next_frame = 0;
+			return true;
+		}
+
+		void SharedFramePublisher::close() {
+			if (!ring)
+				return;
+			header()->open.store(0, boost::memory_order_release);
+			sharedRingWake(header()->notify);
+			munmap(ring, size);
+			shm_unlink(name.c_str());
+			ring = 0;
+			size = 0;
+		}
+
+		bool SharedFramePublisher::reopen(size_t slot_bytes) {
+			// open() closes the ring first, which changes nothing it is given
+			const std::string ring_name = name;
+			return open(ring_name, slot_count, slot_bytes, serial);
+		}
+
+		cv::Mat SharedFramePublisher::begin(int rows, int cols, int type, boost::uint64_t & frame) {
+			const size_t step = cols * CV_ELEM_SIZE(type);
+			if (!ring || (size_t) rows * step > header()->slot_bytes) {
+				++oversized_frames;
+				return cv::Mat();
+			}
+
+			frame = next_frame++;
+			SharedSlotHeader * slot = sharedSlot(ring, frame);
+			// readers drop copies of the slot taken from now on
+			slot->sequence.store(2 * frame + 1, boost::memory_order_relaxed);
+			boost::atomic_thread_fence(boost::memory_order_release);
+			slot->info.frame = frame;
+			slot->info.rows = rows;
+			slot->info.cols = cols;
+			slot->info.type = type;
+			slot->info.step = step;
+			return cv::Mat(rows, cols, type, sharedPixels(slot), step);
+		}
+
+		void SharedFramePublisher::commit(boost::uint64_t frame, const FrameMeta & meta) {
+			SharedSlotHeader * slot = sharedSlot(ring, frame);
+			SharedFrameInfo & info = slot->info;
+			info.camera_time = meta.camera_time;
+			info.timestamp_seconds = meta.timestamp_seconds;
+			info.timestamp_microseconds = meta.timestamp_microseconds;
+			info.frame_counter = meta.frame_counter;
+			info.received = meta.received;
+			info.shutter = meta.shutter;
+			info.gain = meta.gain;
+			info.offset_x = meta.offset_x;
+			info.offset_y = meta.offset_y;
+			info.serial = serial;
+			slot->sequence.store(2 * frame + 2, boost::memory_order_release);
+
+			header()->head.store(frame + 1, boost::memory_order_release);
+			sharedRingWake(header()->notify);
+			++published_frames;
+		}
+
+} //: namespace CameraPGR
+} //: namespace Sources
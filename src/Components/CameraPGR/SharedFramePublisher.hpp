@@ -0,0 +1,114 @@
+/*!
+ * \file
+ * \brief Frames published to shared memory for other processes
+ * \author Mikolaj Kojdecki
+ */
+
+#ifndef SHAREDFRAMEPUBLISHER_HPP_
+#define SHAREDFRAMEPUBLISHER_HPP_
+
+#include <string>
+
+#include <opencv2/opencv.hpp>
+
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+
+#include "FrameMeta.hpp"
+#include "Types/SharedFrameRing.hpp"
+
+namespace Sources {
+namespace CameraPGR {
+
+/*!
+ * \class SharedFramePublisher
+ * \brief Writer of a ring of frames in POSIX shared memory (layout in
+ * Types/SharedFrameRing.hpp, readers use Types/SharedFrameReader.hpp).
+ *
+ * A frame is written in two steps: begin() claims the slot of the next
+ * frame and returns it as an image, which the conversion fills band by band,
+ * and commit() makes it visible to readers. Slots are reused in turn
+ * whether readers are done with them or not, so nothing here ever waits.
+ * begin() is called by the capture thread, commit() by whichever thread
+ * finishes the conversion, in the order of begin().
+ */
+class SharedFramePublisher {
+public:
+	SharedFramePublisher();
+
+	/*!
+	 * Closes the ring.
+	 */
+	~SharedFramePublisher();
+
+	/*!
+	 * Creates ring of the name (e.g. "/camerapgr") with slots of slot_bytes,
+	 * replacing one left by an earlier run.
+	 */
+	bool open(const std::string & name, unsigned int slots, size_t slot_bytes, unsigned int serial);
+
+	/*!
+	 * Tells readers the ring is closed and removes its name.
+	 */
+	void close();
+
+	/*!
+	 * Creates the ring again with slots of slot_bytes, readers of the old one
+	 * see it closed. No frame may be between begin() and commit().
+	 */
+	bool reopen(size_t slot_bytes);
+
+	/*!
+	 * Claims slot of the next frame. Returns image in the slot, empty if the
+	 * frame does not fit (it is skipped and counted).
+	 */
+	cv::Mat begin(int rows, int cols, int type, boost::uint64_t & frame);
+
+	/*!
+	 * Frame claimed by begin() is complete.
+	 */
+	void commit(boost::uint64_t frame, const FrameMeta & meta);
+
+	bool isOpen() const {
+		return ring != 0;
+	}
+
+	/// Largest frame (bytes) of the ring, 0 if closed
+	size_t slotBytes() const {
+		return ring ? static_cast<const SharedRingHeader *>(ring)->slot_bytes : 0;
+	}
+
+	unsigned long published() const {
+		return published_frames;
+	}
+
+	/// Frames larger than a slot, not published
+	unsigned long oversized() const {
+		return oversized_frames;
+	}
+
+	const std::string & lastError() const {
+		return error_message;
+	}
+
+private:
+	SharedRingHeader * header() {
+		return static_cast<SharedRingHeader *>(ring);
+	}
+
+	std::string name;
+	unsigned int slot_count;
+	void * ring;
+	size_t size;
+	unsigned int serial;
+	/// Number of the next frame, used by the capture thread only
+	boost::uint64_t next_frame;
+	boost::atomic<unsigned long> published_frames;
+	boost::atomic<unsigned long> oversized_frames;
+	std::string error_message;
+};
+
+} //: namespace CameraPGR
+} //: namespace Sources
+
+#endif /* SHAREDFRAMEPUBLISHER_HPP_ */
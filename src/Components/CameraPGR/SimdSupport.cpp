@@ -0,0 +1,55 @@
+/*!
+ * \file
+ * \brief Runtime selection of SIMD kernels
+ * \author Mikolaj Kojdecki
+ */
+
+#include "SimdSupport.hpp"
+
+namespace Sources {
+namespace CameraPGR {
+
+namespace {
+
+SimdLevel detectSimdLevel() {
+#if CAMERAPGR_X86_SIMD
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return SIMD_AVX2;
+	if (__builtin_cpu_supports("sse2"))
+		return SIMD_SSE2;
+#endif
+	return SIMD_SCALAR;
+}
+
+}
+
+		SimdLevel bestSimdLevel() {
+			static const SimdLevel level = detectSimdLevel();
+			return level;
+		}
+
+		SimdLevel simdLevelFromString(const std::string & name) {
+			SimdLevel level = bestSimdLevel();
+			if (name == "scalar")
+				level = SIMD_SCALAR;
+			else if (name == "sse2")
+				level = SIMD_SSE2;
+			else if (name == "avx2")
+				level = SIMD_AVX2;
+			return level < bestSimdLevel() ? level : bestSimdLevel();
+		}
+
+		const char * simdLevelName(SimdLevel level) {
+			switch (level) {
+			case SIMD_AVX2:
+				return "avx2";
+			case SIMD_SSE2:
+				return "sse2";
+			default:
+				return "scalar";
+			}
+		}
+
+} //: namespace CameraPGR
+} //: namespace Sources
@@ -0,0 +1,49 @@
+/*!
+ * \file
+ * \brief Runtime selection of SIMD kernels
+ * \author Mikolaj Kojdecki
+ */
+
+#ifndef SIMDSUPPORT_HPP_
+#define SIMDSUPPORT_HPP_
+
+#include <string>
+
+/*
+ * Kernels are compiled for several instruction sets within one binary
+ * (GCC target attributes), the best one supported by the CPU is chosen
+ * at runtime. On other compilers and architectures only scalar code is built.
+ */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CAMERAPGR_X86_SIMD 1
+#define CAMERAPGR_TARGET_SSE2 __attribute__((target("sse2")))
+#define CAMERAPGR_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define CAMERAPGR_X86_SIMD 0
+#endif
+
+namespace Sources {
+namespace CameraPGR {
+
+enum SimdLevel {
+	SIMD_SCALAR,
+	SIMD_SSE2,
+	SIMD_AVX2
+};
+
+/*!
+ * Best instruction set supported by this CPU (detected once).
+ */
+SimdLevel bestSimdLevel();
+
+/*!
+ * Parses "scalar", "sse2", "avx2" or "auto", never returning more than bestSimdLevel().
+ */
+SimdLevel simdLevelFromString(const std::string & name);
+
+const char * simdLevelName(SimdLevel level);
+
+} //: namespace CameraPGR
+} //: namespace Sources
+
+#endif /* SIMDSUPPORT_HPP_ */
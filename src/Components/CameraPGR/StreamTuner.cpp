@@ -0,0 +1,100 @@
+/*!
+ * \file
+ * \brief Choice of GigE packet size and delay by measuring the stream
+ * \author Mikolaj Kojdecki
+ */
+
+#include <algorithm>
+
+#include "StreamTuner.hpp"
+#include "Timing.hpp"
+
+namespace Sources {
+namespace CameraPGR {
+
+namespace {
+
+/// Trials slower than the best by less than this are compared by failures
+const double fps_tolerance = 0.02;
+
+/// Grab timeout of a trial in frame periods, settings that deliver nothing fail after it
+const double timeout_periods = 3;
+
+/// Grab timeout (ms) when the camera does not tell its frame rate
+const int default_timeout = 1000;
+
+/// Shortest grab timeout (ms), for very high frame rates
+const int min_timeout = 10;
+
+}
+
+		bool sweepStream(CaptureBackend & camera, const std::vector<unsigned int> & sizes, const std::vector<int> & delays,
+				boost::uint64_t duration, std::vector<StreamTrial> & trials) {
+			StreamSettings original;
+			if (!camera.getStreamSettings(original))
+				return false;
+
+			// a few frame periods of the rate the camera is set to
+			FlyCapture2::Property rate;
+			rate.type = FlyCapture2::FRAME_RATE;
+			int timeout = default_timeout;
+			if (camera.getProperty(rate) && rate.absValue > 0)
+				timeout = std::max(min_timeout, (int) (timeout_periods * 1000 / rate.absValue));
+			timeout = std::min<boost::uint64_t>(timeout, std::max<boost::uint64_t>(duration / 1000000, min_timeout));
+
+			FlyCapture2::Image image;
+			FrameMeta meta;
+			for (size_t s = 0; s < sizes.size(); ++s) {
+				for (size_t d = 0; d < delays.size(); ++d) {
+					StreamTrial trial;
+					trial.packet_size = sizes[s];
+					trial.packet_delay = delays[d];
+
+					StreamSettings settings;
+					settings.packet_size = trial.packet_size;
+					settings.packet_delay = trial.packet_delay;
+					// settings that deliver nothing must not stall the sweep
+					settings.grab_timeout = timeout;
+					trial.accepted = camera.setStreamSettings(settings) && camera.startCapture();
+					if (trial.accepted) {
+						// the first frame may still be on its way with the previous settings
+						camera.retrieveBuffer(image, meta);
+						const boost::uint64_t start = monotonicNanoseconds();
+						boost::uint64_t now = start;
+						while (now - start < duration) {
+							if (camera.retrieveBuffer(image, meta))
+								++trial.frames;
+							else
+								++trial.failures;
+							now = monotonicNanoseconds();
+						}
+						trial.fps = trial.frames / ((now - start) / 1e9);
+						camera.stopCapture();
+					}
+					trials.push_back(trial);
+				}
+			}
+
+			camera.setStreamSettings(original);
+			return true;
+		}
+
+		int bestTrial(const std::vector<StreamTrial> & trials) {
+			double top = 0;
+			for (size_t i = 0; i < trials.size(); ++i)
+				top = std::max(top, trials[i].fps);
+			if (top <= 0)
+				return -1;
+
+			int best = -1;
+			for (size_t i = 0; i < trials.size(); ++i) {
+				if (trials[i].fps < top * (1 - fps_tolerance))
+					continue;
+				if (best < 0 || trials[i].failureRate() < trials[best].failureRate())
+					best = i;
+			}
+			return best;
+		}
+
+} //: namespace CameraPGR
+} //: namespace Sources
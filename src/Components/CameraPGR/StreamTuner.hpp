@@ -0,0 +1,68 @@
+/*!
+ * \file
+ * \brief Choice of GigE packet size and delay by measuring the stream
+ * \author Mikolaj Kojdecki
+ */
+
+#ifndef STREAMTUNER_HPP_
+#define STREAMTUNER_HPP_
+
+#include <vector>
+
+#include <boost/cstdint.hpp>
+
+#include "CaptureBackend.hpp"
+
+namespace Sources {
+namespace CameraPGR {
+
+/*!
+ * \struct StreamTrial
+ * \brief Stream of a camera measured with one packet size and delay.
+ */
+struct StreamTrial {
+	unsigned int packet_size;
+	int packet_delay;
+	/// Camera took the settings and started capture
+	bool accepted;
+	/// Frames received complete
+	unsigned long frames;
+	/// Failed retrieves: incomplete frames and timeouts
+	unsigned long failures;
+	/// Complete frames per second
+	double fps;
+
+	StreamTrial() :
+		packet_size(0), packet_delay(0), accepted(false), frames(0), failures(0), fps(0) {
+	}
+
+	/// Part of frames lost or incomplete, 1 if nothing came
+	double failureRate() const {
+		return (frames + failures > 0) ? (double) failures / (frames + failures) : 1.0;
+	}
+};
+
+/*!
+ * Streams from the camera for duration (ns) with every packet size, each
+ * with every delay, and appends the results to trials in that order.
+ *
+ * The camera must be connected and not capturing; its frame rate and image
+ * settings are those being tuned for. Frames are waited for three frame
+ * periods at most, so that settings that deliver nothing fail fast. It is
+ * left with the stream settings it had before. Returns false if they cannot
+ * be read.
+ */
+bool sweepStream(CaptureBackend & camera, const std::vector<unsigned int> & sizes, const std::vector<int> & delays,
+		boost::uint64_t duration, std::vector<StreamTrial> & trials);
+
+/*!
+ * Trial to keep: the highest frame rate; of trials within 2% of it the one
+ * with fewest failures, of equal ones the first. -1 if no trial delivered
+ * any frame.
+ */
+int bestTrial(const std::vector<StreamTrial> & trials);
+
+} //: namespace CameraPGR
+} //: namespace Sources
+
+#endif /* STREAMTUNER_HPP_ */
@@ -0,0 +1,424 @@
+/*!
+ * \file
+ * \brief Simulated camera for running the component without hardware
+ * \author Mikolaj Kojdecki
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <cstdio>
+
+#include <boost/random/uniform_real_distribution.hpp>
+
+#include "SyntheticBackend.hpp"
+#include "Timing.hpp"
+
+namespace Sources {
+namespace CameraPGR {
+
+namespace {
+
+/// Colour (0 - R, 1 - G, 2 - B) of the pixel at even/odd row and column for each tile
+const int bayer_layout[5][2][2] = {
+	{ { 0, 1 }, { 1, 2 } }, // NONE, treated as RGGB
+	{ { 0, 1 }, { 1, 2 } }, // RGGB
+	{ { 1, 0 }, { 2, 1 } }, // GRBG
+	{ { 1, 2 }, { 0, 1 } }, // GBRG
+	{ { 2, 1 }, { 1, 0 } }  // BGGR
+};
+
+/// Number of distinct frames generated for one capture session
+const unsigned int pattern_frames = 4;
+
+/// Trigger source of the software trigger
+const unsigned int software_trigger = 7;
+
+/// Time retrieveBuffer waits for a trigger, unless the grab timeout is set
+const boost::uint64_t trigger_timeout = 1000000000ull;
+
+/// Bytes of IP, UDP and GVSP headers in a stream packet
+const unsigned int packet_headers = 36;
+/// Bytes a packet takes on the wire besides itself: Ethernet header, checksum, preamble and gap
+const unsigned int ethernet_overhead = 38;
+/// Line rate of the camera, bytes per second
+const double line_rate = 125e6;
+/// Inter-packet delay tick, seconds
+const double delay_tick = 8e-9;
+
+}
+
+		SyntheticBackend::SyntheticBackend(const std::map<std::string, std::string> & params) :
+			transfer_time(0), frame_packets(0), overflow(false), connected(false), capturing(false), serial_number(0), stride(0),
+			frame_count(0), next_frame_time(0), trigger_time(0) {
+			sensor_width = 1296;
+			sensor_height = 1032;
+			std::string sensor = urlParam<std::string>(params, "sensor", "");
+			if (!sensor.empty())
+				sscanf(sensor.c_str(), "%ux%u", &sensor_width, &sensor_height);
+
+			stride_align = urlParam<unsigned int>(params, "stride_align", 64);
+			if (stride_align == 0)
+				stride_align = 1;
+			error_rate = urlParam<double>(params, "error_rate", 0.0);
+			fail_after = urlParam<unsigned long>(params, "fail_after", 0);
+			camera_count = urlParam<unsigned int>(params, "cameras", 1);
+			rng.seed(urlParam<unsigned int>(params, "seed", 5489u));
+
+			link_mbps = urlParam<double>(params, "link_mbps", 0.0);
+			switch_buffer = urlParam<double>(params, "switch_buffer_kb", 256.0) * 1024;
+			mtu = urlParam<unsigned int>(params, "mtu", 1500);
+			packet_loss = urlParam<double>(params, "packet_loss", 0.0);
+			// defaults of Point Grey GigE cameras and the SDK
+			stream.packet_size = 1400;
+			stream.packet_delay = 0;
+			stream.buffers = 10;
+			stream.grab_mode = FlyCapture2::DROP_FRAMES;
+			stream.grab_timeout = FlyCapture2::TIMEOUT_INFINITE;
+
+			std::string bayer = urlParam<std::string>(params, "bayer", "RGGB");
+			if (bayer == "GRBG")
+				bayer_tile = FlyCapture2::GRBG;
+			else if (bayer == "GBRG")
+				bayer_tile = FlyCapture2::GBRG;
+			else if (bayer == "BGGR")
+				bayer_tile = FlyCapture2::BGGR;
+			else
+				bayer_tile = FlyCapture2::RGGB;
+
+			settings.offsetX = 0;
+			settings.offsetY = 0;
+			settings.width = sensor_width;
+			settings.height = sensor_height;
+			settings.pixelFormat = FlyCapture2::PIXEL_FORMAT_RGB;
+
+			FlyCapture2::Property frame_rate(FlyCapture2::FRAME_RATE);
+			frame_rate.present = true;
+			frame_rate.onOff = true;
+			frame_rate.autoManualMode = false;
+			frame_rate.absControl = true;
+			frame_rate.onePush = false;
+			frame_rate.valueA = frame_rate.valueB = 0;
+			frame_rate.absValue = urlParam<float>(params, "fps", 30.0f);
+			properties[FlyCapture2::FRAME_RATE] = frame_rate;
+
+			FlyCapture2::Property shutter = frame_rate;
+			shutter.type = FlyCapture2::SHUTTER;
+			shutter.absValue = 10.0f;
+			properties[FlyCapture2::SHUTTER] = shutter;
+
+			FlyCapture2::Property gain = frame_rate;
+			gain.type = FlyCapture2::GAIN;
+			gain.absValue = 0.0f;
+			properties[FlyCapture2::GAIN] = gain;
+
+			trigger.onOff = false;
+			trigger.polarity = trigger.source = trigger.mode = trigger.parameter = 0;
+		}
+
+		SyntheticBackend::~SyntheticBackend() {
+		}
+
+		bool SyntheticBackend::listCameras(std::vector<unsigned int> & serials) {
+			serials.clear();
+			for (unsigned int i = 1; i <= camera_count; ++i)
+				serials.push_back(i);
+			return true;
+		}
+
+		bool SyntheticBackend::connect(unsigned int serial) {
+			if (fail_after != 0 && frame_count >= fail_after) {
+				error_message = "Camera not found (simulated)";
+				return false;
+			}
+			serial_number = (serial != 0) ? serial : 1;
+			connected = true;
+			return true;
+		}
+
+		void SyntheticBackend::disconnect() {
+			capturing = false;
+			connected = false;
+		}
+
+		bool SyntheticBackend::getCameraInfo(FlyCapture2::CameraInfo & info) {
+			if (!connected) {
+				error_message = "Camera not connected";
+				return false;
+			}
+
+			memset(&info, 0, sizeof(info));
+			info.serialNumber = serial_number;
+			strncpy(info.modelName, "Synthetic camera", sizeof(info.modelName) - 1);
+			strncpy(info.vendorName, "CameraPGR", sizeof(info.vendorName) - 1);
+			strncpy(info.sensorInfo, "Test pattern generator", sizeof(info.sensorInfo) - 1);
+			snprintf(info.sensorResolution, sizeof(info.sensorResolution), "%ux%u", sensor_width, sensor_height);
+			return true;
+		}
+
+		bool SyntheticBackend::setImageSettings(const FlyCapture2::GigEImageSettings & new_settings) {
+			if (capturing) {
+				error_message = "Image settings cannot be changed during capture";
+				return false;
+			}
+			if (new_settings.width == 0 || new_settings.height == 0 ||
+					new_settings.offsetX + new_settings.width > sensor_width ||
+					new_settings.offsetY + new_settings.height > sensor_height) {
+				error_message = "Image window exceeds sensor size";
+				return false;
+			}
+			switch (new_settings.pixelFormat) {
+			case FlyCapture2::PIXEL_FORMAT_RGB:
+			case FlyCapture2::PIXEL_FORMAT_RGB8:
+			case FlyCapture2::PIXEL_FORMAT_RAW8:
+			case FlyCapture2::PIXEL_FORMAT_MONO8:
+			case FlyCapture2::PIXEL_FORMAT_MONO16:
+			case FlyCapture2::PIXEL_FORMAT_RAW16:
+				break;
+			default:
+				error_message = "Pixel format not supported by synthetic camera";
+				return false;
+			}
+
+			settings = new_settings;
+			return true;
+		}
+
+		bool SyntheticBackend::startCapture() {
+			if (!connected) {
+				error_message = "Camera not connected";
+				return false;
+			}
+			generateFrames();
+			planTransfer();
+			next_frame_time = 0;
+			capturing = true;
+			return true;
+		}
+
+		bool SyntheticBackend::stopCapture() {
+			capturing = false;
+			return true;
+		}
+
+		bool SyntheticBackend::getStreamSettings(StreamSettings & settings) {
+			settings = stream;
+			return true;
+		}
+
+		bool SyntheticBackend::setStreamSettings(const StreamSettings & new_settings) {
+			if (capturing) {
+				error_message = "Stream settings cannot be changed during capture";
+				return false;
+			}
+			if (new_settings.packet_size > 0 && (new_settings.packet_size < 576 || new_settings.packet_size > 9000)) {
+				error_message = "Packet size out of range";
+				return false;
+			}
+			stream.update(new_settings);
+			return true;
+		}
+
+		unsigned int SyntheticBackend::bytesPerPixel() const {
+			if (settings.pixelFormat == FlyCapture2::PIXEL_FORMAT_RGB || settings.pixelFormat == FlyCapture2::PIXEL_FORMAT_RGB8)
+				return 3;
+			if (settings.pixelFormat == FlyCapture2::PIXEL_FORMAT_MONO16 || settings.pixelFormat == FlyCapture2::PIXEL_FORMAT_RAW16)
+				return 2;
+			return 1;
+		}
+
+		void SyntheticBackend::generateFrames() {
+			const unsigned int bpp = bytesPerPixel();
+			stride = (settings.width * bpp + stride_align - 1) / stride_align * stride_align;
+
+			frames.assign(pattern_frames, std::vector<unsigned char>(stride * settings.height, 0));
+			for (unsigned int k = 0; k < pattern_frames; ++k) {
+				unsigned char * data = &frames[k][0];
+				for (unsigned int row = 0; row < settings.height; ++row) {
+					const unsigned int y = row + settings.offsetY;
+					unsigned char * line = data + row * stride;
+					for (unsigned int col = 0; col < settings.width; ++col) {
+						const unsigned int x = col + settings.offsetX;
+						// horizontal gradient, vertical gradient and vertical bars moving between frames
+						unsigned char rgb[3];
+						rgb[0] = (unsigned char) ((x * 255 / sensor_width + k * 16) & 0xff);
+						rgb[1] = (unsigned char) (y * 255 / sensor_height);
+						rgb[2] = ((x + k * 32) / 64) % 2 ? 200 : 40;
+
+						const unsigned char mono = (unsigned char) ((rgb[0] * 77 + rgb[1] * 150 + rgb[2] * 29) >> 8);
+						switch (settings.pixelFormat) {
+						case FlyCapture2::PIXEL_FORMAT_RAW8:
+							line[col] = rgb[bayer_layout[bayer_tile][y & 1][x & 1]];
+							break;
+						case FlyCapture2::PIXEL_FORMAT_MONO8:
+							line[col] = mono;
+							break;
+						case FlyCapture2::PIXEL_FORMAT_RAW16:
+							((unsigned short *) line)[col] = rgb[bayer_layout[bayer_tile][y & 1][x & 1]] * 257;
+							break;
+						case FlyCapture2::PIXEL_FORMAT_MONO16:
+							((unsigned short *) line)[col] = mono * 257;
+							break;
+						default:
+							line[3 * col] = rgb[0];
+							line[3 * col + 1] = rgb[1];
+							line[3 * col + 2] = rgb[2];
+						}
+					}
+				}
+			}
+		}
+
+		void SyntheticBackend::planTransfer() {
+			transfer_time = 0;
+			frame_packets = 0;
+			overflow = false;
+			if (link_mbps <= 0)
+				return;
+
+			const double bytes = (double) stride * settings.height;
+			frame_packets = std::ceil(bytes / (stream.packet_size - packet_headers));
+			const double wire = stream.packet_size + ethernet_overhead;
+			const double packet_time = wire / line_rate + stream.packet_delay * delay_tick;
+			transfer_time = (boost::uint64_t) (frame_packets * packet_time * 1e9);
+
+			// what the link does not take while the frame is sent waits in the switch
+			const double backlog = (wire / packet_time - link_mbps * 1e6 / 8) * frame_packets * packet_time;
+			overflow = stream.packet_size > mtu || backlog > switch_buffer;
+		}
+
+		bool SyntheticBackend::framePacketLost() {
+			if (link_mbps <= 0)
+				return false;
+			bool lost = overflow;
+			if (!lost && packet_loss > 0) {
+				boost::random::uniform_real_distribution<double> dist(0.0, 1.0);
+				lost = dist(rng) >= std::pow(1.0 - packet_loss, frame_packets);
+			}
+			if (lost)
+				error_message = "Image consistency error (simulated packet loss)";
+			return lost;
+		}
+
+		bool SyntheticBackend::injectError() {
+			if (error_rate > 0) {
+				boost::random::uniform_real_distribution<double> dist(0.0, 1.0);
+				if (dist(rng) < error_rate) {
+					error_message = "Frame lost (simulated)";
+					return true;
+				}
+			}
+			return false;
+		}
+
+		const FlyCapture2::Image * SyntheticBackend::retrieveBuffer(FlyCapture2::Image & image, FrameMeta & meta) {
+			if (!capturing) {
+				error_message = "Capture not started";
+				return 0;
+			}
+			// an unplugged camera fails at once, like the SDK does
+			if (fail_after != 0 && frame_count >= fail_after) {
+				error_message = "Camera disconnected (simulated)";
+				return 0;
+			}
+
+			// Frames are produced on a fixed schedule. If nobody asked for
+			// frames for longer than a period, they are lost, as with
+			// a real camera running in DROP_FRAMES mode.
+			float fps = properties[FlyCapture2::FRAME_RATE].absValue;
+			if (fps <= 0)
+				fps = 30.0f;
+			// the camera cannot start a frame before the previous one is sent
+			const boost::uint64_t period = std::max((boost::uint64_t) (1e9 / fps), transfer_time);
+			boost::uint64_t now = monotonicNanoseconds();
+			boost::uint64_t exposure_time;
+			if (trigger.onOff && trigger.source == software_trigger) {
+				boost::mutex::scoped_lock lock(trigger_mutex);
+				const boost::uint64_t timeout = (stream.grab_timeout >= 0) ? stream.grab_timeout * 1000000ull : trigger_timeout;
+				while (trigger_time == 0)
+					if (!trigger_fired.timed_wait(lock, boost::posix_time::microseconds(timeout / 1000))) {
+						error_message = "Trigger timeout (simulated)";
+						return 0;
+					}
+				exposure_time = trigger_time;
+				trigger_time = 0;
+			} else {
+				if (trigger.onOff)
+					// external trigger - every camera fires at the same ticks
+					next_frame_time = (now / period + 1) * period;
+				else if (next_frame_time == 0 || now > next_frame_time + period)
+					next_frame_time = now;
+				sleepUntilNanoseconds(next_frame_time);
+				exposure_time = next_frame_time;
+				next_frame_time += period;
+			}
+
+			// frame is complete when its last packet arrives
+			if (transfer_time > 0)
+				sleepUntilNanoseconds(exposure_time + transfer_time);
+
+			if (injectError() || framePacketLost()) {
+				++frame_count;
+				return 0;
+			}
+
+			// camera clock mimics 1394 cycle time, which wraps every 128 s
+			meta.camera_time = exposure_time % (128 * 1000000000ull);
+			meta.timestamp_seconds = exposure_time / 1000000000ull;
+			meta.timestamp_microseconds = (exposure_time % 1000000000ull) / 1000;
+			meta.frame_counter = frame_count;
+			meta.shutter = properties[FlyCapture2::SHUTTER].absValue;
+			meta.gain = properties[FlyCapture2::GAIN].absValue;
+
+			const std::vector<unsigned char> & frame = frames[frame_count % frames.size()];
+			const bool bayer = settings.pixelFormat == FlyCapture2::PIXEL_FORMAT_RAW8 || settings.pixelFormat == FlyCapture2::PIXEL_FORMAT_RAW16;
+			const FlyCapture2::BayerTileFormat tile = bayer ? bayer_tile : FlyCapture2::NONE;
+			image.SetDimensions(settings.height, settings.width, stride, settings.pixelFormat, tile);
+			image.SetData(&frame[0], frame.size());
+			++frame_count;
+			return &image;
+		}
+
+		bool SyntheticBackend::setTriggerMode(const FlyCapture2::TriggerMode & mode) {
+			boost::mutex::scoped_lock lock(trigger_mutex);
+			trigger = mode;
+			trigger_time = 0;
+			return true;
+		}
+
+		bool SyntheticBackend::fireSoftwareTrigger() {
+			boost::mutex::scoped_lock lock(trigger_mutex);
+			if (!trigger.onOff || trigger.source != software_trigger) {
+				error_message = "Camera not armed for software trigger";
+				return false;
+			}
+			// a trigger fired while the previous frame is still pending is ignored, like on a busy camera
+			if (trigger_time == 0)
+				trigger_time = monotonicNanoseconds();
+			trigger_fired.notify_one();
+			return true;
+		}
+
+		bool SyntheticBackend::setProperty(const FlyCapture2::Property & prop) {
+			FlyCapture2::Property & stored = properties[prop.type];
+			float value = stored.absValue;
+			stored = prop;
+			stored.present = true;
+			// value is kept by the camera when the property goes into auto mode
+			if (prop.autoManualMode || !prop.absControl)
+				stored.absValue = value;
+			return true;
+		}
+
+		bool SyntheticBackend::getProperty(FlyCapture2::Property & prop) {
+			std::map<int, FlyCapture2::Property>::const_iterator it = properties.find(prop.type);
+			if (it == properties.end()) {
+				error_message = "Property not present";
+				return false;
+			}
+			prop = it->second;
+			return true;
+		}
+
+} //: namespace CameraPGR
+} //: namespace Sources
@@ -0,0 +1,153 @@
+/*!
+ * \file
+ * \brief Simulated camera for running the component without hardware
+ * \author Mikolaj Kojdecki
+ */
+
+#ifndef SYNTHETICBACKEND_HPP_
+#define SYNTHETICBACKEND_HPP_
+
+#include <map>
+#include <vector>
+
+#include <boost/cstdint.hpp>
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/thread.hpp>
+
+#include "CaptureBackend.hpp"
+
+namespace Sources {
+namespace CameraPGR {
+
+/*!
+ * \class SyntheticBackend
+ * \brief Camera simulated in software.
+ *
+ * Generates moving test pattern in RGB8, RAW8 (Bayer), MONO8, RAW16 or
+ * MONO16 at the rate set through FRAME_RATE property. Armed for software trigger, it produces
+ * a frame per fireSoftwareTrigger(); armed for external trigger, frames of
+ * all synthetic cameras are exposed at the same multiples of the frame
+ * period, as if the cameras shared a trigger line. Frames are prepared when capture starts
+ * and then only copied into the image, as the SDK does with frames
+ * received from the network, so the cost of the generator does not show
+ * up in measurements of the component.
+ *
+ * Parameters (camera_url query):
+ * - sensor=WxH - sensor resolution, default 1296x1032,
+ * - fps - initial frame rate, default 30,
+ * - bayer - RGGB, GRBG, GBRG or BGGR, tile of RAW frames, default RGGB,
+ * - stride_align - row alignment in bytes, default 64,
+ * - error_rate - probability that retrieveBuffer fails, default 0,
+ * - fail_after - number of frames after which the camera "disappears"
+ *   and every call fails, default 0 (never),
+ * - seed - seed of the error generator,
+ * - cameras - number of cameras reported by listCameras(), with serial
+ *   numbers 1, 2, ..., default 1. Any serial number can be connected.
+ *
+ * GigE transport is simulated when link_mbps is given. A frame is then sent
+ * in packets of the stream packet size at the 1 Gb/s line rate of the
+ * camera, with the inter-packet delay after each packet; it arrives when its
+ * last packet does, and the frame rate drops when sending takes longer than
+ * the frame period. A switch passes the packets to a slower link and queues
+ * the excess; when the queue outgrows the switch buffer, packets are lost and
+ * retrieveBuffer fails with an image consistency error, as the SDK does for
+ * incomplete frames.
+ * - link_mbps - bandwidth (Mb/s) of the host link left to the camera while it
+ *   sends, e.g. 1000 / number of cameras sending at once, default 0 (no
+ *   transport simulated, frames arrive at once),
+ * - switch_buffer_kb - buffer of the switch port, default 256,
+ * - mtu - largest packet the host accepts, bigger packets are all lost, default 1500,
+ * - packet_loss - probability that a packet is lost on its own, default 0.
+ *
+ * Example: synthetic://?sensor=2448x2048&fps=60&bayer=GRBG&error_rate=0.01
+ */
+class SyntheticBackend: public CaptureBackend {
+public:
+	SyntheticBackend(const std::map<std::string, std::string> & params);
+
+	virtual ~SyntheticBackend();
+
+	bool listCameras(std::vector<unsigned int> & serials);
+	bool connect(unsigned int serial);
+	void disconnect();
+	bool getCameraInfo(FlyCapture2::CameraInfo & info);
+	bool setImageSettings(const FlyCapture2::GigEImageSettings & settings);
+	bool startCapture();
+	bool stopCapture();
+	bool getStreamSettings(StreamSettings & settings);
+	bool setStreamSettings(const StreamSettings & settings);
+	const FlyCapture2::Image * retrieveBuffer(FlyCapture2::Image & image, FrameMeta & meta);
+	bool setTriggerMode(const FlyCapture2::TriggerMode & mode);
+	bool fireSoftwareTrigger();
+	bool setProperty(const FlyCapture2::Property & prop);
+	bool getProperty(FlyCapture2::Property & prop);
+
+private:
+	/*!
+	 * Prepares pattern frames for current image settings.
+	 */
+	void generateFrames();
+
+	/*!
+	 * Checks injected failures, returns true if call should fail.
+	 */
+	bool injectError();
+
+	unsigned int bytesPerPixel() const;
+
+	/*!
+	 * Transfer of frames of current image and stream settings: time
+	 * to send a frame and whether the switch loses its packets.
+	 */
+	void planTransfer();
+
+	/*!
+	 * Checks simulated packet loss, returns true if the frame is incomplete.
+	 */
+	bool framePacketLost();
+
+	unsigned int sensor_width;
+	unsigned int sensor_height;
+	unsigned int stride_align;
+	unsigned int camera_count;
+	double error_rate;
+	unsigned long fail_after;
+	FlyCapture2::BayerTileFormat bayer_tile;
+
+	// GigE transport, simulated when link_mbps > 0
+	double link_mbps;
+	double switch_buffer;
+	unsigned int mtu;
+	double packet_loss;
+	StreamSettings stream;
+	/// Time (ns) from the exposure to the last packet of a frame
+	boost::uint64_t transfer_time;
+	/// Packets of a frame and whether the switch buffer overflows on every frame
+	double frame_packets;
+	bool overflow;
+
+	bool connected;
+	bool capturing;
+	unsigned int serial_number;
+	FlyCapture2::GigEImageSettings settings;
+	std::map<int, FlyCapture2::Property> properties;
+
+	/// Prepared frames, replayed in a loop
+	std::vector<std::vector<unsigned char> > frames;
+	unsigned int stride;
+	unsigned long frame_count;
+	boost::uint64_t next_frame_time;
+
+	FlyCapture2::TriggerMode trigger;
+	/// Time of software trigger not consumed yet, 0 - none
+	boost::uint64_t trigger_time;
+	boost::mutex trigger_mutex;
+	boost::condition_variable trigger_fired;
+
+	boost::random::mt19937 rng;
+};
+
+} //: namespace CameraPGR
+} //: namespace Sources
+
+#endif /* SYNTHETICBACKEND_HPP_ */
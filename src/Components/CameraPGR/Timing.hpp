@@ -0,0 +1,49 @@
+/*!
+ * \file
+ * \brief Monotonic clock helpers shared by the capture code
+ * \author Mikolaj Kojdecki
+ */
+
+#ifndef TIMING_HPP_
+#define TIMING_HPP_
+
+#include <time.h>
+
+#include <boost/cstdint.hpp>
+#include <boost/thread.hpp>
+
+namespace Sources {
+namespace CameraPGR {
+
+/*!
+ * Current value of the host monotonic clock in nanoseconds.
+ */
+inline boost::uint64_t monotonicNanoseconds() {
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (boost::uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/*!
+ * CPU time (ns) consumed so far by the calling thread.
+ */
+inline boost::uint64_t threadCpuNanoseconds() {
+	timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return (boost::uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/*!
+ * Sleeps the calling thread until the monotonic clock reaches deadline.
+ * The sleep is an interruption point, so boost::thread::interrupt() wakes it.
+ */
+inline void sleepUntilNanoseconds(boost::uint64_t deadline) {
+	boost::uint64_t now = monotonicNanoseconds();
+	if (deadline > now)
+		boost::this_thread::sleep(boost::posix_time::microseconds((deadline - now) / 1000));
+}
+
+} //: namespace CameraPGR
+} //: namespace Sources
+
+#endif /* TIMING_HPP_ */
@@ -0,0 +1,210 @@
+/*!
+ * \file
+ * \brief Lens distortion removal fused with colour conversion
+ * \author Mikolaj Kojdecki
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+
+#include "Undistorter.hpp"
+
+namespace Sources {
+namespace CameraPGR {
+
+namespace {
+
+const int frac_bits = 5;
+const int frac_one = 1 << frac_bits;
+const int weight_shift = 2 * frac_bits;
+const boost::uint16_t outside = 0x8000;
+
+/// Rows of one parallel band
+const int band_rows = 16;
+
+/*!
+ * Splits position in 1/32 of a pixel into sample and fraction.
+ */
+inline void split(int fixed, int & sample, int & frac) {
+	sample = fixed >> frac_bits;
+	frac = fixed & (frac_one - 1);
+}
+
+inline unsigned char blend(int a, int b, int c, int d, int w00, int w01, int w10, int w11) {
+	return (unsigned char) ((a * w00 + b * w01 + c * w10 + d * w11 + (1 << (weight_shift - 1))) >> weight_shift);
+}
+
+class RemapBody: public cv::ParallelLoopBody {
+public:
+	RemapBody(const Undistorter & undistorter, const unsigned char * src, unsigned char * dst, size_t dst_step, bool swap_rb, int rows) :
+		undistorter(undistorter), src(src), dst(dst), dst_step(dst_step), swap_rb(swap_rb), rows(rows) {
+	}
+
+	void operator()(const cv::Range & range) const {
+		const int begin = range.start * band_rows;
+		const int end = std::min(rows, range.end * band_rows);
+		undistorter.remapRows(src, dst, dst_step, swap_rb, begin, end);
+	}
+
+private:
+	const Undistorter & undistorter;
+	const unsigned char * src;
+	unsigned char * dst;
+	size_t dst_step;
+	bool swap_rb;
+	int rows;
+};
+
+}
+
+		Undistorter::Undistorter() :
+			rows(0), cols(0), offset_x(0), offset_y(0), src_step(0) {
+		}
+
+		void Undistorter::setCalibration(const cv::Mat & matrix, const cv::Mat & coeffs) {
+			camera_matrix = matrix.clone();
+			dist_coeffs = coeffs.clone();
+			rows = cols = 0;
+		}
+
+		void Undistorter::prepare(int r, int c, int ox, int oy, size_t step) {
+			if (r == rows && c == cols && ox == offset_x && oy == offset_y && step == src_step)
+				return;
+			rows = r;
+			cols = c;
+			offset_x = ox;
+			offset_y = oy;
+			src_step = step;
+			build();
+		}
+
+		void Undistorter::build() {
+			// calibration is done on the full sensor, the frame is its part starting at the offset
+			cv::Mat matrix = camera_matrix.clone();
+			matrix.at<double>(0, 2) -= offset_x;
+			matrix.at<double>(1, 2) -= offset_y;
+
+			cv::Mat map_x, map_y;
+			cv::initUndistortRectifyMap(matrix, dist_coeffs, cv::Mat(), matrix, cv::Size(cols, rows), CV_32FC1, map_x, map_y);
+
+			offsets.assign((size_t) rows * cols, 0);
+			weights.assign((size_t) rows * cols, outside);
+			border.clear();
+			border_rows.assign(rows + 1, 0);
+
+			for (int row = 0; row < rows; ++row) {
+				border_rows[row] = border.size();
+				const float * xs = map_x.ptr<float>(row);
+				const float * ys = map_y.ptr<float>(row);
+				for (int col = 0; col < cols; ++col) {
+					const float fx_pos = xs[col], fy_pos = ys[col];
+					// far outside the frame (also guards the conversion below)
+					if (!(fx_pos > -2 && fx_pos < cols + 1 && fy_pos > -2 && fy_pos < rows + 1))
+						continue;
+
+					int x, y, fx, fy;
+					split((int) floor(fx_pos * frac_one + 0.5f), x, fx);
+					split((int) floor(fy_pos * frac_one + 0.5f), y, fy);
+					if (x < -1 || y < -1 || x >= cols || y >= rows)
+						continue;
+
+					const size_t index = (size_t) row * cols + col;
+					if (x >= 0 && y >= 0 && x + 1 < cols && y + 1 < rows) {
+						offsets[index] = (boost::int32_t) (y * src_step + x * 3);
+						weights[index] = (boost::uint16_t) (fx | fy << frac_bits);
+					} else {
+						BorderPixel pixel;
+						pixel.col = col;
+						pixel.x = x;
+						pixel.y = y;
+						pixel.fx = fx;
+						pixel.fy = fy;
+						border.push_back(pixel);
+					}
+				}
+			}
+			border_rows[rows] = border.size();
+		}
+
+		void Undistorter::apply(const unsigned char * src, unsigned char * dst, size_t dst_step, bool swap_rb) const {
+			cv::parallel_for_(cv::Range(0, (rows + band_rows - 1) / band_rows), RemapBody(*this, src, dst, dst_step, swap_rb, rows));
+		}
+
+		void Undistorter::remapRows(const unsigned char * src, unsigned char * dst, size_t dst_step, bool swap_rb, int row_begin, int row_end) const {
+			// channel of the source read for blue, green and red of the output
+			const int b = swap_rb ? 2 : 0, r = swap_rb ? 0 : 2;
+
+			for (int row = row_begin; row < row_end; ++row) {
+				unsigned char * out = dst + row * dst_step;
+				const boost::int32_t * offset = &offsets[(size_t) row * cols];
+				const boost::uint16_t * weight = &weights[(size_t) row * cols];
+
+				for (int col = 0; col < cols; ++col, out += 3) {
+					const boost::uint16_t w = weight[col];
+					if (w & outside) {
+						out[0] = out[1] = out[2] = 0;
+						continue;
+					}
+					const int fx = w & (frac_one - 1), fy = w >> frac_bits;
+					const int w00 = (frac_one - fx) * (frac_one - fy), w01 = fx * (frac_one - fy);
+					const int w10 = (frac_one - fx) * fy, w11 = fx * fy;
+					const unsigned char * p = src + offset[col];
+					const unsigned char * q = p + src_step;
+					out[0] = blend(p[b], p[3 + b], q[b], q[3 + b], w00, w01, w10, w11);
+					out[1] = blend(p[1], p[4], q[1], q[4], w00, w01, w10, w11);
+					out[2] = blend(p[r], p[3 + r], q[r], q[3 + r], w00, w01, w10, w11);
+				}
+
+				// pixels near the edge, samples outside the frame are black
+				out = dst + row * dst_step;
+				for (int i = border_rows[row]; i < border_rows[row + 1]; ++i) {
+					const BorderPixel & pixel = border[i];
+					const int w[4] = { (frac_one - pixel.fx) * (frac_one - pixel.fy), pixel.fx * (frac_one - pixel.fy),
+							(frac_one - pixel.fx) * pixel.fy, pixel.fx * pixel.fy };
+					int sum[3] = { 0, 0, 0 };
+					for (int k = 0; k < 4; ++k) {
+						const int x = pixel.x + (k & 1), y = pixel.y + (k >> 1);
+						if (x < 0 || y < 0 || x >= cols || y >= rows)
+							continue;
+						const unsigned char * s = src + y * src_step + x * 3;
+						sum[0] += s[b] * w[k];
+						sum[1] += s[1] * w[k];
+						sum[2] += s[r] * w[k];
+					}
+					for (int c = 0; c < 3; ++c)
+						out[3 * pixel.col + c] = (unsigned char) ((sum[c] + (1 << (weight_shift - 1))) >> weight_shift);
+				}
+			}
+		}
+
+		bool Undistorter::parseMatrix(const std::string & text, cv::Mat & matrix) {
+			std::vector<std::vector<double> > values;
+			std::stringstream rows_stream(text);
+			std::string line;
+			while (std::getline(rows_stream, line, ';')) {
+				std::stringstream line_stream(line);
+				std::vector<double> row;
+				double value;
+				while (line_stream >> value)
+					row.push_back(value);
+				if (!line_stream.eof())
+					return false;
+				if (row.empty())
+					continue;
+				if (!values.empty() && row.size() != values[0].size())
+					return false;
+				values.push_back(row);
+			}
+			if (values.empty())
+				return false;
+
+			matrix.create(values.size(), values[0].size(), CV_64FC1);
+			for (size_t i = 0; i < values.size(); ++i)
+				for (size_t j = 0; j < values[i].size(); ++j)
+					matrix.at<double>(i, j) = values[i][j];
+			return true;
+		}
+
+} //: namespace CameraPGR
+} //: namespace Sources
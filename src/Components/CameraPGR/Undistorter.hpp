@@ -0,0 +1,105 @@
+/*!
+ * \file
+ * \brief Lens distortion removal fused with colour conversion
+ * \author Mikolaj Kojdecki
+ */
+
+#ifndef UNDISTORTER_HPP_
+#define UNDISTORTER_HPP_
+
+#include <string>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include <boost/cstdint.hpp>
+
+namespace Sources {
+namespace CameraPGR {
+
+/*!
+ * \class Undistorter
+ * \brief Remaps frames from the camera into undistorted BGR images.
+ *
+ * For every output pixel a fixed-point table keeps byte offset of the
+ * top-left source sample and 5-bit fractions of the position between
+ * samples (6 bytes per pixel). Pixels whose samples lie partly outside
+ * the frame are kept in a separate list, so the main loop needs no
+ * bounds checks. The table is built once and rebuilt only when size,
+ * position of the ROI on the sensor or row step of the source change.
+ *
+ * Source is read once and red and blue are swapped on the fly, so an RGB
+ * frame from the camera becomes rectified BGR in a single pass. Rows are
+ * split into bands processed in parallel.
+ */
+class Undistorter {
+public:
+	Undistorter();
+
+	/*!
+	 * Sets calibration of the full sensor (3x3 camera matrix, 4, 5 or 8
+	 * distortion coefficients) and drops the table.
+	 */
+	void setCalibration(const cv::Mat & camera_matrix, const cv::Mat & dist_coeffs);
+
+	bool calibrated() const {
+		return !camera_matrix.empty();
+	}
+
+	/*!
+	 * Makes sure the table matches frames of given size, taken from
+	 * (offset_x, offset_y) of the sensor, with rows src_step bytes apart.
+	 */
+	void prepare(int rows, int cols, int offset_x, int offset_y, size_t src_step);
+
+	/*!
+	 * Writes undistorted image of 3-channel src (RGB if swap_rb, BGR
+	 * otherwise) to BGR dst. Pixels mapped outside the frame are black.
+	 */
+	void apply(const unsigned char * src, unsigned char * dst, size_t dst_step, bool swap_rb) const;
+
+	/*!
+	 * Part of apply() writing rows [row_begin, row_end) of dst.
+	 */
+	void remapRows(const unsigned char * src, unsigned char * dst, size_t dst_step, bool swap_rb, int row_begin, int row_end) const;
+
+	/*!
+	 * Parses matrix written as rows separated with ';' and values separated
+	 * with spaces, e.g. "1052.9 0 646.3 ; 0 1048.5 506.1 ; 0 0 1".
+	 */
+	static bool parseMatrix(const std::string & text, cv::Mat & matrix);
+
+private:
+	/// Pixel whose source samples lie partly outside the frame
+	struct BorderPixel {
+		int col;
+		int x;
+		int y;
+		int fx;
+		int fy;
+	};
+
+	void build();
+
+	cv::Mat camera_matrix;
+	cv::Mat dist_coeffs;
+
+	int rows;
+	int cols;
+	int offset_x;
+	int offset_y;
+	size_t src_step;
+
+	/// Byte offset of the top-left source sample of each pixel
+	std::vector<boost::int32_t> offsets;
+	/// fx | fy << 5 for pixels inside, outside flag for the rest
+	std::vector<boost::uint16_t> weights;
+	/// Border pixels, ordered by row, and index of the first one in each row
+	std::vector<BorderPixel> border;
+	std::vector<int> border_rows;
+};
+
+} //: namespace CameraPGR
+} //: namespace Sources
+
+#endif /* UNDISTORTER_HPP_ */
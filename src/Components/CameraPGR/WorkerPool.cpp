@@ -0,0 +1,134 @@
+/*!
+ * \file
+ * \brief Persistent threads converting frames in bands of rows
+ * \author Mikolaj Kojdecki
+ */
+
+#include <algorithm>
+
+#include "WorkerPool.hpp"
+#include "Timing.hpp"
+
+#include <boost/bind.hpp>
+
+namespace Sources {
+namespace CameraPGR {
+
+namespace {
+
+/// Bands per worker, more than one evens out bands of different cost
+const int bands_per_thread = 4;
+
+}
+
+		WorkerPool::WorkerPool(int threads) :
+			thread_count(threads > 0 ? threads : 1), quit(false), active(false), rows(0), failed(false),
+			stage(0), band_rows(0), bands(0), next_band(0), finished_bands(0), stage_start(0) {
+			for (int i = 0; i < thread_count; ++i)
+				workers.create_thread(boost::bind(&WorkerPool::worker, this));
+		}
+
+		WorkerPool::~WorkerPool() {
+			wait();
+			{
+				boost::mutex::scoped_lock lock(mutex);
+				quit = true;
+			}
+			work_ready.notify_all();
+			workers.join_all();
+		}
+
+		void WorkerPool::start(const std::vector<Stage> & job, int job_rows, const Handler & done) {
+			boost::mutex::scoped_lock lock(mutex);
+			while (active)
+				job_done.wait(lock);
+
+			stages = job;
+			handler = done;
+			rows = job_rows;
+			failed = false;
+			stage = 0;
+			active = true;
+			beginStage();
+			work_ready.notify_all();
+		}
+
+		void WorkerPool::wait() {
+			boost::mutex::scoped_lock lock(mutex);
+			while (active)
+				job_done.wait(lock);
+		}
+
+		void WorkerPool::beginStage() {
+			if (stages[stage].banded) {
+				// even band heights keep the Bayer phase of every band the same
+				const int alignment = std::max(1, stages[stage].alignment);
+				const int target = (rows + thread_count * bands_per_thread - 1) / (thread_count * bands_per_thread);
+				band_rows = std::max(alignment, (target + alignment - 1) / alignment * alignment);
+				bands = std::max(1, (rows + band_rows - 1) / band_rows);
+			} else {
+				band_rows = rows;
+				bands = 1;
+			}
+			next_band = 0;
+			finished_bands = 0;
+			stage_start = monotonicNanoseconds();
+		}
+
+		void WorkerPool::worker() {
+			boost::mutex::scoped_lock lock(mutex);
+			for (;;) {
+				while (!quit && !(active && next_band < bands))
+					work_ready.wait(lock);
+				if (quit)
+					return;
+
+				const Stage & current = stages[stage];
+				const int begin = next_band * band_rows;
+				const int end = std::min(rows, begin + band_rows);
+				++next_band;
+
+				lock.unlock();
+				const bool ok = current.kernel(begin, end);
+				lock.lock();
+
+				failed |= !ok;
+				if (++finished_bands < bands)
+					continue;
+
+				if (current.latency)
+					current.latency->record(monotonicNanoseconds() - stage_start);
+				if (!failed && ++stage < stages.size()) {
+					beginStage();
+					work_ready.notify_all();
+					continue;
+				}
+
+				// last band of the job - report it outside the lock
+				Handler done;
+				if (!failed)
+					done.swap(handler);
+				lock.unlock();
+				if (done)
+					done();
+				lock.lock();
+				active = false;
+				handler.clear();
+				job_done.notify_all();
+			}
+		}
+
+		void WorkerPool::runInline(const std::vector<Stage> & stages, int rows, const Handler & done) {
+			for (size_t i = 0; i < stages.size(); ++i) {
+				const boost::uint64_t start = monotonicNanoseconds();
+				if (!stages[i].kernel(0, rows))
+					return;
+				if (stages[i].latency)
+					stages[i].latency->record(monotonicNanoseconds() - start);
+			}
+			if (done)
+				done();
+		}
+
+} //: namespace CameraPGR
+} //: namespace Sources
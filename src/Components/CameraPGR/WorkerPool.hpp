@@ -0,0 +1,113 @@
+/*!
+ * \file
+ * \brief Persistent threads converting frames in bands of rows
+ * \author Mikolaj Kojdecki
+ */
+
+#ifndef WORKERPOOL_HPP_
+#define WORKERPOOL_HPP_
+
+#include <vector>
+
+#include <boost/cstdint.hpp>
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+
+#include "LatencyHistogram.hpp"
+
+namespace Sources {
+namespace CameraPGR {
+
+/*!
+ * \class WorkerPool
+ * \brief Fixed set of threads running conversion of one frame at a time.
+ *
+ * A job is a list of stages (e.g. demosaic, then undistortion), each
+ * processing rows of the frame. Rows of a stage are split into bands taken
+ * by free workers; the next stage starts when all bands of the previous
+ * one are done. start() returns immediately, so the capture thread can
+ * retrieve the next frame while the workers convert the current one.
+ * When the job is finished the last worker calls its completion handler.
+ */
+class WorkerPool {
+public:
+	/// Processes rows [begin, end), returns false on failure
+	typedef boost::function<bool(int, int)> Kernel;
+
+	struct Stage {
+		Kernel kernel;
+		/// false - kernel processes the whole frame in one call
+		bool banded;
+		/// Duration of the stage is recorded here, if set
+		LatencyHistogram * latency;
+		/// Bands start at multiples of this many rows
+		int alignment;
+
+		Stage(const Kernel & kernel, bool banded = true, LatencyHistogram * latency = 0, int alignment = 2) :
+			kernel(kernel), banded(banded), latency(latency), alignment(alignment) {
+		}
+	};
+
+	/// Called after all stages succeeded
+	typedef boost::function<void()> Handler;
+
+	WorkerPool(int threads);
+
+	/*!
+	 * Waits for the current job and stops the threads.
+	 */
+	~WorkerPool();
+
+	/*!
+	 * Starts job on a frame of given rows. Waits for the previous job first.
+	 */
+	void start(const std::vector<Stage> & stages, int rows, const Handler & done);
+
+	/*!
+	 * Waits until the current job (if any) is finished.
+	 */
+	void wait();
+
+	int threads() const {
+		return thread_count;
+	}
+
+	/*!
+	 * Runs job on the calling thread, stage after stage.
+	 */
+	static void runInline(const std::vector<Stage> & stages, int rows, const Handler & done);
+
+private:
+	void worker();
+
+	/*!
+	 * Prepares bands of the current stage. Called with the lock held.
+	 */
+	void beginStage();
+
+	const int thread_count;
+	boost::thread_group workers;
+
+	boost::mutex mutex;
+	boost::condition_variable work_ready;
+	boost::condition_variable job_done;
+	bool quit;
+
+	// Current job, guarded by mutex
+	bool active;
+	std::vector<Stage> stages;
+	Handler handler;
+	int rows;
+	bool failed;
+	size_t stage;
+	int band_rows;
+	int bands;
+	int next_band;
+	int finished_bands;
+	boost::uint64_t stage_start;
+};
+
+} //: namespace CameraPGR
+} //: namespace Sources
+
+#endif /* WORKERPOOL_HPP_ */
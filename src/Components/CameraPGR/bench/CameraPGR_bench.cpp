@@ -0,0 +1,396 @@
+/*!
+ * \file
+ * \brief Microbenchmark of the pixel kernels used by CameraPGR_Source
+ * \author Mikolaj Kojdecki
+ *
+ * Runs every kernel on random frames of several sizes, on one thread and
+ * on several threads (each thread converting its own band of rows), and
+ * prints results as JSON on standard output and as a table on standard
+ * error. No camera is needed.
+ *
+ * Usage: CameraPGR_bench [--iterations N] [--threads N] [--json FILE]
+ *
+ * MB/s counts bytes read plus bytes written per frame.
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+
+#include <opencv2/opencv.hpp>
+
+#include "BayerDemosaic.hpp"
+#include "FrameConverter.hpp"
+#include "SimdSupport.hpp"
+#include "Timing.hpp"
+#include "Undistorter.hpp"
+
+using namespace Sources::CameraPGR;
+
+namespace {
+
+/// Converts rows [begin, end) of the frame
+typedef boost::function<void(int, int)> Kernel;
+
+/*!
+ * Runs a kernel split into bands of rows on a fixed set of threads.
+ * The calling thread converts the first band.
+ */
+class BandRunner {
+public:
+	BandRunner(int threads) : thread_count(threads), start(threads), done(threads), quit(false) {
+		for (int i = 1; i < thread_count; ++i)
+			workers.create_thread(boost::bind(&BandRunner::worker, this, i));
+	}
+
+	~BandRunner() {
+		quit = true;
+		start.wait();
+		workers.join_all();
+	}
+
+	void run(const Kernel & k, int row_count) {
+		kernel = k;
+		rows = row_count;
+		start.wait();
+		band(0);
+		done.wait();
+	}
+
+private:
+	void band(int index) {
+		// bands of even height keep Bayer phase and alignment simple
+		const int step = ((rows + thread_count - 1) / thread_count + 1) & ~1;
+		const int begin = std::min(rows, index * step);
+		const int end = std::min(rows, begin + step);
+		if (begin < end)
+			kernel(begin, end);
+	}
+
+	void worker(int index) {
+		for (;;) {
+			start.wait();
+			if (quit)
+				return;
+			band(index);
+			done.wait();
+		}
+	}
+
+	const int thread_count;
+	boost::barrier start;
+	boost::barrier done;
+	volatile bool quit;
+	boost::thread_group workers;
+	Kernel kernel;
+	int rows;
+};
+
+struct Case {
+	std::string name;
+	Kernel kernel;
+	/// bytes read and written per frame
+	size_t bytes;
+};
+
+struct Result {
+	std::string kernel;
+	int width;
+	int height;
+	int threads;
+	double ms_per_frame;
+	double ns_per_pixel;
+	double mb_per_s;
+};
+
+/*!
+ * Median time of one frame in ms.
+ */
+double measure(BandRunner & runner, const Kernel & kernel, int rows, int iterations) {
+	// warm up caches and lazy initialisation
+	runner.run(kernel, rows);
+
+	std::vector<double> times;
+	for (int i = 0; i < iterations; ++i) {
+		const boost::uint64_t begin = monotonicNanoseconds();
+		runner.run(kernel, rows);
+		times.push_back((monotonicNanoseconds() - begin) / 1e6);
+	}
+	std::sort(times.begin(), times.end());
+	return times[times.size() / 2];
+}
+
+// Kernels, each converting rows [begin, end)
+
+void swapRGB(const cv::Mat * src, cv::Mat * dst, int begin, int end) {
+	cv::Mat out = dst->rowRange(begin, end);
+	cv::cvtColor(src->rowRange(begin, end), out, CV_RGB2BGR);
+}
+
+void convertRGBU(const cv::Mat * src, cv::Mat * dst, int begin, int end) {
+	cv::Mat out = dst->rowRange(begin, end);
+	cv::cvtColor(src->rowRange(begin, end), out, CV_RGBA2BGR);
+}
+
+void extractMono(const cv::Mat * src, cv::Mat * dst, int begin, int end) {
+	cv::Mat out = dst->rowRange(begin, end);
+	cv::cvtColor(src->rowRange(begin, end), out, CV_BGR2GRAY);
+}
+
+/*!
+ * Converter chosen once per format pair, as in the capture loop.
+ */
+void convertFrame(RowConverter convert, const cv::Mat * src, cv::Mat * dst, int begin, int end) {
+	SourceImage source;
+	source.data = src->data;
+	source.step = src->step[0];
+	source.rows = src->rows;
+	source.cols = src->cols;
+	source.pattern = BAYER_RGGB;
+	convert(source, dst->data, dst->step[0], DEMOSAIC_BILINEAR, bestSimdLevel(), begin, end);
+}
+
+void demosaic(const cv::Mat * src, cv::Mat * dst, DemosaicMethod method, SimdLevel simd, int begin, int end) {
+	demosaicBGR(src->data, src->step[0], dst->data, dst->step[0], src->rows, src->cols, begin, end, BAYER_RGGB, method, simd);
+}
+
+void luma(const cv::Mat * src, cv::Mat * dst, SimdLevel simd, int begin, int end) {
+	bayerLuma(src->data, src->step[0], dst->data, dst->step[0], src->rows, src->cols, begin, end, simd);
+}
+
+/*!
+ * Mono output of a Bayer camera, as it would be done without a dedicated converter.
+ */
+void demosaicThenGray(const cv::Mat * src, cv::Mat * bgr, cv::Mat * dst, int begin, int end) {
+	demosaicBGR(src->data, src->step[0], bgr->data, bgr->step[0], src->rows, src->cols, begin, end, BAYER_RGGB, DEMOSAIC_BILINEAR);
+	cv::Mat out = dst->rowRange(begin, end);
+	cv::cvtColor(bgr->rowRange(begin, end), out, CV_BGR2GRAY);
+}
+
+void grayToBGR(const cv::Mat * src, cv::Mat * dst, int begin, int end) {
+	cv::Mat out = dst->rowRange(begin, end);
+	cv::cvtColor(src->rowRange(begin, end), out, CV_GRAY2BGR);
+}
+
+void demosaicOpenCV(const cv::Mat * src, cv::Mat * dst, int begin, int end) {
+	// OpenCV needs a border row on each side of the band
+	const int first = std::max(0, begin - 2);
+	const int last = std::min(src->rows, end + 2);
+	cv::Mat bgr;
+	cv::cvtColor(src->rowRange(first & ~1, last), bgr, CV_BayerBG2BGR);
+	cv::Mat out = dst->rowRange(begin, end);
+	bgr.rowRange(begin - (first & ~1), end - (first & ~1)).copyTo(out);
+}
+
+void undistort(const cv::Mat * src, cv::Mat * dst, const cv::Mat * map1, const cv::Mat * map2, int begin, int end) {
+	cv::Mat out = dst->rowRange(begin, end);
+	cv::remap(*src, out, map1->rowRange(begin, end), map2->rowRange(begin, end), cv::INTER_LINEAR);
+}
+
+void undistortFused(const cv::Mat * src, cv::Mat * dst, const Undistorter * undistorter, int begin, int end) {
+	undistorter->remapRows(src->data, dst->data, dst->step[0], true, begin, end);
+}
+
+void writeJson(std::ostream & os, const std::vector<Result> & results) {
+	os << "{\n  \"benchmark\": \"CameraPGR\",\n  \"simd\": \"" << simdLevelName(bestSimdLevel()) << "\",\n  \"results\": [\n";
+	for (size_t i = 0; i < results.size(); ++i) {
+		const Result & r = results[i];
+		os << "    { \"kernel\": \"" << r.kernel << "\", \"width\": " << r.width << ", \"height\": " << r.height
+				<< ", \"threads\": " << r.threads << ", \"ms_per_frame\": " << r.ms_per_frame
+				<< ", \"ns_per_pixel\": " << r.ns_per_pixel << ", \"mb_per_s\": " << r.mb_per_s << " }"
+				<< (i + 1 < results.size() ? "," : "") << "\n";
+	}
+	os << "  ]\n}\n";
+}
+
+}
+
+int main(int argc, char ** argv) {
+	int iterations = 50;
+	int threads = boost::thread::hardware_concurrency();
+	std::string json_file;
+
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (arg == "--iterations" && i + 1 < argc)
+			iterations = std::max(1, atoi(argv[++i]));
+		else if (arg == "--threads" && i + 1 < argc)
+			threads = atoi(argv[++i]);
+		else if (arg == "--json" && i + 1 < argc)
+			json_file = argv[++i];
+		else {
+			std::cerr << "Usage: " << argv[0] << " [--iterations N] [--threads N] [--json FILE]\n";
+			return 1;
+		}
+	}
+	if (threads < 1)
+		threads = 1;
+
+	// threads are managed here, OpenCV must not split the work on its own
+	cv::setNumThreads(0);
+
+	const int sizes[][2] = { { 640, 480 }, { 1296, 1032 }, { 1920, 1200 }, { 2448, 2048 } };
+	std::vector<int> thread_counts;
+	thread_counts.push_back(1);
+	if (threads > 1)
+		thread_counts.push_back(threads);
+
+	std::vector<Result> results;
+	fprintf(stderr, "%-28s %11s %7s %10s %8s %10s\n", "kernel", "size", "threads", "ms/frame", "ns/px", "MB/s");
+
+	for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+		const int width = sizes[s][0];
+		const int height = sizes[s][1];
+
+		cv::Mat rgb(height, width, CV_8UC3), rgbu(height, width, CV_8UC4), raw(height, width, CV_8UC1);
+		cv::randu(rgb, cv::Scalar::all(0), cv::Scalar::all(256));
+		cv::randu(rgbu, cv::Scalar::all(0), cv::Scalar::all(256));
+		cv::randu(raw, cv::Scalar::all(0), cv::Scalar::all(256));
+		cv::Mat raw16(height, width, CV_16UC1), gray16(height, width, CV_16UC1);
+		cv::randu(raw16, cv::Scalar::all(0), cv::Scalar::all(65536));
+		cv::Mat bgr(height, width, CV_8UC3), gray(height, width, CV_8UC1), rectified(height, width, CV_8UC3);
+
+		// calibration of the camera from tasks/CameraUndist2.xml, scaled to the frame
+		const double scale = width / 1296.0;
+		cv::Mat camera_matrix = (cv::Mat_<double>(3, 3) << 1052.974150 * scale, 0, 646.343139 * scale,
+				0, 1048.529819 * scale, 506.165068 * scale, 0, 0, 1);
+		cv::Mat dist_coeffs = (cv::Mat_<double>(1, 5) << -0.405033, 0.189376, 0.000262, 0.000465, 0.0);
+		cv::Mat map1, map2;
+		cv::initUndistortRectifyMap(camera_matrix, dist_coeffs, cv::Mat(), camera_matrix, cv::Size(width, height), CV_16SC2, map1, map2);
+		Undistorter undistorter;
+		undistorter.setCalibration(camera_matrix, dist_coeffs);
+		undistorter.prepare(height, width, 0, 0, rgb.step[0]);
+
+		std::vector<Case> cases;
+		const size_t pixels = (size_t) width * height;
+
+		Case c;
+		c.name = "rgb_to_bgr";
+		c.kernel = boost::bind(swapRGB, &rgb, &bgr, _1, _2);
+		c.bytes = pixels * 6;
+		cases.push_back(c);
+
+		// format pairs of the capture loop, cvtColor cases above and below are the previous path
+		c.name = "convert_rgb8_bgr8";
+		c.kernel = boost::bind(convertFrame, rowConverter(INPUT_RGB8, OUTPUT_BGR8), &rgb, &bgr, _1, _2);
+		cases.push_back(c);
+
+		c.name = "rgbu_to_bgr";
+		c.kernel = boost::bind(convertRGBU, &rgbu, &bgr, _1, _2);
+		c.bytes = pixels * 7;
+		cases.push_back(c);
+
+		for (int level = SIMD_SCALAR; level <= bestSimdLevel(); ++level) {
+			c.name = std::string("demosaic_bilinear_") + simdLevelName((SimdLevel) level);
+			c.kernel = boost::bind(demosaic, &raw, &bgr, DEMOSAIC_BILINEAR, (SimdLevel) level, _1, _2);
+			c.bytes = pixels * 4;
+			cases.push_back(c);
+
+			c.name = std::string("demosaic_edge_") + simdLevelName((SimdLevel) level);
+			c.kernel = boost::bind(demosaic, &raw, &bgr, DEMOSAIC_EDGE_AWARE, (SimdLevel) level, _1, _2);
+			cases.push_back(c);
+		}
+
+		c.name = "demosaic_opencv";
+		c.kernel = boost::bind(demosaicOpenCV, &raw, &bgr, _1, _2);
+		cases.push_back(c);
+
+		c.name = "bgr_to_mono";
+		c.kernel = boost::bind(extractMono, &rgb, &gray, _1, _2);
+		c.bytes = pixels * 4;
+		cases.push_back(c);
+
+		c.name = "convert_rgb8_mono8";
+		c.kernel = boost::bind(convertFrame, rowConverter(INPUT_RGB8, OUTPUT_MONO8), &rgb, &gray, _1, _2);
+		cases.push_back(c);
+
+		c.name = "convert_raw8_mono8";
+		c.kernel = boost::bind(convertFrame, rowConverter(INPUT_RAW8, OUTPUT_MONO8), &raw, &gray, _1, _2);
+		c.bytes = pixels * 2;
+		cases.push_back(c);
+
+		for (int level = SIMD_SCALAR; level <= bestSimdLevel(); ++level) {
+			c.name = std::string("bayer_luma_") + simdLevelName((SimdLevel) level);
+			c.kernel = boost::bind(luma, &raw, &gray, (SimdLevel) level, _1, _2);
+			cases.push_back(c);
+		}
+
+		c.name = "raw8_to_mono8_demosaic_cvtcolor";
+		c.kernel = boost::bind(demosaicThenGray, &raw, &bgr, &gray, _1, _2);
+		c.bytes = pixels * 8;
+		cases.push_back(c);
+
+		c.name = "convert_mono8_bgr8";
+		c.kernel = boost::bind(convertFrame, rowConverter(INPUT_MONO8, OUTPUT_BGR8), &raw, &bgr, _1, _2);
+		c.bytes = pixels * 4;
+		cases.push_back(c);
+
+		c.name = "mono8_to_bgr8_cvtcolor";
+		c.kernel = boost::bind(grayToBGR, &raw, &bgr, _1, _2);
+		cases.push_back(c);
+
+		c.name = "convert_raw16_mono16";
+		c.kernel = boost::bind(convertFrame, rowConverter(INPUT_RAW16, OUTPUT_MONO16), &raw16, &gray16, _1, _2);
+		c.bytes = pixels * 4;
+		cases.push_back(c);
+
+		c.name = "convert_mono16_mono8";
+		c.kernel = boost::bind(convertFrame, rowConverter(INPUT_MONO16, OUTPUT_MONO8), &raw16, &gray, _1, _2);
+		c.bytes = pixels * 3;
+		cases.push_back(c);
+
+		c.name = "convert_raw16_bgr8";
+		c.kernel = boost::bind(convertFrame, rowConverter(INPUT_RAW16, OUTPUT_BGR8), &raw16, &bgr, _1, _2);
+		c.bytes = pixels * 5;
+		cases.push_back(c);
+
+		c.name = "undistort_remap";
+		c.kernel = boost::bind(undistort, &rgb, &rectified, &map1, &map2, _1, _2);
+		c.bytes = pixels * 6 + map1.total() * map1.elemSize() + map2.total() * map2.elemSize();
+		cases.push_back(c);
+
+		// remap of the camera RGB frame with red and blue swapped, as done by the component
+		c.name = "undistort_fused_rgb_to_bgr";
+		c.kernel = boost::bind(undistortFused, &rgb, &rectified, &undistorter, _1, _2);
+		c.bytes = pixels * 12;
+		cases.push_back(c);
+
+		for (size_t t = 0; t < thread_counts.size(); ++t) {
+			BandRunner runner(thread_counts[t]);
+			for (size_t k = 0; k < cases.size(); ++k) {
+				Result r;
+				r.kernel = cases[k].name;
+				r.width = width;
+				r.height = height;
+				r.threads = thread_counts[t];
+				r.ms_per_frame = measure(runner, cases[k].kernel, height, iterations);
+				r.ns_per_pixel = r.ms_per_frame * 1e6 / pixels;
+				r.mb_per_s = cases[k].bytes / (r.ms_per_frame * 1e-3) / 1e6;
+				results.push_back(r);
+
+				std::stringstream size;
+				size << width << "x" << height;
+				fprintf(stderr, "%-28s %11s %7d %10.3f %8.3f %10.1f\n", r.kernel.c_str(), size.str().c_str(),
+						r.threads, r.ms_per_frame, r.ns_per_pixel, r.mb_per_s);
+			}
+		}
+	}
+
+	if (!json_file.empty()) {
+		std::ofstream file(json_file.c_str());
+		writeJson(file, results);
+	} else {
+		writeJson(std::cout, results);
+	}
+	return 0;
+}
@@ -0,0 +1,221 @@
+/*!
+ * \file
+ * \brief Capture to sink latency of the delivery modes of CameraPGR_Source
+ * \author Mikolaj Kojdecki
+ *
+ * Frames of the synthetic camera are handed to a sink the way the component
+ * does it: with step delivery the capture thread puts them in a latest-only
+ * FrameQueue and the source executor writes the newest one every source
+ * period; with event delivery the capture thread writes every frame itself.
+ * The sink either polls at its executor period or runs on every write, as
+ * a sink triggered by out_trigger. Prints the number of frames that reached
+ * the sink and the time from receiving a frame to the sink taking it.
+ * No camera is needed.
+ *
+ * Usage: CameraPGR_latency [--delivery step|event] [--sink poll|trigger]
+ *        [--source-period S] [--sink-period S] [--frames N] [--fps F]
+ *
+ * The figures in IMPORTANT.README come from:
+ *   CameraPGR_latency --delivery step --sink poll --source-period 0.1 --sink-period 0.05
+ *   CameraPGR_latency --delivery event --sink poll --sink-period 0.05
+ *   CameraPGR_latency --delivery event --sink trigger
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include "FrameQueue.hpp"
+#include "SyntheticBackend.hpp"
+#include "Timing.hpp"
+
+using namespace Sources::CameraPGR;
+
+namespace {
+
+struct Item {
+	/// Host time (ns) the frame was received at
+	boost::uint64_t received;
+	unsigned long number;
+};
+
+/*!
+ * Input port of the sink: keeps the last frame written, like a DataStream,
+ * and wakes a triggered sink.
+ */
+class Sink {
+public:
+	Sink() :
+		fresh(false), quit(false) {
+	}
+
+	void write(const Item & item) {
+		boost::mutex::scoped_lock lock(mutex);
+		last = item;
+		fresh = true;
+		written.notify_one();
+	}
+
+	void stop() {
+		boost::mutex::scoped_lock lock(mutex);
+		quit = true;
+		written.notify_all();
+	}
+
+	/// Takes a frame every period, if one was written since the last
+	void poll(double period) {
+		for (;;) {
+			boost::this_thread::sleep(boost::posix_time::microseconds((long) (period * 1e6)));
+			boost::mutex::scoped_lock lock(mutex);
+			if (quit)
+				return;
+			if (fresh)
+				take();
+		}
+	}
+
+	/// Takes every frame as soon as it is written
+	void trigger() {
+		boost::mutex::scoped_lock lock(mutex);
+		for (;;) {
+			while (!fresh && !quit)
+				written.wait(lock);
+			if (quit)
+				return;
+			take();
+		}
+	}
+
+	/// Latencies (ms) of the frames taken, called after stop()
+	std::vector<double> latencies;
+
+private:
+	void take() {
+		fresh = false;
+		latencies.push_back((monotonicNanoseconds() - last.received) / 1e6);
+	}
+
+	boost::mutex mutex;
+	boost::condition_variable written;
+	Item last;
+	bool fresh;
+	bool quit;
+};
+
+/*!
+ * Step of the source executor: writes the newest frame every period.
+ */
+void sourceSteps(FrameQueue<Item> * queue, Sink * sink, double period, const boost::atomic<bool> * quit) {
+	while (!quit->load()) {
+		boost::this_thread::sleep(boost::posix_time::microseconds((long) (period * 1e6)));
+		Item item;
+		if (queue->pop(item))
+			sink->write(item);
+	}
+}
+
+}
+
+int main(int argc, char ** argv) {
+	std::string delivery = "step";
+	std::string sink_mode = "poll";
+	double source_period = 0.1;
+	double sink_period = 0.05;
+	unsigned long frames = 300;
+	std::string fps = "30";
+
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (arg == "--delivery" && i + 1 < argc)
+			delivery = argv[++i];
+		else if (arg == "--sink" && i + 1 < argc)
+			sink_mode = argv[++i];
+		else if (arg == "--source-period" && i + 1 < argc)
+			source_period = atof(argv[++i]);
+		else if (arg == "--sink-period" && i + 1 < argc)
+			sink_period = atof(argv[++i]);
+		else if (arg == "--frames" && i + 1 < argc)
+			frames = std::max(1l, atol(argv[++i]));
+		else if (arg == "--fps" && i + 1 < argc)
+			fps = argv[++i];
+		else {
+			fprintf(stderr, "Usage: %s [--delivery step|event] [--sink poll|trigger] [--source-period S] [--sink-period S] [--frames N] [--fps F]\n",
+					argv[0]);
+			return 1;
+		}
+	}
+	const bool event = (delivery == "event");
+	const bool triggered = (sink_mode == "trigger");
+
+	std::map<std::string, std::string> params;
+	params["sensor"] = "1296x1032";
+	params["fps"] = fps;
+	SyntheticBackend camera(params);
+	FlyCapture2::GigEImageSettings settings;
+	settings.offsetX = 0;
+	settings.offsetY = 0;
+	settings.width = 1296;
+	settings.height = 1032;
+	settings.pixelFormat = FlyCapture2::PIXEL_FORMAT_RGB8;
+	if (!camera.connect(0) || !camera.setImageSettings(settings) || !camera.startCapture()) {
+		fprintf(stderr, "Synthetic camera: %s\n", camera.lastError().c_str());
+		return 1;
+	}
+
+	Sink sink;
+	FrameQueue<Item> queue(4, QUEUE_LATEST_ONLY);
+	boost::atomic<bool> quit(false);
+	boost::thread sink_thread = triggered ? boost::thread(boost::bind(&Sink::trigger, &sink)) : boost::thread(boost::bind(&Sink::poll, &sink, sink_period));
+	boost::thread source_thread;
+	if (!event)
+		source_thread = boost::thread(boost::bind(sourceSteps, &queue, &sink, source_period, &quit));
+
+	// capture thread: the copy stands for the conversion to out_img
+	FlyCapture2::Image image;
+	FrameMeta meta;
+	std::vector<unsigned char> converted(settings.width * settings.height * 3);
+	unsigned long retrieved = 0;
+	for (unsigned long n = 0; n < frames; ++n) {
+		const FlyCapture2::Image * frame = camera.retrieveBuffer(image, meta);
+		if (!frame)
+			continue;
+		Item item;
+		item.received = monotonicNanoseconds();
+		item.number = n;
+		memcpy(&converted[0], frame->GetData(), std::min<size_t>(converted.size(), frame->GetDataSize()));
+		++retrieved;
+		if (event)
+			sink.write(item);
+		else
+			queue.push(item);
+	}
+	camera.stopCapture();
+
+	quit = true;
+	if (source_thread.joinable())
+		source_thread.join();
+	sink.stop();
+	sink_thread.join();
+
+	std::vector<double> & latencies = sink.latencies;
+	if (latencies.empty()) {
+		fprintf(stderr, "No frames reached the sink\n");
+		return 1;
+	}
+	std::sort(latencies.begin(), latencies.end());
+	double sum = 0;
+	for (size_t i = 0; i < latencies.size(); ++i)
+		sum += latencies[i];
+	printf("%s delivery, %s sink: %lu of %lu frames, latency mean %.3f ms, p50 %.3f ms, p99 %.3f ms, max %.3f ms\n", delivery.c_str(), sink_mode.c_str(),
+			(unsigned long) latencies.size(), retrieved, sum / latencies.size(), latencies[latencies.size() / 2], latencies[latencies.size() * 99 / 100],
+			latencies.back());
+	return 0;
+}
@@ -0,0 +1,198 @@
+/*!
+ * \file
+ * \brief Stress test of FrameQueue under every queue policy
+ * \author Mikolaj Kojdecki
+ *
+ * A producer thread pushes numbered items while a consumer thread pops them,
+ * both pausing at random moments so that the queue runs empty, full and
+ * everything in between. For each policy and several capacities the test
+ * checks that items come out in order, none twice and none torn, that the
+ * counters add up to the items pushed and that the queue keeps no reference
+ * to an item once it is out. No camera is needed.
+ *
+ * Usage: FrameQueue_stress [--items N] [--rounds N]
+ *
+ * Exits with 1 if any check fails.
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include <boost/bind.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+
+#include "FrameQueue.hpp"
+
+using namespace Sources::CameraPGR;
+
+namespace {
+
+/*!
+ * Stands for a frame: its number, a copy of it to detect torn items and a
+ * reference to a shared buffer, as frames hold pool buffers.
+ */
+struct Item {
+	unsigned long number;
+	unsigned long check;
+	boost::shared_ptr<int> buffer;
+
+	Item() :
+		number(0), check(~0ul) {
+	}
+};
+
+/*!
+ * Random pause of the thread: none most of the time, a yield or a short
+ * sleep now and then.
+ */
+void pause(unsigned int & seed) {
+	seed = seed * 1103515245u + 12345u;
+	const unsigned int roll = (seed >> 16) % 64;
+	if (roll == 0)
+		boost::this_thread::sleep(boost::posix_time::microseconds(200));
+	else if (roll < 8)
+		boost::this_thread::yield();
+}
+
+void produce(FrameQueue<Item> * queue, unsigned long items, boost::shared_ptr<int> buffer, unsigned long * rejected) {
+	unsigned int seed = 1;
+	for (unsigned long i = 0; i < items; ++i) {
+		Item item;
+		item.number = i;
+		item.check = ~i;
+		item.buffer = buffer;
+		if (!queue->push(item))
+			++*rejected;
+		pause(seed);
+	}
+}
+
+struct Consumed {
+	unsigned long popped;
+	unsigned long last;
+	unsigned long out_of_order;
+	unsigned long torn;
+	unsigned long gaps;
+};
+
+/*!
+ * Pops until the producer is done and the queue is empty.
+ */
+void consume(FrameQueue<Item> * queue, const boost::atomic<bool> * produced, Consumed * result) {
+	unsigned int seed = 2;
+	Consumed & r = *result;
+	r.popped = r.out_of_order = r.torn = r.gaps = 0;
+	r.last = 0;
+	for (;;) {
+		const bool done = produced->load(boost::memory_order_acquire);
+		Item item;
+		if (!queue->pop(item)) {
+			if (done)
+				return;
+			boost::this_thread::yield();
+			continue;
+		}
+		if (item.check != ~item.number || !item.buffer)
+			++r.torn;
+		if (r.popped > 0) {
+			if (item.number <= r.last)
+				++r.out_of_order;
+			else if (item.number != r.last + 1)
+				++r.gaps;
+		}
+		r.last = item.number;
+		++r.popped;
+		pause(seed);
+	}
+}
+
+const char * policyName(QueuePolicy policy) {
+	switch (policy) {
+	case QUEUE_DROP_OLDEST:
+		return "drop_oldest";
+	case QUEUE_BLOCK:
+		return "block";
+	default:
+		return "latest";
+	}
+}
+
+/*!
+ * One producer and one consumer through a queue, returns the number of
+ * failed checks.
+ */
+int run(QueuePolicy policy, size_t capacity, unsigned long items) {
+	FrameQueue<Item> queue(capacity, policy);
+	boost::shared_ptr<int> buffer(new int(0));
+	boost::atomic<bool> produced(false);
+	unsigned long rejected = 0;
+	Consumed consumed;
+
+	boost::thread consumer(boost::bind(consume, &queue, &produced, &consumed));
+	produce(&queue, items, buffer, &rejected);
+	produced.store(true, boost::memory_order_release);
+	consumer.join();
+
+	int failures = 0;
+	std::string errors;
+	const unsigned long dropped = queue.dropped();
+	const unsigned long stale = queue.stale();
+	if (rejected > 0 || queue.enqueued() != items)
+		errors += " enqueued";
+	if (consumed.out_of_order > 0)
+		errors += " order";
+	if (consumed.torn > 0)
+		errors += " torn";
+	if (consumed.popped + dropped + stale != items)
+		errors += " counts";
+	if (consumed.popped == 0 || consumed.last != items - 1)
+		errors += " last";
+	if (policy == QUEUE_BLOCK && (dropped > 0 || stale > 0 || consumed.gaps > 0))
+		errors += " lost";
+	if (policy == QUEUE_DROP_OLDEST && stale > 0)
+		errors += " stale";
+	if (policy != QUEUE_LATEST_ONLY && queue.size() != 0)
+		errors += " left";
+	// every item taken out, by pop() or eviction, gave its reference back
+	if (buffer.use_count() != 1)
+		errors += " references";
+	if (!errors.empty())
+		++failures;
+
+	printf("%-12s capacity %3lu: popped %8lu dropped %8lu stale %8lu gaps %8lu%s%s\n", policyName(policy), (unsigned long) queue.capacity(),
+			consumed.popped, dropped, stale, consumed.gaps, errors.empty() ? " ok" : " FAILED:", errors.c_str());
+	return failures;
+}
+
+}
+
+int main(int argc, char ** argv) {
+	unsigned long items = 100000;
+	int rounds = 2;
+
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (arg == "--items" && i + 1 < argc)
+			items = std::max(1l, atol(argv[++i]));
+		else if (arg == "--rounds" && i + 1 < argc)
+			rounds = std::max(1, atoi(argv[++i]));
+		else {
+			fprintf(stderr, "Usage: %s [--items N] [--rounds N]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	const QueuePolicy policies[] = { QUEUE_LATEST_ONLY, QUEUE_DROP_OLDEST, QUEUE_BLOCK };
+	const size_t capacities[] = { 2, 3, 8, 64 };
+	int failures = 0;
+	for (int round = 0; round < rounds; ++round)
+		for (size_t p = 0; p < sizeof(policies) / sizeof(policies[0]); ++p)
+			for (size_t c = 0; c < sizeof(capacities) / sizeof(capacities[0]); ++c)
+				failures += run(policies[p], capacities[c], items);
+
+	printf("%s: %d failed\n", failures ? "FAILED" : "PASSED", failures);
+	return failures ? 1 : 0;
+}
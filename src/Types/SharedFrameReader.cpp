@@ -0,0 +1,202 @@
+/*!
+ * \file
+ * \brief Reader of frames CameraPGR publishes to shared memory
+ * \author Mikolaj Kojdecki
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "SharedFrameReader.hpp"
+
+namespace Sources {
+namespace CameraPGR {
+
+namespace {
+
+boost::uint64_t monotonicNanoseconds() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+}
+
+		SharedFrameReader::SharedFrameReader() :
+			ring(0), size(0), next_frame(0), skipped_frames(0) {
+		}
+
+		SharedFrameReader::~SharedFrameReader() {
+			close();
+		}
+
+		bool SharedFrameReader::open(const std::string & name) {
+			close();
+			const int fd = shm_open(name.c_str(), O_RDONLY, 0);
+			if (fd < 0) {
+				error_message = name + ": " + strerror(errno);
+				return false;
+			}
+			struct stat st;
+			if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(SharedRingHeader)) {
+				error_message = name + ": not a frame ring";
+				::close(fd);
+				return false;
+			}
+			void * mapping = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+			// the mapping keeps the object open
+			::close(fd);
+			if (mapping == MAP_FAILED) {
+				error_message = name + ": " + strerror(errno);
+				return false;
+			}
+			ring = mapping;
+			size = st.st_size;
+
+			const SharedRingHeader & ring_header = *header();
+			if (ring_header.magic.load(boost::memory_order_acquire) != shared_ring_magic || ring_header.version != shared_ring_version
+					|| ring_header.slot_count == 0 || ring_header.first_slot + ring_header.slot_count * ring_header.slot_stride > size
+					|| ring_header.slot_stride < shared_slot_header_bytes + ring_header.slot_bytes) {
+				error_message = name + ": not a frame ring of version 1 (or not ready yet)";
+				close();
+				return false;
+			}
+			// frames published from now on
+			next_frame = ring_header.head.load(boost::memory_order_acquire);
+			skipped_frames = 0;
+			return true;
+		}
+
+		void SharedFrameReader::close() {
+			if (ring)
+				munmap(const_cast<void *>(ring), size);
+			ring = 0;
+			size = 0;
+		}
+
+		bool SharedFrameReader::writerClosed() const {
+			return ring && header()->open.load(boost::memory_order_acquire) == 0;
+		}
+
+		boost::uint64_t SharedFrameReader::slotBytes() const {
+			return ring ? header()->slot_bytes : 0;
+		}
+
+		bool SharedFrameReader::wait(int timeout_ms) {
+			if (!ring)
+				return false;
+			const boost::uint64_t deadline = monotonicNanoseconds() + (timeout_ms > 0 ? timeout_ms : 0) * 1000000ull;
+			for (;;) {
+				// read before the head, so a frame published in between changes it
+				const boost::uint32_t notify = header()->notify.load(boost::memory_order_acquire);
+				if (header()->head.load(boost::memory_order_acquire) > next_frame)
+					return true;
+				if (writerClosed() || timeout_ms == 0)
+					return false;
+				int remaining = -1;
+				if (timeout_ms > 0) {
+					const boost::uint64_t now = monotonicNanoseconds();
+					if (now >= deadline)
+						return false;
+					remaining = (deadline - now + 999999) / 1000000;
+				}
+				sharedRingWait(header()->notify, notify, remaining);
+			}
+		}
+
+		boost::uint64_t SharedFrameReader::oldestFrame(boost::uint64_t head) const {
+			return (head > header()->slot_count) ? head - header()->slot_count : 0;
+		}
+
+		bool SharedFrameReader::copy(boost::uint64_t frame, SharedFrameInfo & info, std::vector<unsigned char> & pixels) {
+			const SharedSlotHeader * slot = sharedSlot(ring, frame);
+			const boost::uint64_t complete = 2 * frame + 2;
+			if (slot->sequence.load(boost::memory_order_acquire) != complete)
+				return false;
+			info = slot->info;
+			const boost::uint64_t bytes = (boost::uint64_t) info.rows * info.step;
+			if (info.rows < 0 || bytes > header()->slot_bytes)
+				return false;
+			pixels.resize(bytes);
+			if (bytes > 0)
+				memcpy(&pixels[0], sharedPixels(slot), bytes);
+			// the copy counts only if the writer did not start on the slot meanwhile
+			boost::atomic_thread_fence(boost::memory_order_acquire);
+			return slot->sequence.load(boost::memory_order_relaxed) == complete;
+		}
+
+		bool SharedFrameReader::next(SharedFrameInfo & info, std::vector<unsigned char> & pixels) {
+			if (!ring)
+				return false;
+			const boost::uint64_t head = header()->head.load(boost::memory_order_acquire);
+			while (next_frame < head) {
+				const boost::uint64_t oldest = oldestFrame(head);
+				if (next_frame < oldest) {
+					skipped_frames += oldest - next_frame;
+					next_frame = oldest;
+				}
+				if (copy(next_frame++, info, pixels))
+					return true;
+				++skipped_frames;
+			}
+			return false;
+		}
+
+		bool SharedFrameReader::latest(SharedFrameInfo & info, std::vector<unsigned char> & pixels) {
+			if (!ring)
+				return false;
+			const boost::uint64_t head = header()->head.load(boost::memory_order_acquire);
+			const boost::uint64_t oldest = std::max(next_frame, oldestFrame(head));
+			// the writer may be filling the slot of the newest frame already
+			// (or have stopped half-way), an older one is still whole
+			for (boost::uint64_t frame = head; frame > oldest; --frame) {
+				if (copy(frame - 1, info, pixels)) {
+					next_frame = head;
+					return true;
+				}
+			}
+			// all overwritten, wait() sleeps until the next one
+			if (head > next_frame) {
+				skipped_frames += head - next_frame;
+				next_frame = head;
+			}
+			return false;
+		}
+
+		const unsigned char * SharedFrameReader::peekLatest(SharedFrameInfo & info) {
+			if (!ring)
+				return 0;
+			const boost::uint64_t head = header()->head.load(boost::memory_order_acquire);
+			// as in latest(), a frame whose slot is being written is passed over
+			for (boost::uint64_t frame = head; frame > oldestFrame(head); --frame) {
+				const SharedSlotHeader * slot = sharedSlot(ring, frame - 1);
+				const boost::uint64_t complete = 2 * frame;
+				if (slot->sequence.load(boost::memory_order_acquire) != complete)
+					continue;
+				info = slot->info;
+				boost::atomic_thread_fence(boost::memory_order_acquire);
+				if (slot->sequence.load(boost::memory_order_relaxed) != complete)
+					continue;
+				next_frame = head;
+				return sharedPixels(slot);
+			}
+			next_frame = std::max(next_frame, head);
+			return 0;
+		}
+
+		bool SharedFrameReader::stillValid(const SharedFrameInfo & info) const {
+			if (!ring)
+				return false;
+			boost::atomic_thread_fence(boost::memory_order_acquire);
+			return sharedSlot(ring, info.frame)->sequence.load(boost::memory_order_relaxed) == 2 * info.frame + 2;
+		}
+
+} //: namespace CameraPGR
+} //: namespace Sources
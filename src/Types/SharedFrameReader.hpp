@@ -0,0 +1,125 @@
+/*!
+ * \file
+ * \brief Reader of frames CameraPGR publishes to shared memory
+ * \author Mikolaj Kojdecki
+ */
+
+#ifndef SHAREDFRAMEREADER_HPP_
+#define SHAREDFRAMEREADER_HPP_
+
+#include <string>
+#include <vector>
+
+#include <boost/cstdint.hpp>
+
+#include "SharedFrameRing.hpp"
+
+namespace Sources {
+namespace CameraPGR {
+
+/*!
+ * \class SharedFrameReader
+ * \brief Reads frames of one camera from the ring given by shm_name of
+ * CameraPGR, in a process of its own. Needs no DisCODe nor OpenCV.
+ *
+ * The ring is mapped read-only, so readers cannot disturb the camera nor
+ * each other, and any number of them may follow it. Frames are copied out
+ * (next(), latest()) or used in place (peekLatest(), then stillValid()).
+ * A reader that falls more than the ring size behind skips to the oldest
+ * frame still there and counts the skipped ones.
+ */
+class SharedFrameReader {
+public:
+	SharedFrameReader();
+
+	~SharedFrameReader();
+
+	/*!
+	 * Maps ring of the name (e.g. "/camerapgr"). Fails if it does not exist
+	 * or is not a ring of this version.
+	 */
+	bool open(const std::string & name);
+
+	void close();
+
+	bool isOpen() const {
+		return ring != 0;
+	}
+
+	/*!
+	 * The component closed the ring (task stopped). A ring created again
+	 * under the same name is followed after open().
+	 */
+	bool writerClosed() const;
+
+	/*!
+	 * Waits at most timeout_ms (-1 - no limit) for a frame not read yet.
+	 * Returns false on timeout.
+	 */
+	bool wait(int timeout_ms);
+
+	/*!
+	 * Copies the oldest frame not read yet into pixels. Returns false if
+	 * there is none.
+	 */
+	bool next(SharedFrameInfo & info, std::vector<unsigned char> & pixels);
+
+	/*!
+	 * Copies the newest frame, skipping older ones not read yet. The one
+	 * before it is taken when the writer is already reusing its slot. Returns
+	 * false if there is no frame newer than the last one read. Never waits.
+	 */
+	bool latest(SharedFrameInfo & info, std::vector<unsigned char> & pixels);
+
+	/*!
+	 * Pixels of the newest frame, in the ring itself. The writer may reuse
+	 * the slot at any time: whatever was computed from them counts only if
+	 * stillValid(info) holds afterwards. As latest(), falls back to an
+	 * older frame and never waits. Returns NULL if there is no frame.
+	 */
+	const unsigned char * peekLatest(SharedFrameInfo & info);
+
+	/*!
+	 * The frame was not overwritten since info was taken.
+	 */
+	bool stillValid(const SharedFrameInfo & info) const;
+
+	/// Frames overwritten or abandoned before they were read
+	boost::uint64_t skipped() const {
+		return skipped_frames;
+	}
+
+	/// Largest frame (bytes) of the ring
+	boost::uint64_t slotBytes() const;
+
+	const std::string & lastError() const {
+		return error_message;
+	}
+
+private:
+	/*!
+	 * Copies frame, returns false if it is not in the ring (any more).
+	 */
+	bool copy(boost::uint64_t frame, SharedFrameInfo & info, std::vector<unsigned char> & pixels);
+
+	/*!
+	 * Oldest frame that may still be in the ring when head frames were published.
+	 */
+	boost::uint64_t oldestFrame(boost::uint64_t head) const;
+
+	const SharedRingHeader * header() const {
+		return static_cast<const SharedRingHeader *>(ring);
+	}
+
+	const void * ring;
+	size_t size;
+	/// Number of the next frame to read
+	boost::uint64_t next_frame;
+	boost::uint64_t skipped_frames;
+	std::string error_message;
+};
+
+} //: namespace CameraPGR
+} //: namespace Sources
+
+#endif /* SHAREDFRAMEREADER_HPP_ */
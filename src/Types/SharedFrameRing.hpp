@@ -0,0 +1,155 @@
+/*!
+ * \file
+ * \brief Layout of the shared memory ring CameraPGR publishes frames to
+ * \author Mikolaj Kojdecki
+ */
+
+#ifndef SHAREDFRAMERING_HPP_
+#define SHAREDFRAMERING_HPP_
+
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/static_assert.hpp>
+
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#endif
+
+namespace Sources {
+namespace CameraPGR {
+
+/*
+ * A ring is a POSIX shared memory object (shm_open) written by one
+ * CameraPGR camera and read by any number of processes:
+ *
+ *   SharedRingHeader | ... | slot 0 | slot 1 | ... | slot slot_count-1
+ *
+ * Frame f (counted from 0) goes to slot f % slot_count, which starts with a
+ * SharedSlotHeader followed by the pixels, rows one after another. The
+ * sequence of the slot works as a seqlock: it is 2f+1 while frame f is being
+ * written and 2f+2 once it is complete. A reader copies the frame when the
+ * sequence is 2f+2 and keeps the copy if it still is afterwards. The writer
+ * never waits for readers; a reader too slow for the ring misses frames.
+ */
+
+/// "PGRS", written last when the ring is created
+const boost::uint32_t shared_ring_magic = 0x53524750;
+const boost::uint32_t shared_ring_version = 1;
+/// Bytes from the start of a slot to its pixels
+const boost::uint64_t shared_slot_header_bytes = 256;
+
+BOOST_STATIC_ASSERT(BOOST_ATOMIC_INT64_LOCK_FREE == 2 && BOOST_ATOMIC_INT32_LOCK_FREE == 2);
+
+/*!
+ * \struct SharedFrameInfo
+ * \brief Image layout and capture information of a frame in the ring.
+ */
+struct SharedFrameInfo {
+	/// Number of the frame, counted from 0 by the writer
+	boost::uint64_t frame;
+	boost::int32_t rows;
+	boost::int32_t cols;
+	/// OpenCV type: CV_8UC3 (BGR), CV_8UC1 or CV_16UC1
+	boost::int32_t type;
+	/// Bytes per row, rows follow each other without gaps
+	boost::uint32_t step;
+
+	/// Camera clock in ns, wraps every 128 s
+	boost::uint64_t camera_time;
+	boost::int64_t timestamp_seconds;
+	boost::uint32_t timestamp_microseconds;
+	/// Frame counter of the camera
+	boost::uint32_t frame_counter;
+	/// CLOCK_MONOTONIC (ns) at which the frame was received, comparable between processes of the host
+	boost::uint64_t received;
+	/// Shutter (ms) and gain (dB) last read from the camera, -1 - not known
+	float shutter;
+	float gain;
+	/// Sensor position of the top-left pixel
+	boost::uint32_t offset_x;
+	boost::uint32_t offset_y;
+	/// Serial number of the camera
+	boost::uint32_t serial;
+	boost::uint32_t reserved;
+};
+
+struct SharedSlotHeader {
+	/// 2f+1 - frame f being written, 2f+2 - frame f complete
+	boost::atomic<boost::uint64_t> sequence;
+	SharedFrameInfo info;
+};
+
+BOOST_STATIC_ASSERT(sizeof(SharedSlotHeader) <= shared_slot_header_bytes);
+// futex words are plain 32-bit integers
+BOOST_STATIC_ASSERT(sizeof(boost::atomic<boost::uint32_t>) == 4);
+
+struct SharedRingHeader {
+	/// shared_ring_magic once the rest of the header is set
+	boost::atomic<boost::uint32_t> magic;
+	boost::uint32_t version;
+	boost::uint32_t slot_count;
+	boost::uint32_t reserved;
+	/// Largest frame (bytes of pixels) a slot holds
+	boost::uint64_t slot_bytes;
+	/// Offset of slot 0 from the start of the ring and distance between slots
+	boost::uint64_t first_slot;
+	boost::uint64_t slot_stride;
+	/// Number of the newest complete frame + 1, 0 - none yet
+	boost::atomic<boost::uint64_t> head;
+	/// Changed with every frame, readers wait on it
+	boost::atomic<boost::uint32_t> notify;
+	/// 1 while the writer publishes, 0 after it closed the ring
+	boost::atomic<boost::uint32_t> open;
+};
+
+inline SharedSlotHeader * sharedSlot(void * ring, boost::uint64_t frame) {
+	const SharedRingHeader * header = static_cast<const SharedRingHeader *>(ring);
+	return reinterpret_cast<SharedSlotHeader *>(static_cast<unsigned char *>(ring) + header->first_slot
+			+ (frame % header->slot_count) * header->slot_stride);
+}
+
+inline const SharedSlotHeader * sharedSlot(const void * ring, boost::uint64_t frame) {
+	return sharedSlot(const_cast<void *>(ring), frame);
+}
+
+inline unsigned char * sharedPixels(SharedSlotHeader * slot) {
+	return reinterpret_cast<unsigned char *>(slot) + shared_slot_header_bytes;
+}
+
+inline const unsigned char * sharedPixels(const SharedSlotHeader * slot) {
+	return reinterpret_cast<const unsigned char *>(slot) + shared_slot_header_bytes;
+}
+
+/*!
+ * Waits until notify differs from value, at most timeout_ms (-1 - no limit).
+ * Returns early on signals; callers check the ring again anyway.
+ */
+inline void sharedRingWait(const boost::atomic<boost::uint32_t> & notify, boost::uint32_t value, int timeout_ms) {
+#ifdef __linux__
+	// not FUTEX_PRIVATE_FLAG, the word is shared between processes
+	struct timespec timeout;
+	timeout.tv_sec = timeout_ms / 1000;
+	timeout.tv_nsec = (timeout_ms % 1000) * 1000000L;
+	syscall(SYS_futex, &notify, FUTEX_WAIT, value, timeout_ms >= 0 ? &timeout : NULL, NULL, 0);
+#else
+	// polled, one period of a fast camera at most
+	if (timeout_ms != 0 && notify.load(boost::memory_order_acquire) == value)
+		usleep(1000);
+#endif
+}
+
+inline void sharedRingWake(boost::atomic<boost::uint32_t> & notify) {
+	notify.fetch_add(1, boost::memory_order_release);
+#ifdef __linux__
+	syscall(SYS_futex, &notify, FUTEX_WAKE, 0x7fffffff, NULL, NULL, 0);
+#endif
+}
+
+} //: namespace CameraPGR
+} //: namespace Sources
+
+#endif /* SHAREDFRAMERING_HPP_ */
@@ -0,0 +1,78 @@
+/*!
+ * \file
+ * \brief Example reader of frames CameraPGR publishes to shared memory
+ * \author Mikolaj Kojdecki
+ *
+ * Follows the ring given as shm_name of CameraPGR (e.g. "/camerapgr") and
+ * prints once a second how many frames came, how many were missed and how
+ * long after capture they were read. With "latest" it takes only the newest
+ * frame each time, as a slow consumer (e.g. inference) would.
+ *
+ *   shm_reader /camerapgr [latest]
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <vector>
+
+#include "SharedFrameReader.hpp"
+
+using namespace Sources::CameraPGR;
+
+namespace {
+
+boost::uint64_t monotonicNanoseconds() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+}
+
+int main(int argc, char * argv[]) {
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s <shm_name> [latest]\n", argv[0]);
+		return 1;
+	}
+	const bool newest = (argc > 2 && strcmp(argv[2], "latest") == 0);
+
+	SharedFrameReader reader;
+	if (!reader.open(argv[1])) {
+		fprintf(stderr, "%s\n", reader.lastError().c_str());
+		return 1;
+	}
+	printf("%s: frames up to %llu bytes\n", argv[1], (unsigned long long) reader.slotBytes());
+
+	SharedFrameInfo info;
+	std::vector<unsigned char> pixels;
+	boost::uint64_t report = monotonicNanoseconds() + 1000000000ull;
+	unsigned long frames = 0;
+	boost::uint64_t latency_sum = 0;
+	boost::uint64_t skipped = 0;
+	while (!reader.writerClosed()) {
+		if (reader.wait(100)) {
+			while (newest ? reader.latest(info, pixels) : reader.next(info, pixels)) {
+				// pixels hold info.rows rows of info.step bytes, e.g. cv::Mat(info.rows, info.cols, info.type, &pixels[0])
+				latency_sum += monotonicNanoseconds() - info.received;
+				++frames;
+			}
+		}
+
+		const boost::uint64_t now = monotonicNanoseconds();
+		if (now >= report) {
+			printf("%lu frames, missed %llu, capture to copy %.2f ms", frames, (unsigned long long) (reader.skipped() - skipped),
+					frames > 0 ? latency_sum / 1e6 / frames : 0.0);
+			if (frames > 0)
+				printf(", last %dx%d type %d camera %u", info.cols, info.rows, info.type, info.serial);
+			printf("\n");
+			fflush(stdout);
+			frames = 0;
+			latency_sum = 0;
+			skipped = reader.skipped();
+			report = now + 1000000000ull;
+		}
+	}
+	printf("%s closed by the camera component\n", argv[1]);
+	return 0;
+}